@@ -0,0 +1,410 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @brief Replication benchmark.  One writer process drives SET/DEL at a
+ * rate, doubling each round, to K replica processes on loopback.  Each round
+ * reports the propagation latency percentiles of a probe key, the rate
+ * reached and the time for every replica to converge on the writer's table.
+ * A node joining the final table is timed last.
+ *
+ * Build and run with "make replbench", options are passed in BENCHARGS.
+ */
+
+#ifdef REPL_BENCH
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "hash.h"
+
+/** Benchmark value, the time it was written and the op number */
+typedef struct {
+    int64_t ts;     /**< CLOCK_MONOTONIC nsec when set */
+    uint64_t n;     /**< Op number, or round for the marker */
+} bench_v;
+
+DEFINE_LIST(Bench,int,bench_v);
+
+#define BENCH_PROBE -1      /**< Key set every BENCH_PROBE_NS for latency */
+#define BENCH_MARK -2       /**< Key set at the end of each round */
+#define BENCH_PROBE_NS 1000000
+#define BENCH_SAMPLES 65536 /**< Latency samples kept per round */
+#define BENCH_CONVERGE_NS 5000000000L /**< Longest wait for a replica */
+
+/** Options */
+static struct {
+    int replicas;           /**< Number of replica processes */
+    long rate;              /**< Ops per second of the first round */
+    long maxRate;           /**< Ops per second of the last round */
+    int secs;               /**< Seconds per round */
+    int keys;               /**< Number of data keys */
+    int delPct;             /**< Percent of ops that are deletes */
+    bool local;             /**< Use the shared memory transport */
+    uint16_t port;          /**< Replication port */
+} opt = {
+    .replicas=2,
+    .rate=10000,
+    .maxRate=320000,
+    .secs=1,
+    .keys=10000,
+    .delPct=10,
+    .port=6600,
+};
+
+/** Result of one round on one replica */
+typedef struct {
+    int round;
+    long samples;           /**< Probe updates seen */
+    long p50,p90,p99,max;   /**< Latency in nsec */
+    long converge;          /**< nsec from the marker to a matching table, <0 if not */
+    long mismatch;          /**< Keys that differ at timeout */
+} bench_result_t;
+
+/** Return CLOCK_MONOTONIC in nsec */
+static inline int64_t nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000L+ts.tv_nsec;
+}
+
+/** Rate of a round */
+static long bench_rate(int round)
+{
+    return opt.rate<<round;
+}
+
+/** Number of rounds up to maxRate */
+static int bench_rounds(void)
+{
+    int r=0;
+    while (bench_rate(r)<=opt.maxRate) r++;
+    return r;
+}
+
+/** Ops in a round */
+static long bench_ops(int round)
+{
+    return bench_rate(round)*opt.secs;
+}
+
+/** Op number is a delete, a fixed mix so replicas can replay it */
+static inline bool bench_del(uint64_t n)
+{
+    return ((n*0x9e3779b97f4a7c15ULL)>>32)%100<(uint64_t)opt.delPct;
+}
+
+/** Replay a round into the expected table, n of each key or -1 if deleted */
+static void bench_expect(int64_t *expect,int round,uint64_t *base)
+{
+    long ops=bench_ops(round);
+    long i;
+
+    for (i=0;i<ops;i++) {
+        uint64_t n=*base+i;
+        expect[n%opt.keys]=(bench_del(n)) ? -1 : (int64_t)n;
+    }
+    *base+=ops;
+}
+
+/** Count the keys that differ from the expected table */
+static long bench_mismatch(int64_t *expect)
+{
+    long miss=0;
+    bench_v v;
+    int k;
+
+    for (k=0;k<opt.keys;k++) {
+        bool has=BenchGet(k,&v);
+        if (expect[k]<0) {
+            if (has) miss++;
+        } else if ((!has)||(v.n!=(uint64_t)expect[k])) {
+            miss++;
+        }
+    }
+    return miss;
+}
+
+static int cmpLong(const void *a,const void *b)
+{
+    long x=*(const long *)a;
+    long y=*(const long *)b;
+    return (x>y)-(x<y);
+}
+
+/** Start replication on the chosen transport */
+static bool bench_start(void)
+{
+    if (opt.local) return BenchNetStartLocal(opt.port);
+    return BenchNetStart(opt.port);
+}
+
+/** Replica process, reports each round on fd */
+static void bench_replica(int fd)
+{
+    int64_t *expect=malloc(opt.keys*sizeof(*expect));
+    long *lat=malloc(BENCH_SAMPLES*sizeof(*lat));
+    int rounds=bench_rounds();
+    uint64_t base=0;
+    uint64_t probe=0;
+    int round=0;
+    long nlat=0;
+
+    if ((expect==NULL)||(lat==NULL)||(!bench_start())) exit(1);
+    BenchNetSync(1000);
+    memset(expect,0xff,opt.keys*sizeof(*expect));
+
+    while (round<rounds) {
+        bench_result_t res;
+        bench_v v;
+
+        /* Poll the probe key for latency samples */
+        if ((BenchGet(BENCH_PROBE,&v))&&(v.n!=probe)) {
+            probe=v.n;
+            if (nlat<BENCH_SAMPLES) lat[nlat++]=nsec()-v.ts;
+        }
+        if ((!BenchGet(BENCH_MARK,&v))||(v.n!=round)) {
+            sched_yield();
+            continue;
+        }
+
+        /* Round over, wait for the table to match the writer */
+        memset(&res,0,sizeof(res));
+        res.round=round;
+        bench_expect(expect,round,&base);
+        while (((res.mismatch=bench_mismatch(expect))!=0)&&
+                (nsec()-v.ts<BENCH_CONVERGE_NS)) {
+            usleep(1000);
+        }
+        res.converge=(res.mismatch) ? -1 : nsec()-v.ts;
+        res.samples=nlat;
+        if (nlat) {
+            qsort(lat,nlat,sizeof(*lat),cmpLong);
+            res.p50=lat[nlat/2];
+            res.p90=lat[nlat*9/10];
+            res.p99=lat[nlat*99/100];
+            res.max=lat[nlat-1];
+        }
+        if (write(fd,&res,sizeof(res))!=sizeof(res)) break;
+        nlat=0;
+        round++;
+    }
+    BenchFree();
+    free(expect);
+    free(lat);
+    exit(0);
+}
+
+/** Drive one round at its rate, return the rate reached */
+static double bench_drive(int round,uint64_t *base)
+{
+    long ops=bench_ops(round);
+    double step=1e9/bench_rate(round);
+    int64_t start=nsec();
+    int64_t nextProbe=start;
+    bench_v v;
+    long i;
+
+    for (i=0;i<ops;i++) {
+        uint64_t n=*base+i;
+        int64_t now=nsec();
+        int64_t due=start+(int64_t)(i*step);
+
+        /* Sleep when ahead, run flat out when behind */
+        if (due-now>100000) {
+            struct timespec ts={0,due-now};
+            nanosleep(&ts,NULL);
+            now=nsec();
+        }
+        if (bench_del(n)) {
+            BenchDel(n%opt.keys);
+        } else {
+            v.ts=now;
+            v.n=n;
+            BenchSet(n%opt.keys,v);
+        }
+        if (now>=nextProbe) {
+            v.ts=nsec();
+            v.n=n+1;
+            BenchSet(BENCH_PROBE,v);
+            nextProbe=now+BENCH_PROBE_NS;
+        }
+    }
+    *base+=ops;
+    v.ts=nsec();
+    v.n=round;
+    BenchSet(BENCH_MARK,v);
+    return ops/((v.ts-start)/1e9);
+}
+
+/** Joining node, started when a byte is read from fd */
+static void bench_join(int fd)
+{
+    int64_t *expect=malloc(opt.keys*sizeof(*expect));
+    uint64_t base=0;
+    int64_t start;
+    bool synced;
+    char go=0;
+    long miss;
+    int r;
+
+    if ((read(fd,&go,1)!=1)||(!go)||(expect==NULL)) exit(0);
+    memset(expect,0xff,opt.keys*sizeof(*expect));
+    for (r=0;r<bench_rounds();r++) bench_expect(expect,r,&base);
+
+    start=nsec();
+    if (!bench_start()) exit(1);
+    synced=BenchNetSync(BENCH_CONVERGE_NS/1000000);
+    while (((miss=bench_mismatch(expect))!=0)&&(nsec()-start<BENCH_CONVERGE_NS)) {
+        usleep(1000);
+    }
+    printf("join: %d entries, %s in %.3f ms, %ld keys differ\n",BenchCount(),
+            (synced) ? "synced" : "sync timeout",(nsec()-start)/1e6,miss);
+    BenchFree();
+    free(expect);
+    exit(0);
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr,"%s [-k replicas] [-r rate] [-m maxrate] [-s secs] "
+            "[-n keys] [-d delete%%] [-p port] [-l]\n"
+            "  -l  shared memory transport instead of multicast\n",name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    pid_t *pids;
+    pid_t join;
+    int joinFd[2];
+    int *fds;
+    uint64_t base=0;
+    long best=0;
+    int rounds;
+    int c,i,r;
+
+    while ((c=getopt(argc,argv,"k:r:m:s:n:d:p:l"))!=-1) {
+        switch (c) {
+            case 'k': opt.replicas=atoi(optarg); break;
+            case 'r': opt.rate=atol(optarg); break;
+            case 'm': opt.maxRate=atol(optarg); break;
+            case 's': opt.secs=atoi(optarg); break;
+            case 'n': opt.keys=atoi(optarg); break;
+            case 'd': opt.delPct=atoi(optarg); break;
+            case 'p': opt.port=atoi(optarg); break;
+            case 'l': opt.local=true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if ((opt.replicas<1)||(opt.rate<1)||(opt.secs<1)||(opt.keys<1)) usage(argv[0]);
+    rounds=bench_rounds();
+    pids=calloc(opt.replicas,sizeof(*pids));
+    fds=calloc(opt.replicas,sizeof(*fds));
+    if ((pids==NULL)||(fds==NULL)) return 1;
+
+    printf("%d replicas, %s, %d keys, %d%% deletes, %d s rounds\n",
+            opt.replicas,(opt.local) ? "shared memory" : "multicast",
+            opt.keys,opt.delPct,opt.secs);
+
+    /* Replicas and the joiner are forked before any replication thread
+     * exists */
+    fflush(stdout);
+    if (pipe(joinFd)<0) return 1;
+    join=fork();
+    if (join==0) {
+        close(joinFd[1]);
+        bench_join(joinFd[0]);
+    }
+    close(joinFd[0]);
+    for (i=0;i<opt.replicas;i++) {
+        int p[2];
+        if (pipe(p)<0) return 1;
+        pids[i]=fork();
+        if (pids[i]==0) {
+            close(p[0]);
+            bench_replica(p[1]);
+        }
+        close(p[1]);
+        fds[i]=p[0];
+    }
+    if (!bench_start()) return 1;
+    BenchNetSync(1000);
+    /* Let the replicas finish their own start */
+    usleep(500000);
+
+    printf("%10s %10s %9s %9s %9s %9s %11s\n","target/s","actual/s",
+            "p50 us","p90 us","p99 us","max us","converge ms");
+    for (r=0;r<rounds;r++) {
+        bench_result_t worst={.converge=0};
+        double actual=bench_drive(r,&base);
+        bool ok=true;
+
+        for (i=0;i<opt.replicas;i++) {
+            struct pollfd pfd={.fd=fds[i],.events=POLLIN};
+            bench_result_t res;
+
+            if ((poll(&pfd,1,(int)(BENCH_CONVERGE_NS/1000000)+1000)<=0)||
+                    (read(fds[i],&res,sizeof(res))!=sizeof(res))) {
+                ok=false;
+                worst.converge=-1;
+                continue;
+            }
+            if (res.p50>worst.p50) worst.p50=res.p50;
+            if (res.p90>worst.p90) worst.p90=res.p90;
+            if (res.p99>worst.p99) worst.p99=res.p99;
+            if (res.max>worst.max) worst.max=res.max;
+            if ((res.converge<0)||(worst.converge<0)) worst.converge=-1;
+            else if (res.converge>worst.converge) worst.converge=res.converge;
+            if (res.mismatch) ok=false;
+        }
+        printf("%10ld %10.0f %9.1f %9.1f %9.1f %9.1f ",bench_rate(r),actual,
+                worst.p50/1e3,worst.p90/1e3,worst.p99/1e3,worst.max/1e3);
+        if (worst.converge<0) printf("%11s\n","lost");
+        else printf("%11.3f\n",worst.converge/1e6);
+        fflush(stdout);
+        if (!ok) break;
+        /* Sustained means every replica converged at 95% of the target */
+        if (actual>=0.95*bench_rate(r)) best=bench_rate(r);
+    }
+    printf("sustained: %ld ops/s\n",best);
+    fflush(stdout);
+
+    /* Only the writer holds the table while the joiner starts */
+    for (i=0;i<opt.replicas;i++) {
+        kill(pids[i],SIGTERM);
+        waitpid(pids[i],NULL,0);
+        close(fds[i]);
+    }
+    {
+        char go=(r==rounds);
+        if (write(joinFd[1],&go,1)!=1) kill(join,SIGTERM);
+        close(joinFd[1]);
+        waitpid(join,NULL,0);
+    }
+    BenchFree();
+    free(pids);
+    free(fds);
+    return 0;
+}
+#endif /* REPL_BENCH */
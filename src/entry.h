@@ -34,16 +34,25 @@ extern "C" {
 typedef struct {
     void *key;      /**< Pointer to Key */
     void *val;      /**< Pointer to Value */
+    uint32_t flags; /**< Entry state, see @ref ENTRY_DIRTY */
+    uint32_t expire;/**< TTL wheel tick the entry expires at, 0 for none */
 #ifdef LIST_ENTRY_LOCK
     pthread_mutex_t *lock;  /**< Mutex for individual entry */
     bool lock_en;           /**< Flag to indicate flag is not being deleted */
 #endif
 } _entry_t;
 
+#define ENTRY_DIRTY 0x01    /**< Entry changed since the last snapshot */
+#define ENTRY_STALE 0x02    /**< Entry not yet confirmed by a replica pull */
+#define ENTRY_PENDING 0x04  /**< Entry update held in a coalescing window */
+#define ENTRY_REF 0x08      /**< Cache entry read since the CLOCK hand passed */
+#define ENTRY_TIMER 0x10    /**< Expiry timer fires early and moves to expire */
+
 /* Utility Functions for managing list */
 /* Central Search and insert function */
 void *_hash_search(list_store_t *store,void *keyref,void *valref);
 int _find_index(list_store_t *store,void *keyref);
+size_t _next_index(list_store_t *store,void *keyref,size_t hint);
 void _delete_entry(list_store_t *store,int index);
 #ifdef LIST_ENTRY_LOCK
 /* Delete lock by index */
@@ -61,10 +61,16 @@
  * <hr>
  * @copydetails LIST_FUNCTION_NETSTART
  * <hr>
+ * @copydetails LIST_FUNCTION_NETFILTER
+ * <hr>
  * @copydetails LIST_FUNCTION_LOAD
  * <hr>
  * @copydetails LIST_FUNCTION_SAVE
  * <hr>
+ * @copydetails LIST_FUNCTION_DELTA
+ * <hr>
+ * @copydetails LIST_FUNCTION_SHARDED
+ * <hr>
  * @copydetails LIST_FUNCTION_FREE
  * <hr>
  * @copydetails LIST_FUNCTION_LOCK
@@ -92,10 +98,14 @@
 #include<search.h>
 #include<unistd.h>
 #include<assert.h>
+#include<limits.h>
+#include<time.h>
+#include<sys/stat.h>
 
 #include "hash.h"
 #include "repl.h"
 #include "entry.h"
+#include "wheel.h"
 
 #ifdef HDEBUG
 #include <errno.h>
@@ -111,6 +121,75 @@ static inline void *list_resize(list_store_t *store);
 static inline void * bfind(const void *key, const void *base, size_t *nmemb, 
         size_t size, __compar_fn_t compar,size_t *slot);
 static char *hash_print(const list_type_info_t *type,const void *val);
+/* Snapshot change tracking */
+static bool list_tombstone(list_store_t *store,void *key);
+static void list_clean(list_store_t *store);
+/* Range search */
+static size_t list_bound(list_store_t *store,void *keyref,bool upper);
+static inline _entry_t *list_gallop(list_store_t *store,void *keyref,size_t *pos);
+/* Entry expiry and cache */
+static inline _entry_t *list_access(list_store_t *store,_entry_t *eptr);
+static _entry_t *list_evict(list_store_t *store,_entry_t *keep);
+static void list_ttl_stop(list_store_t *store);
+
+#ifndef LIST_TTL_TICK_MS
+#define LIST_TTL_TICK_MS 10 /**< Resolution of entry expiry times */
+#endif
+#define LIST_TTL_BATCH 1024 /**< Entries the reaper expires per lock */
+#ifndef LIST_DELTA_DELETES
+#define LIST_DELTA_DELETES (64*1024) /**< Deleted keys kept for one delta */
+#endif
+
+/** Store has an entry or byte limit */
+#define LIST_CACHE(store) (((store)->capacity)||((store)->budget))
+/** Bytes an entry counts against the cache budget, with its list slot */
+#define LIST_ENTRY_BYTES(store,eptr) (sizeof(_entry_t)+(store)->key.sz((eptr)->key)+\
+        (store)->value.sz((eptr)->val))
+
+/** Expiry of the entries of a store, created by the first SetTTL */
+struct list_ttl {
+    wheel_t *wheel;         /**< Expiry ticks of the keys */
+    long epoch;             /**< Time in usec of tick 0 */
+    pthread_t reaper;       /**< Thread deleting expired entries */
+    pthread_cond_t cond;    /**< Wakes the reaper for a new key or to stop */
+    uint32_t wake;          /**< Tick the reaper sleeps until */
+    bool idle;              /**< Reaper sleeps until a key is added */
+    bool stop;              /**< Reaper exit request */
+};
+
+/* Delta snapshot file format: header then records of op, key, value */
+#define DELTA_ID 0x44454c54 /**< Xor'd with store id for delta file header */
+#define DELTA_SET 1         /**< Delta record: key and value follow */
+#define DELTA_DEL 2         /**< Delta record: key follows */
+
+/** Sharded snapshot file header */
+typedef struct {
+    uint32_t id;        /**< Store id, as in a full save */
+    uint32_t shard;     /**< Shard number of this file */
+    uint32_t count;     /**< Total number of shards */
+} shard_hdr_t;
+
+/** Work for one shard of a parallel load */
+typedef struct {
+    list_store_t *store;    /**< Store the shard is loaded for */
+    char path[PATH_MAX];    /**< Shard file */
+    uint32_t shard;         /**< Expected shard number */
+    uint32_t count;         /**< Expected shard count */
+    _entry_t *list;         /**< Decoded entries */
+    size_t index;           /**< Number of decoded entries */
+    bool ok;                /**< Shard decoded without error */
+} shard_job_t;
+
+/** Thread arguments for a parallel load */
+typedef struct {
+    shard_job_t *jobs;      /**< All shard jobs */
+    int count;              /**< Number of jobs */
+    int first;              /**< First job for this thread */
+    int step;               /**< Job stride, number of threads */
+} shard_worker_t;
+
+static bool shard_decode(shard_job_t *job);
+static void *shard_thread(void *arg);
 
 static uint32_t pyHash(const uint8_t *a,int s,uint32_t x);
 
@@ -165,8 +244,14 @@ void *_hash_search(list_store_t *store,void *keyref,void *valref)
 
         if (eptr) {
             /* Value already exists, Update it with new value */
-            if (valref)
+            if (valref) {
+                if (store->net) repl_digest(store,eptr);
                 memcpy(eptr->val,valref,store->value.size);
+                eptr->flags|=ENTRY_DIRTY;
+                eptr->flags&=~(ENTRY_STALE|ENTRY_TIMER);
+                eptr->expire=0;
+                if (store->net) repl_digest(store,eptr);
+            }
         } else if (valref) {
             /* Convert value reference if needed */
             entry.val=valref;
@@ -181,7 +266,13 @@ void *_hash_search(list_store_t *store,void *keyref,void *valref)
             eptr->key=store->key.alloc(entry.key);
             eptr->val=store->value.alloc(entry.val);
             if ((eptr->key)&&(eptr->val)) {
+                eptr->flags=ENTRY_DIRTY;
                 store->index++;
+                if (store->net) repl_digest(store,eptr);
+                if (LIST_CACHE(store)) {
+                    store->bytes+=LIST_ENTRY_BYTES(store,eptr);
+                    eptr=list_evict(store,eptr);
+                }
             } else {
                 /* On failure return values as needed and clear the slot */
                 dbg("Mem:%s allocation failure: size: %lu slot: %lu key: %p  val: %p",
@@ -202,9 +293,13 @@ bool _list_insert(list_store_t *store,void *keyref,void *valref)
     bool ret=false;
     _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
 
+    /* A paced writer waits for queue room outside the lock */
+    if (store->port) repl_reserve(store);
     pthread_mutex_lock(&store->lock);
-    eptr=_hash_search(store,keyref,valref);
-    if (eptr) {
+    if ((store->net)&&(!repl_owned(store,keyref))) {
+        /* A partitioned store sends keys it does not own to their owners */
+        ret=repl_forward(store,keyref,valref);
+    } else if ((eptr=_hash_search(store,keyref,valref))) {
         dbgentry(eptr);
         ret=true;
         if (store->port) repl_update(store,eptr);
@@ -223,13 +318,301 @@ bool _list_insert(list_store_t *store,void *keyref,void *valref)
     return ret;
 }
 
+/** Current tick of the expiry wheel */
+static inline uint32_t list_ttl_now(list_ttl_t *ttl)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((ts.tv_sec*1000000 + ts.tv_nsec/1000)-ttl->epoch)/(LIST_TTL_TICK_MS*1000);
+}
+
+/** Delete an entry and send the delete, under the store lock */
+static void list_expire(list_store_t *store,_entry_t *eptr)
+{
+    dbgentry(eptr);
+    if (store->port) repl_remove(store,eptr->key);
+    _delete_entry(store,EIdx(eptr));
+}
+
+/** Entry of a read if it has not expired, an expired entry is deleted.
+ * A cache marks the entry referenced for the CLOCK hand. */
+static inline _entry_t *list_access(list_store_t *store,_entry_t *eptr)
+{
+    if ((eptr)&&(eptr->expire)&&(store->ttl)&&
+            ((int32_t)(list_ttl_now(store->ttl)-eptr->expire)>=0)) {
+        list_expire(store,eptr);
+        eptr=NULL;
+    }
+    if ((eptr)&&(LIST_CACHE(store))) eptr->flags|=ENTRY_REF;
+    return eptr;
+}
+
+/** Wheel callback, delete the entry if it has expired.  A SetTTL that
+ * extends the expiry sets ENTRY_TIMER instead of adding a timer, and the
+ * first timer of the entry to fire early takes the flag and moves to the new
+ * tick.  Other early timers were left by a Set or a shorter SetTTL and are
+ * dropped, so an entry has one timer following its expiry. */
+static void list_ttl_fire(void *keyref,uint32_t expire,void *ctx)
+{
+    list_store_t *store=ctx;
+    _entry_t *eptr=_hash_search(store,keyref,false);
+    void *key;
+
+    /* A Set without expiry leaves a stale timer */
+    if ((eptr==NULL)||(eptr->expire==0)) return;
+    if ((int32_t)(eptr->expire-list_ttl_now(store->ttl))>0) {
+        if ((eptr->flags&ENTRY_TIMER)&&((key=store->key.alloc(eptr->key)))) {
+            if (wheel_add(store->ttl->wheel,key,eptr->expire)) {
+                eptr->flags&=~ENTRY_TIMER;
+            } else {
+                free(key);
+            }
+        }
+        return;
+    }
+    list_expire(store,eptr);
+}
+
+/** Reaper thread, expires entries as their ticks pass, a batch per lock.
+ * It sleeps until the next tick with keys, or until a key is added. */
+static void *list_reaper(void *arg)
+{
+    list_store_t *store=arg;
+    list_ttl_t *ttl=store->ttl;
+    long tickUs=LIST_TTL_TICK_MS*1000L;
+    struct timespec ts;
+    long at;
+    int batch,count;
+
+    for (;;) {
+        /* A batch of deletes is no larger than a paced queue has room for */
+        batch=(store->port) ? repl_room(store,LIST_TTL_BATCH) : LIST_TTL_BATCH;
+        pthread_mutex_lock(&store->lock);
+        if (ttl->stop) break;
+        count=wheel_advance(ttl->wheel,list_ttl_now(ttl),list_ttl_fire,store,
+                batch);
+        if (count==batch) {
+            /* More are waiting, let other threads in between batches */
+            pthread_mutex_unlock(&store->lock);
+            sched_yield();
+            continue;
+        }
+        ttl->idle=!wheel_next(ttl->wheel,&ttl->wake);
+        if (ttl->idle) {
+            pthread_cond_wait(&ttl->cond,&store->lock);
+            pthread_mutex_unlock(&store->lock);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        at=ts.tv_sec*1000000L+ts.tv_nsec/1000-ttl->epoch;
+        /* Start of the wake tick, counted from the current one */
+        at=ttl->epoch+(at/tickUs+(int32_t)(ttl->wake-(uint32_t)(at/tickUs)))*tickUs;
+        ts.tv_sec=at/1000000L;
+        ts.tv_nsec=(at%1000000L)*1000;
+        pthread_cond_timedwait(&ttl->cond,&store->lock,&ts);
+        pthread_mutex_unlock(&store->lock);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+/** Create the expiry wheel and reaper of a store, under the store lock */
+static bool list_ttl_start(list_store_t *store)
+{
+    list_ttl_t *ttl;
+    pthread_condattr_t attr;
+    struct timespec ts;
+
+    if (store->ttl) return true;
+    ttl=calloc(1,sizeof(*ttl));
+    if (ttl==NULL) return false;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    /* Tick 0 is in the past, an expire of 0 means none */
+    ttl->epoch=(ts.tv_sec*1000000 + ts.tv_nsec/1000)-LIST_TTL_TICK_MS*1000;
+    ttl->wheel=wheel_init(list_ttl_now(ttl));
+    /* The reaper sleeps to a tick of the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+    pthread_cond_init(&ttl->cond,&attr);
+    pthread_condattr_destroy(&attr);
+    store->ttl=ttl;
+    if ((ttl->wheel==NULL)||(pthread_create(&ttl->reaper,NULL,list_reaper,store))) {
+        store->ttl=NULL;
+        if (ttl->wheel) wheel_free(ttl->wheel);
+        pthread_cond_destroy(&ttl->cond);
+        free(ttl);
+        return false;
+    }
+    return true;
+}
+
+/** Stop the reaper and free the expiry wheel */
+static void list_ttl_stop(list_store_t *store)
+{
+    list_ttl_t *ttl=store->ttl;
+
+    pthread_mutex_lock(&store->lock);
+    ttl->stop=true;
+    pthread_cond_signal(&ttl->cond);
+    pthread_mutex_unlock(&store->lock);
+    pthread_join(ttl->reaper,NULL);
+
+    pthread_mutex_lock(&store->lock);
+    store->ttl=NULL;
+    pthread_mutex_unlock(&store->lock);
+    wheel_free(ttl->wheel);
+    pthread_cond_destroy(&ttl->cond);
+    free(ttl);
+}
+
+/**
+ * Insert or update an entry that expires after ttlms.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param valref pointer to the value
+ * @param ttlms time to live in milliseconds, 0 for no expiry
+ * @return false on allocation failure, or for a key a partitioned store
+ * does not own
+ */
+bool _list_insert_ttl(list_store_t *store,void *keyref,void *valref,long ttlms)
+{
+    bool ret=false;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    void *key;
+
+    if (ttlms<=0) return _list_insert(store,keyref,valref);
+    /* The expiry is kept where the entry is */
+    if ((store->partition)&&(store->net)&&(!repl_owned(store,keyref))) return false;
+
+    if (store->port) repl_reserve(store);
+    pthread_mutex_lock(&store->lock);
+    if (list_ttl_start(store)) {
+        list_ttl_t *ttl=store->ttl;
+        long ticks=(ttlms+LIST_TTL_TICK_MS-1)/LIST_TTL_TICK_MS;
+        uint32_t expire;
+        uint32_t pending=0;
+        bool timer=false;
+        bool move=false;
+
+        /* Expiry ticks compare as signed differences */
+        if (ticks>INT32_MAX) ticks=INT32_MAX;
+        expire=list_ttl_now(ttl)+ticks;
+
+        /* A timer pending at or before the new expiry moves to it */
+        if ((eptr=_hash_search(store,keyref,false))) pending=eptr->expire;
+        if ((pending)&&((int32_t)(expire-pending)>=0)) {
+            /* The same tick keeps a move still to come */
+            timer=true;
+            move=((expire!=pending)||(eptr->flags&ENTRY_TIMER));
+        } else if ((key=store->key.alloc(keyref))) {
+            timer=wheel_add(ttl->wheel,key,expire);
+            if (!timer) free(key);
+            /* Wake a reaper sleeping past the new tick */
+            else if ((ttl->idle)||((int32_t)(expire-ttl->wake)<0)) {
+                pthread_cond_signal(&ttl->cond);
+            }
+        }
+        if ((timer)&&((eptr=_hash_search(store,keyref,valref)))) {
+            /* The update cleared the flag, a new timer is at expire */
+            if (move) eptr->flags|=ENTRY_TIMER;
+            eptr->expire=expire;
+            dbgentry(eptr);
+            ret=true;
+            if (store->port) repl_update(store,eptr);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ret;
+}
+
+/**
+ * Run fn on the value of a key under one lock and one search, and send the
+ * result as a single update when fn reports a change.  A missing key starts
+ * from a zero value when insert is set, and a second search adds it.  A
+ * partitioned store only changes keys it owns.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param fn callback with the key reference, value and ctx, true on a change
+ * @param ctx pointer passed to fn
+ * @param insert true to add a missing key
+ * @return true if fn changed the value and it was stored, false for a key a
+ * partitioned store does not own
+ */
+bool _list_update(list_store_t *store,void *keyref,_list_visit_fn_t fn,void *ctx,bool insert)
+{
+    bool ret=false;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    void *value;
+    assert(store);
+
+    /* Only an owner changes the key under its lock */
+    if ((store->partition)&&(store->net)&&(!repl_owned(store,keyref))) return false;
+
+    if (store->port) repl_reserve(store);
+    pthread_mutex_lock(&store->lock);
+    eptr=list_access(store,_hash_search(store,keyref,false));
+    if (eptr) {
+        /* The digest takes the value out and back in around the change */
+        if (store->net) repl_digest(store,eptr);
+        ret=fn(eptr->key,eptr->val,ctx);
+        if (ret) {
+            eptr->flags|=ENTRY_DIRTY;
+            eptr->flags&=~ENTRY_STALE;
+        }
+        if (store->net) repl_digest(store,eptr);
+    } else if ((insert)&&((value=calloc(1,store->value.size)))) {
+        if (fn(keyref,value,ctx)) eptr=_hash_search(store,keyref,value);
+        ret=(eptr!=NULL);
+        free(value);
+    }
+    if (ret) {
+        dbgentry(eptr);
+        if (store->port) repl_update(store,eptr);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ret;
+}
+
+/** Compare and set context */
+typedef struct {
+    list_store_t *store;
+    void *expected;
+    void *desired;
+} list_cas_t;
+
+/** Replace the value when it matches expected, compared as bytes since a
+ * value type has no comparison.  Padding would make equal values differ. */
+static bool list_cas(const void *key,void *value,void *ctx)
+{
+    list_cas_t *cas=ctx;
+
+    if (memcmp(value,cas->expected,cas->store->value.size)) return false;
+    cas->store->value.cp(value,cas->desired);
+    return true;
+}
+
+/**
+ * Set the value of an existing key to desired if it equals expected.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param expected pointer to the value to compare
+ * @param desired pointer to the new value
+ * @return true if the value was replaced
+ */
+bool _list_cas(list_store_t *store,void *keyref,void *expected,void *desired)
+{
+    list_cas_t cas={.store=store,.expected=expected,.desired=desired};
+
+    return _list_update(store,keyref,list_cas,&cas,false);
+}
+
 void *_list_reference(list_store_t *store,void *keyref)
 {
     _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
     void *value=NULL;
 
     pthread_mutex_lock(&store->lock);
-    eptr=_hash_search(store,keyref,false);
+    eptr=list_access(store,_hash_search(store,keyref,false));
     if (eptr) {
         assert(eptr->val);
         value=eptr->val;
@@ -289,7 +672,7 @@ bool _list_copy(list_store_t *store,void *keyref,void *value)
     assert(store);
 
     pthread_mutex_lock(&store->lock);
-    eptr=_hash_search(store,keyref,false);
+    eptr=list_access(store,_hash_search(store,keyref,false));
     if (eptr) {
         assert(eptr->val);
         store->value.cp(value,eptr->val);
@@ -297,11 +680,130 @@ bool _list_copy(list_store_t *store,void *keyref,void *value)
         dbgentry(eptr);
     }
     pthread_mutex_unlock(&store->lock);
+    /* Ask the owners for a key a partitioned store does not hold */
+    if ((!ret)&&(store->partition)&&(store->net)) {
+        ret=repl_fetch(store,keyref,value);
+    }
 
     return ret;
 }
 
 
+/** Key reference of element i of a key array, a hash has an array of strings */
+static inline void *list_keyarg(list_store_t *store,void *keys,int i,bool str)
+{
+    if (str) return ((char **)keys)[i];
+    return (uint8_t *)keys+(size_t)i*store->key.size;
+}
+
+/**
+ * Copy the values of n keys under one lock.  The probe keys are sorted, if
+ * they are not already, and the list is walked once, galloping from the last
+ * match to bound each binary search.  With found given, a partitioned store
+ * fetches the keys it does not hold from their owners afterwards.
+ * @param store pointer to store structure.
+ * @param keys array of n keys, an array of strings for a hash
+ * @param n number of keys
+ * @param vals array of n values for return, missing keys are not written
+ * @param found array of n flags for return, or NULL
+ * @return number of keys found
+ */
+int _list_copy_many(list_store_t *store,void *keys,int n,void *vals,bool *found)
+{
+    bool str=!strcmp(store->key.name,"STR");
+    _entry_t *probe=NULL;   /**< Probe keys in key order, val is the index */
+    _entry_t *eptr;
+#ifndef LSEARCH
+    size_t pos=0;           /**< Walk position, the last key found */
+#endif
+    int count=0;
+    int i;
+    assert(store);
+
+    if (n<=0) return 0;
+    if (found) memset(found,0x00,n*sizeof(*found));
+    probe=malloc(n*sizeof(*probe));
+    if (probe) {
+        for (i=0;i<n;i++) {
+            probe[i].key=list_keyarg(store,keys,i,str);
+            probe[i].val=(void *)(intptr_t)i;
+        }
+        /* Presorted probes are common, only sort when one is out of order */
+        for (i=1;(i<n)&&(store->key.cmp(&probe[i-1],&probe[i])<=0);i++);
+        if (i<n) qsort(probe,n,sizeof(*probe),store->key.cmp);
+    }
+
+    pthread_mutex_lock(&store->lock);
+    for (i=0;i<n;i++) {
+        int index=(probe) ? (int)(intptr_t)probe[i].val : i;
+
+        if (probe) {
+#ifndef LSEARCH
+            eptr=list_gallop(store,probe[i].key,&pos);
+#else
+            eptr=_hash_search(store,probe[i].key,false);
+#endif
+        } else {
+            /* No memory to sort, search for each key */
+            eptr=_hash_search(store,list_keyarg(store,keys,i,str),false);
+        }
+        eptr=list_access(store,eptr);
+        if (eptr) {
+            store->value.cp((uint8_t *)vals+(size_t)index*store->value.size,eptr->val);
+            if (found) found[index]=true;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    free(probe);
+
+    /* Ask the owners for the keys a partitioned store does not hold */
+    if ((store->partition)&&(store->net)&&(found)) {
+        for (i=0;i<n;i++) {
+            if (found[i]) continue;
+            found[i]=repl_fetch(store,list_keyarg(store,keys,i,str),
+                    (uint8_t *)vals+(size_t)i*store->value.size);
+            if (found[i]) count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Call fn on the stored value of a key, under the store lock and without a
+ * copy.  A partitioned store fetches a key it does not hold from its owners
+ * into a temporary value.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param fn callback with the key reference, value and ctx
+ * @param ctx pointer passed to fn
+ * @return false if the key is missing, otherwise the return of fn
+ */
+bool _list_visit(list_store_t *store,void *keyref,_list_visit_fn_t fn,void *ctx)
+{
+    bool found=false;
+    bool ret=false;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    eptr=list_access(store,_hash_search(store,keyref,false));
+    if (eptr) {
+        found=true;
+        ret=fn(eptr->key,eptr->val,ctx);
+    }
+    pthread_mutex_unlock(&store->lock);
+    if ((!found)&&(store->partition)&&(store->net)) {
+        void *value=malloc(store->value.size);
+
+        if ((value)&&(repl_fetch(store,keyref,value))) {
+            ret=fn(keyref,value,ctx);
+        }
+        free(value);
+    }
+    return ret;
+}
+
 /**
  * @brief Internal list lookup function used by the hash library
  * This function returns the entry at a specific location.
@@ -349,67 +851,294 @@ bool _list_items(list_store_t *store,int index,void *keyref,void *value)
 int _list_index(list_store_t *store,void *keyref)
 {
     int index=-1;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
     assert(store);
 
     pthread_mutex_lock(&store->lock);
-    index=_find_index(store,keyref);
+    eptr=list_access(store,_hash_search(store,keyref,false));
+    if (eptr) index=EIdx(eptr);
     dbgindex(index);
     pthread_mutex_unlock(&store->lock);
     return index;
 }
 
 /**
- * Start sharing list/hash on network at port
+ * Index of the first entry not less than the key, or greater than the key
+ * for the upper bound.
  * @param store pointer to store structure.
- * @param port mcast/udp port number
- * @return true on success, false on fail
+ * @param keyref pointer to the key
+ * @param upper true to skip an entry equal to the key
+ * @return index of the bound, the count when every key is before it
  */
-bool _list_netstart(list_store_t *store,uint16_t port)
+int _list_bound(list_store_t *store,void *keyref,bool upper)
 {
-    bool ret=true;
-    dbg("Starting thread on port: %u",port);
+    int index=0;
+    assert(store);
 
-    /* Ensure list is initialized */
-    if (!list_init(store)) return false;
+    pthread_mutex_lock(&store->lock);
+    if (store->list) index=list_bound(store,keyref,upper);
+    pthread_mutex_unlock(&store->lock);
+    return index;
+}
 
-    if (store->net) {
-        dbg("Error, thread already running");
-        ret=false;
-    } else {
-        if (port) {
-            store->port=port;
-            ret=repl_start(store);
-        } else {
-            dbg("Error, port not non-zero");
-            ret=false;
+/**
+ * Visit the entries with keys from lo to hi inclusive, in list order, under
+ * one lock.  The callback must not call into the same store.
+ * @param store pointer to store structure.
+ * @param lo pointer to the first key
+ * @param hi pointer to the last key
+ * @param fn callback with the key reference, value and ctx, false to stop
+ * @param ctx pointer passed to fn
+ * @return number of entries visited
+ */
+int _list_range(list_store_t *store,void *lo,void *hi,_list_visit_fn_t fn,void *ctx)
+{
+    _entry_t *eptr;
+    int count=0;
+    size_t i;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    if (store->list) {
+#ifndef LSEARCH
+        i=list_bound(store,lo,false);
+#else
+        i=0;
+#endif
+        for (;i<store->index;i++) {
+            eptr=((_entry_t *)store->list)+i;
+#ifndef LSEARCH
+            /* Sorted, nothing after this key is in range */
+            if (store->key.cmp(&eptr->key,&hi)>0) break;
+#else
+            if ((store->key.cmp(&eptr->key,&lo)<0)||
+                    (store->key.cmp(&eptr->key,&hi)>0)) continue;
+#endif
+            count++;
+            if (!fn(eptr->key,eptr->val,ctx)) break;
         }
     }
-
-    return ret;
+    pthread_mutex_unlock(&store->lock);
+    return count;
 }
 
-bool _list_load(list_store_t *store,char *file)
+/**
+ * Visit the string keys starting with prefix, in list order, under one lock.
+ * The keys sharing a prefix follow its lower bound in the strcmp order.
+ * @param store pointer to store structure with string keys.
+ * @param prefix leading characters of the keys
+ * @param fn callback with the key, value and ctx, false to stop
+ * @param ctx pointer passed to fn
+ * @return number of entries visited
+ */
+int _list_prefix(list_store_t *store,const char *prefix,_list_visit_fn_t fn,void *ctx)
 {
-    FILE *fp=NULL;
-    uint32_t loadId=0;
-    void *key=NULL;
-    void *val=NULL;
+    size_t len=strnlen(prefix,HASH_MAX_STR);
+    _entry_t *eptr;
+    int count=0;
+    size_t i;
     assert(store);
 
     pthread_mutex_lock(&store->lock);
-    /* Check if store is initialized */
-    if (!list_init(store)) return false;
+    if (store->list) {
+#ifndef LSEARCH
+        i=list_bound(store,(void *)prefix,false);
+#else
+        i=0;
+#endif
+        for (;i<store->index;i++) {
+            eptr=((_entry_t *)store->list)+i;
+            if (strncmp(eptr->key,prefix,len)) {
+#ifndef LSEARCH
+                /* Sorted, the matching keys are contiguous */
+                break;
+#else
+                continue;
+#endif
+            }
+            count++;
+            if (!fn(eptr->key,eptr->val,ctx)) break;
+        }
+    }
     pthread_mutex_unlock(&store->lock);
-    
-    dbg("list: %p, Size: %lu",store->list,store->index);
-    
-    /* Open file for reading */
-    if ((fp=fopen(file,"r"))==NULL) {
-        dbg("Failed to open file %s for reading: %s",file,strerror(errno));
+    return count;
+}
+
+/**
+ * Wait for the initial sync after starting network sharing
+ * @param store pointer to store structure.
+ * @param tmOutms maximum wait in milliseconds
+ * @return true when synced, false on timeout or if sharing is not started
+ */
+bool _list_netsync(list_store_t *store,long tmOutms)
+{
+    return repl_wait_sync(store,tmOutms);
+}
+
+/**
+ * Set the window for collapsing repeated updates of a key
+ * @param store pointer to store structure.
+ * @param tmOutms window in milliseconds, 0 to send every update
+ * @return false if sharing is not started
+ */
+bool _list_netcoalesce(list_store_t *store,long tmOutms)
+{
+    return repl_coalesce(store,tmOutms);
+}
+
+/**
+ * Limit the send rate of the store
+ * @param store pointer to store structure.
+ * @param rate bytes per second, 0 for no limit
+ * @param burst bytes sent at full speed after an idle time
+ * @return false if sharing is not started
+ */
+bool _list_netpace(list_store_t *store,long rate,long burst)
+{
+    return repl_pace(store,rate,burst);
+}
+
+/**
+ * Add a range of keys to receive from the network
+ * @param store pointer to store structure.
+ * @param lo reference to the first key
+ * @param hi reference to the last key
+ * @return false if sharing is started or on allocation failure
+ */
+bool _list_netfilter(list_store_t *store,void *lo,void *hi)
+{
+    void **filter;
+
+    if (store->net) return false;
+    filter=realloc(store->filter,(store->nfilter+1)*2*sizeof(*filter));
+    if (filter==NULL) return false;
+    store->filter=filter;
+    filter+=store->nfilter*2;
+    filter[0]=store->key.alloc(lo);
+    filter[1]=store->key.alloc(hi);
+    if ((filter[0]==NULL)||(filter[1]==NULL)) {
+        if (filter[0]) free(filter[0]);
+        if (filter[1]) free(filter[1]);
         return false;
     }
+    store->nfilter++;
+    return true;
+}
 
-    /* Check header matches this list/hash type and data sizes
+/**
+ * Bound the store as a cache, evicting with CLOCK past the limits
+ * @param store pointer to store structure.
+ * @param max most entries, 0 for no limit
+ * @param bytes most bytes of entries, 0 for no limit
+ * @return false if sharing is started
+ */
+bool _list_cache(list_store_t *store,int max,size_t bytes)
+{
+    size_t i;
+
+    if ((store->net)||(max<0)) return false;
+    pthread_mutex_lock(&store->lock);
+    store->capacity=max;
+    store->budget=bytes;
+    store->bytes=0;
+    store->hand=0;
+    for (i=0;(LIST_CACHE(store))&&(i<store->index);i++) {
+        store->bytes+=LIST_ENTRY_BYTES(store,((_entry_t *)store->list)+i);
+    }
+    if (store->list) list_evict(store,NULL);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Keep only the keys this node owns, with replicas owners for each key
+ * @param store pointer to store structure.
+ * @param replicas number of nodes keeping each key
+ * @return false if sharing is started or replicas is out of range
+ */
+bool _list_netpartition(list_store_t *store,int replicas)
+{
+    if ((store->net)||(replicas<1)||(replicas>REPL_REPLICAS_MAX)) return false;
+    store->partition=replicas;
+    return true;
+}
+
+/**
+ * Start sharing list/hash on network at port
+ * @param store pointer to store structure.
+ * @param port mcast/udp port number
+ * @return true on success, false on fail
+ */
+bool _list_netstart(list_store_t *store,uint16_t port)
+{
+    bool ret=true;
+    dbg("Starting thread on port: %u",port);
+
+    /* Ensure list is initialized */
+    if (!list_init(store)) return false;
+
+    if (store->net) {
+        dbg("Error, thread already running");
+        ret=false;
+    } else if (LIST_CACHE(store)) {
+        dbg("Error, a cache evicts entries the other nodes keep");
+        ret=false;
+    } else {
+        if (port) {
+            store->port=port;
+            store->local=false;
+            ret=repl_start(store);
+        } else {
+            dbg("Error, port not non-zero");
+            ret=false;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Start sharing list/hash with processes on this host through shared memory
+ * @param store pointer to store structure.
+ * @param port port number naming the shared memory ring
+ * @return true on success, false on fail
+ */
+bool _list_netlocal(list_store_t *store,uint16_t port)
+{
+    /* Ensure list is initialized */
+    if (!list_init(store)) return false;
+
+    if ((store->net)||(port==0)||(LIST_CACHE(store))) return false;
+    store->port=port;
+    store->local=true;
+    return repl_start(store);
+}
+
+bool _list_load(list_store_t *store,char *file)
+{
+    FILE *fp=NULL;
+    uint32_t loadId=0;
+    void *key=NULL;
+    void *val=NULL;
+    bool empty;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    /* Check if store is initialized */
+    if (!list_init(store)) return false;
+    /* A load into an empty list is a base for delta snapshots */
+    empty=(store->index==0);
+    pthread_mutex_unlock(&store->lock);
+    
+    dbg("list: %p, Size: %lu",store->list,store->index);
+    
+    /* Open file for reading */
+    if ((fp=fopen(file,"r"))==NULL) {
+        dbg("Failed to open file %s for reading: %s",file,strerror(errno));
+        return false;
+    }
+
+    /* Check header matches this list/hash type and data sizes
      * Header: name hash */
     if ((fread(&loadId,sizeof(loadId),1,fp)!=1)||
         (loadId!=store->id)) {
@@ -455,6 +1184,12 @@ bool _list_load(list_store_t *store,char *file)
 
     /* Load complete close file and return success */
     fclose(fp);
+    if (empty) {
+        pthread_mutex_lock(&store->lock);
+        list_clean(store);
+        store->snap=true;
+        pthread_mutex_unlock(&store->lock);
+    }
     return true;
 }
 
@@ -514,10 +1249,513 @@ bool _list_save(list_store_t *store,char *file)
 
     /* Save complete close file and return success */
     fclose(fp);
+    /* File is now the base for delta snapshots */
+    list_clean(store);
+    store->snap=true;
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Start or stop keeping deleted keys for delta snapshots.  Stopping drops
+ * the keys already kept, and with them the base of the next delta.
+ * @param store pointer to store structure.
+ * @param enable true to keep deleted keys
+ */
+void _list_delta_track(list_store_t *store,bool enable)
+{
+    pthread_mutex_lock(&store->lock);
+    if ((!enable)&&(store->ndeleted)) {
+        list_clean(store);
+        store->snap=false;
+    }
+    store->delta=enable;
+    pthread_mutex_unlock(&store->lock);
+}
+
+/**
+ * Save the changes since the last snapshot.
+ * Deleted keys are written first followed by changed entries, so replaying
+ * the file in order gives the current list.
+ * @param store pointer to store structure.
+ * @param file delta file name
+ * @return true on success, false on fail or when there is no base snapshot
+ */
+bool _list_save_delta(list_store_t *store,char *file)
+{
+    FILE *fp=NULL;
+    int i;
+    uint32_t id;
+    uint8_t op;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    /* Check if store is initialized */
+    if (!list_init(store)) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    /* Changes are only known relative to a full snapshot */
+    if (!store->snap) {
+        dbg("No base snapshot for delta %s",file);
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    /* Open file for writting */
+    if ((fp=fopen(file,"w"))==NULL) {
+        dbg("Failed to open file %s for writting: %s",file,strerror(errno));
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    /* Header differs from a full save so the two can not be mixed up */
+    id=store->id^DELTA_ID;
+    if (fwrite(&id,sizeof(id),1,fp)!=1) {
+        dbg("Header error for %s: %s",file,strerror(errno));
+        fclose(fp); unlink(file);
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    /* Deleted keys */
+    op=DELTA_DEL;
+    for (i=0;i<store->ndeleted;i++) {
+        if ((fwrite(&op,sizeof(op),1,fp)!=1)||
+            (fwrite(store->deleted[i],store->key.size,1,fp)!=1)) {
+            dbg("delete write error for %s: %s",file,strerror(errno));
+            fclose(fp); unlink(file);
+            pthread_mutex_unlock(&store->lock);
+            return false;
+        }
+    }
+
+    /* Changed entries */
+    op=DELTA_SET;
+    for (i=0;i<store->index;i++) {
+        eptr=((_entry_t *)store->list)+i;
+        if (!(eptr->flags&ENTRY_DIRTY)) continue;
+        if ((fwrite(&op,sizeof(op),1,fp)!=1)||
+            (fwrite(eptr->key,store->key.size,1,fp)!=1)||
+            (fwrite(eptr->val,store->value.size,1,fp)!=1)) {
+            dbg("entry write error for %s: %s",file,strerror(errno));
+            fclose(fp); unlink(file);
+            pthread_mutex_unlock(&store->lock);
+            return false;
+        }
+    }
+
+    if (fclose(fp)) {
+        dbg("close error for %s: %s",file,strerror(errno));
+        unlink(file);
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    /* Next delta starts from here */
+    list_clean(store);
     pthread_mutex_unlock(&store->lock);
     return true;
 }
 
+/**
+ * Apply a delta written by _list_save_delta() to the list
+ * @param store pointer to store structure.
+ * @param file delta file name
+ * @return true on success, false on fail
+ */
+bool _list_load_delta(list_store_t *store,char *file)
+{
+    FILE *fp=NULL;
+    uint32_t loadId=0;
+    uint8_t op;
+    void *key=NULL;
+    void *val=NULL;
+    bool ret=true;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    /* Check if store is initialized */
+    if (!list_init(store)) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    /* Open file for reading */
+    if ((fp=fopen(file,"r"))==NULL) {
+        dbg("Failed to open file %s for reading: %s",file,strerror(errno));
+        return false;
+    }
+
+    /* Check header matches a delta of this list/hash type */
+    if ((fread(&loadId,sizeof(loadId),1,fp)!=1)||
+        (loadId!=(store->id^DELTA_ID))) {
+        dbg("Header error for %s: %s",file,strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    key=malloc(store->key.size);
+    val=malloc(store->value.size);
+    if ((!key)||(!val)) {
+        dbg("Memory error for %s: %s",file,strerror(errno));
+        if (key) free(key);
+        if (val) free(val);
+        fclose(fp);
+        return false;
+    }
+
+    /* Replay records in order */
+    while ((ret)&&(fread(&op,sizeof(op),1,fp)==1)) {
+        if (fread(key,store->key.size,1,fp)!=1) {
+            dbg("Key read failed for %s: %s",file,strerror(errno));
+            ret=false;
+        } else if (op==DELTA_DEL) {
+            _list_remove(store,key);
+        } else if (op==DELTA_SET) {
+            if (fread(val,store->value.size,1,fp)!=1) {
+                dbg("Value read failed for %s: %s",file,strerror(errno));
+                ret=false;
+            } else if (!_list_insert(store,key,val)) {
+                dbg("Insert failed for %s: %s",file,strerror(errno));
+                ret=false;
+            }
+        } else {
+            dbg("Unknown record %u in %s",op,file);
+            ret=false;
+        }
+    }
+    free(key);
+    free(val);
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * Merge a base snapshot and its deltas into a new full snapshot.
+ * The merge is done in a private list of the same type, so the contents of
+ * store are not changed.
+ * @param store pointer to store structure, used for the type information.
+ * @param file output file, may be the same as base
+ * @param base full snapshot file
+ * @param deltas delta files in the order they were saved
+ * @param count number of deltas
+ * @return true on success, false on fail
+ */
+bool _list_compact(list_store_t *store,char *file,char *base,char **deltas,int count)
+{
+    bool ret;
+    int i;
+    list_store_t tmp={.name=store->name,.imax=store->imax,
+        .key=store->key,.value=store->value};
+    assert(store);
+
+    pthread_mutex_init(&tmp.lock,NULL);
+    ret=_list_load(&tmp,base);
+    for (i=0;(ret)&&(i<count);i++) {
+        ret=_list_load_delta(&tmp,deltas[i]);
+    }
+    if (ret) ret=_list_save(&tmp,file);
+    _list_free(&tmp);
+    pthread_mutex_destroy(&tmp.lock);
+    return ret;
+}
+
+/**
+ * Save the list as key range partitioned shard files.
+ * Shard s holds entries [s*n/shards,(s+1)*n/shards) so every file is sorted
+ * and the files are in key order.
+ * @param store pointer to store structure.
+ * @param dir folder for the shard files
+ * @param shards number of files
+ * @return true on success, false on fail
+ */
+bool _list_save_sharded(list_store_t *store,char *dir,int shards)
+{
+    FILE *fp=NULL;
+    char path[PATH_MAX];
+    shard_hdr_t hdr;
+    size_t i,end;
+    int s;
+    _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    assert(store);
+
+    if (shards<1) return false;
+
+    pthread_mutex_lock(&store->lock);
+    /* Check if store is initialized */
+    if (!list_init(store)) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    hdr.id=store->id;
+    hdr.count=shards;
+    for (s=0;s<shards;s++) {
+        snprintf(path,sizeof(path),"%s/%s.%d",dir,store->name,s);
+        if ((fp=fopen(path,"w"))==NULL) {
+            dbg("Failed to open file %s for writting: %s",path,strerror(errno));
+            break;
+        }
+        hdr.shard=s;
+        if (fwrite(&hdr,sizeof(hdr),1,fp)!=1) {
+            dbg("Header error for %s: %s",path,strerror(errno));
+            fclose(fp); unlink(path);
+            break;
+        }
+        end=(store->index*(s+1))/shards;
+        for (i=(store->index*s)/shards;i<end;i++) {
+            eptr=((_entry_t *)store->list)+i;
+            if ((fwrite(eptr->key,store->key.size,1,fp)!=1)||
+                (fwrite(eptr->val,store->value.size,1,fp)!=1)) {
+                dbg("entry write error for %s: %s",path,strerror(errno));
+                break;
+            }
+        }
+        if ((fclose(fp))||(i<end)) {
+            unlink(path);
+            break;
+        }
+    }
+
+    if (s<shards) {
+        /* Remove the partial set */
+        while (--s>=0) {
+            snprintf(path,sizeof(path),"%s/%s.%d",dir,store->name,s);
+            unlink(path);
+        }
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    /* Shards are a full snapshot */
+    list_clean(store);
+    store->snap=true;
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Load shard files written by _list_save_sharded() using parallel threads.
+ * Each thread reads and allocates the entries of its shards.  When the list
+ * is empty the decoded shards are concatenated directly into the list.
+ * @param store pointer to store structure.
+ * @param dir folder of the shard files
+ * @param threads maximum number of decode threads
+ * @return true on success, false on fail
+ */
+bool _list_load_parallel(list_store_t *store,char *dir,int threads)
+{
+    FILE *fp=NULL;
+    char path[PATH_MAX];
+    shard_hdr_t hdr;
+    shard_job_t *jobs=NULL;
+    shard_worker_t *workers=NULL;
+    pthread_t *handles=NULL;
+    size_t total=0;
+    bool ret=true;
+    int i,t;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    /* Check if store is initialized */
+    if (!list_init(store)) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    /* First shard holds the shard count */
+    snprintf(path,sizeof(path),"%s/%s.0",dir,store->name);
+    if ((fp=fopen(path,"r"))==NULL) {
+        dbg("Failed to open file %s for reading: %s",path,strerror(errno));
+        return false;
+    }
+    if ((fread(&hdr,sizeof(hdr),1,fp)!=1)||(hdr.id!=store->id)||
+        (hdr.shard!=0)||(hdr.count==0)) {
+        dbg("Header error for %s: %s",path,strerror(errno));
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    if (threads<1) threads=1;
+    if (threads>hdr.count) threads=hdr.count;
+    jobs=calloc(hdr.count,sizeof(*jobs));
+    workers=calloc(threads,sizeof(*workers));
+    handles=calloc(threads,sizeof(*handles));
+    if ((!jobs)||(!workers)||(!handles)) {
+        dbg("Memory error for %u shards",hdr.count);
+        if (jobs) free(jobs);
+        if (workers) free(workers);
+        if (handles) free(handles);
+        return false;
+    }
+
+    for (i=0;i<hdr.count;i++) {
+        jobs[i].store=store;
+        jobs[i].shard=i;
+        jobs[i].count=hdr.count;
+        snprintf(jobs[i].path,sizeof(jobs[i].path),"%s/%s.%d",dir,store->name,i);
+    }
+
+    /* Decode, the calling thread takes the first stripe */
+    for (t=0;t<threads;t++) {
+        workers[t].jobs=jobs;
+        workers[t].count=hdr.count;
+        workers[t].first=t;
+        workers[t].step=threads;
+    }
+    for (t=1;t<threads;t++) {
+        if (pthread_create(&handles[t],NULL,shard_thread,&workers[t])) {
+            /* Run it here instead */
+            handles[t]=0;
+            shard_thread(&workers[t]);
+        }
+    }
+    shard_thread(&workers[0]);
+    for (t=1;t<threads;t++) {
+        if (handles[t]) pthread_join(handles[t],NULL);
+    }
+
+    for (i=0;i<hdr.count;i++) {
+        if (!jobs[i].ok) ret=false;
+        total+=jobs[i].index;
+    }
+
+    if (ret) {
+        pthread_mutex_lock(&store->lock);
+        if (store->index==0) {
+            /* Shards are sorted key ranges, concatenate in shard order */
+            if (total>store->max) {
+                void *newmem=realloc(store->list,store->size*total);
+                if (newmem) {
+                    store->list=newmem;
+                    store->max=total;
+                } else {
+                    dbg("Resize ERROR %d to %lu",store->max,total);
+                    ret=false;
+                }
+            }
+            for (i=0;(ret)&&(i<hdr.count);i++) {
+                memcpy(((_entry_t *)store->list)+store->index,jobs[i].list,
+                        jobs[i].index*sizeof(_entry_t));
+                store->index+=jobs[i].index;
+                jobs[i].index=0;
+            }
+            if (ret) {
+                if (store->port) {
+                    for (i=0;i<store->index;i++) {
+                        repl_digest(store,((_entry_t *)store->list)+i);
+                        repl_update(store,((_entry_t *)store->list)+i);
+                    }
+                }
+                /* Load into an empty list is a base for delta snapshots */
+                list_clean(store);
+                store->snap=true;
+            }
+            pthread_mutex_unlock(&store->lock);
+        } else {
+            /* Merge with existing entries */
+            pthread_mutex_unlock(&store->lock);
+            for (i=0;i<hdr.count;i++) {
+                size_t e;
+                for (e=0;e<jobs[i].index;e++) {
+                    _entry_t *eptr=jobs[i].list+e;
+                    if ((ret)&&(!_list_insert(store,eptr->key,eptr->val))) {
+                        dbg("Insert failed for %s",jobs[i].path);
+                        ret=false;
+                    }
+                }
+            }
+        }
+    }
+
+    /* Release anything not moved into the list */
+    for (i=0;i<hdr.count;i++) {
+        size_t e;
+        for (e=0;e<jobs[i].index;e++) {
+            free(jobs[i].list[e].key);
+            free(jobs[i].list[e].val);
+        }
+        if (jobs[i].list) free(jobs[i].list);
+    }
+    free(jobs);
+    free(workers);
+    free(handles);
+    return ret;
+}
+
+/** Parallel load thread, decodes every step'th shard */
+static void *shard_thread(void *arg)
+{
+    shard_worker_t *worker=arg;
+    int i;
+
+    for (i=worker->first;i<worker->count;i+=worker->step) {
+        worker->jobs[i].ok=shard_decode(&worker->jobs[i]);
+    }
+    return NULL;
+}
+
+/** Read and allocate all entries of one shard file */
+static bool shard_decode(shard_job_t *job)
+{
+    list_store_t *store=job->store;
+    FILE *fp=NULL;
+    struct stat st;
+    shard_hdr_t hdr;
+    size_t rsize=store->key.size+store->value.size;
+    size_t n;
+    uint8_t *buf=NULL;
+
+    if ((fp=fopen(job->path,"r"))==NULL) {
+        dbg("Failed to open file %s for reading: %s",job->path,strerror(errno));
+        return false;
+    }
+    if ((fstat(fileno(fp),&st))||(st.st_size<sizeof(hdr))||
+        ((st.st_size-sizeof(hdr))%rsize)||
+        (fread(&hdr,sizeof(hdr),1,fp)!=1)||(hdr.id!=store->id)||
+        (hdr.shard!=job->shard)||(hdr.count!=job->count)) {
+        dbg("Header error for %s: %s",job->path,strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    n=(st.st_size-sizeof(hdr))/rsize;
+    if (n) {
+        job->list=calloc(n,sizeof(_entry_t));
+        buf=malloc(rsize);
+        if ((!job->list)||(!buf)) {
+            dbg("Memory error for %s: %lu entries",job->path,n);
+            if (buf) free(buf);
+            fclose(fp);
+            return false;
+        }
+    }
+
+    while (job->index<n) {
+        _entry_t *eptr=job->list+job->index;
+        if (fread(buf,rsize,1,fp)!=1) {
+            dbg("Entry read failed for %s: %s",job->path,strerror(errno));
+            break;
+        }
+        eptr->key=store->key.alloc(buf);
+        eptr->val=store->value.alloc(buf+store->key.size);
+        if ((!eptr->key)||(!eptr->val)) {
+            dbg("Memory error for %s",job->path);
+            if (eptr->key) free(eptr->key);
+            if (eptr->val) free(eptr->val);
+            break;
+        }
+        job->index++;
+    }
+    if (buf) free(buf);
+    fclose(fp);
+    return (job->index==n);
+}
+
 /**
  * Free entire list
  * @param store pointer to store structure.
@@ -531,11 +1769,32 @@ bool _list_free(list_store_t *store)
     /* Check parameter */
     if (!store) return false;
 
+    /* The reaper sends expiry deletes, stop it before the network */
+    if (store->ttl) list_ttl_stop(store);
     if (store->port) {
         repl_close(store);
     }
 
     pthread_mutex_lock(&store->lock);
+    /* Freed list is no longer related to any snapshot */
+    store->snap=false;
+    list_clean(store);
+    if (store->deleted) {
+        free(store->deleted);
+        store->deleted=NULL;
+        store->maxdeleted=0;
+    }
+    if (store->filter) {
+        int i;
+        for (i=0;i<store->nfilter*2;i++) free(store->filter[i]);
+        free(store->filter);
+        store->filter=NULL;
+        store->nfilter=0;
+    }
+    store->partition=0;
+    store->capacity=0;
+    store->budget=0;
+    store->hand=0;
     while(store->index) {
         /* Delete from end */
 #ifdef LIST_ENTRY_LOCK
@@ -553,6 +1812,7 @@ bool _list_free(list_store_t *store)
         store->max=0;
         store->index=0;
     }
+    store->bytes=0;
     pthread_mutex_unlock(&store->lock);
     assert(ret);
     return ret;
@@ -575,6 +1835,7 @@ bool _list_remove_value(list_store_t *store,int index,void *value)
     _delete_lock(store,index);
 #endif
 
+    if (store->port) repl_reserve(store);
     /* Grab the lock and enure the entry key is still valid */
     pthread_mutex_lock(&store->lock);
     if ((index<((int)store->index))&&(store->index)) {
@@ -613,6 +1874,7 @@ bool _list_remove(list_store_t *store,void *keyref)
     _delete_lock(store,index);
 #endif
 
+    if (store->port) repl_reserve(store);
     /* Grab the lock and enure the entry key is still valid */
     pthread_mutex_lock(&store->lock);
     if (store->port) repl_remove(store,keyref);
@@ -678,6 +1940,125 @@ int _find_index(list_store_t *store,void *keyref)
     return ret;
 }
 
+/** Index of the first entry after keyref, without locks.
+ * Used to resume a walk of the list after the lock has been released.
+ * @param store pointer to store structure.
+ * @param keyref last key visited
+ * @param hint index to use when the position can not be found
+ * @return index of the next entry
+ */
+size_t _next_index(list_store_t *store,void *keyref,size_t hint)
+{
+    _entry_t entry;             /**< Temp entry for key lookup */
+    _entry_t *eptr=NULL;
+    size_t slot=hint;
+
+    entry.key=keyref;
+#ifndef LSEARCH
+    eptr=bfind(&entry, store->list, &store->index,store->size,
+            store->key.cmp,&slot);
+#else
+    /* Unsorted, only an existing key gives a position */
+    eptr=lfind(&entry, store->list, &store->index,store->size,
+            store->key.cmp);
+#endif
+    if (eptr) slot=EIdx(eptr)+1;
+    return slot;
+}
+
+/** Evict with the CLOCK hand until the cache is within its limits, without
+ * locks.  Referenced entries lose the mark and are passed over once.
+ * @param store pointer to store structure.
+ * @param keep entry never evicted, the one just inserted, or NULL
+ * @return keep, moved down for the evictions before it
+ */
+static _entry_t *list_evict(list_store_t *store,_entry_t *keep)
+{
+    size_t index=(keep) ? (size_t)EIdx(keep) : store->index;
+
+    while (((store->capacity)&&(store->index>store->capacity))||
+            ((store->budget)&&(store->bytes>store->budget)&&
+             (store->index>((keep) ? 1 : 0)))) {
+        _entry_t *eptr;
+
+        if (store->hand>=store->index) store->hand=0;
+        eptr=((_entry_t *)store->list)+store->hand;
+        if ((store->hand==index)||(eptr->flags&ENTRY_REF)) {
+            eptr->flags&=~ENTRY_REF;
+            store->hand++;
+            continue;
+        }
+        dbgentry(eptr);
+        /* The hand stays, the next entry moves into its place */
+        _delete_entry(store,store->hand);
+        if (store->hand<index) index--;
+    }
+    return (keep) ? ((_entry_t *)store->list)+index : NULL;
+}
+
+/** Lower or upper bound of a key, without locks.
+ * The sorted list takes the insert slot of a binary search.  An unsorted
+ * list has no order, so the first entry in list order past the bound is used.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param upper true to skip an entry equal to the key
+ * @return index of the bound, store->index when there is none
+ */
+static size_t list_bound(list_store_t *store,void *keyref,bool upper)
+{
+    _entry_t entry;             /**< Temp entry for key lookup */
+    _entry_t *eptr=NULL;
+    size_t slot=store->index;
+
+    entry.key=keyref;
+#ifndef LSEARCH
+    eptr=bfind(&entry, store->list, &store->index,store->size,
+            store->key.cmp,&slot);
+    if (eptr) slot=EIdx(eptr)+(upper ? 1 : 0);
+#else
+    for (slot=0;slot<store->index;slot++) {
+        int cmp;
+
+        eptr=((_entry_t *)store->list)+slot;
+        cmp=store->key.cmp(&eptr->key,&entry.key);
+        if ((cmp>0)||((cmp==0)&&(!upper))) break;
+    }
+#endif
+    return slot;
+}
+
+/** Search for a key at or after pos, without locks.
+ * Steps of doubling size from pos bound the binary search, so probing keys
+ * in order costs the log of the distance between them, not of the list.
+ * @param store pointer to store structure.
+ * @param keyref pointer to the key
+ * @param pos start of the search, updated to the position of the key
+ * @return entry of the key, NULL if missing
+ */
+static inline _entry_t *list_gallop(list_store_t *store,void *keyref,size_t *pos)
+{
+    _entry_t entry;             /**< Temp entry for key lookup */
+    _entry_t *eptr;
+    size_t lo=*pos;
+    size_t hi=lo;
+    size_t step=1;
+    size_t count;
+    size_t slot=0;
+
+    entry.key=keyref;
+    while ((hi<store->index)&&
+            (store->key.cmp(&entry,((_entry_t *)store->list)+hi)>0)) {
+        lo=hi+1;
+        hi+=step;
+        step<<=1;
+    }
+    count=((hi<store->index) ? hi+1 : store->index)-lo;
+    eptr=bfind(&entry,((_entry_t *)store->list)+lo,&count,store->size,
+            store->key.cmp,&slot);
+    *pos=(eptr) ? (size_t)EIdx(eptr) : lo+slot;
+    return eptr;
+}
+
 /** Delete entry by index */
 #ifdef LIST_ENTRY_LOCK
 bool _delete_lock(list_store_t *store,int index)
@@ -726,10 +2107,19 @@ bool _delete_lock(list_store_t *store,int index)
 void _delete_entry(list_store_t *store,int index)
 {
     _entry_t *eptr=NULL; /**< Pointer to entry for lookup/search */
+    bool kept=false;
     /* Ensure the store is initialized and has an entry */
     eptr=((_entry_t *)store->list)+index;
     dbgindex(index);
-    if (eptr->key) free(eptr->key);
+    if ((store->net)&&(eptr->key)) repl_digest(store,eptr);
+    if ((LIST_CACHE(store))&&(eptr->key)) store->bytes-=LIST_ENTRY_BYTES(store,eptr);
+    /* Keep deleted keys for the next delta snapshot, a delete that is not
+     * tracked leaves no base for one */
+    if ((eptr->key)&&(store->snap)) {
+        if (store->delta) kept=list_tombstone(store,eptr->key);
+        else store->snap=false;
+    }
+    if ((eptr->key)&&(!kept)) free(eptr->key);
     if (eptr->val) free(eptr->val);
     memset(eptr,0x00,sizeof(*eptr));
     memmove(eptr,(eptr+1), (store->list+(store->size*store->index))-((void*)eptr));
@@ -753,15 +2143,71 @@ static inline void *list_init(list_store_t *store)
         if (store->key.sz) store->key.size=store->key.sz(NULL);
         if (store->value.sz) store->value.size=store->value.sz(NULL);
         /* Generate uniq id from hash configuration */
-        store->id=store->key.size + store->key.size;
-        store->id=pyHash((uint8_t *)store->key.name,strlen(store->key.name),
-            store->id);
-        store->id=pyHash((uint8_t *)store->value.name,strlen(store->value.name),
-            store->id);
+        store->id=_list_type_id(&store->key,&store->value);
     }
     return store->list;
 }
 
+/**
+ * Id of a pair of key and value types, saved files carry it so that a file
+ * is only loaded by a store of the same types.
+ * @param key key type information with its size set
+ * @param value value type information with its size set
+ * @return id of the types
+ */
+uint32_t _list_type_id(const list_type_info_t *key,const list_type_info_t *value)
+{
+    uint32_t id=key->size + key->size;
+
+    id=pyHash((uint8_t *)key->name,strlen(key->name),id);
+    id=pyHash((uint8_t *)value->name,strlen(value->name),id);
+    return id;
+}
+
+/** Record a deleted key for the next delta snapshot, lock must be held.
+ * Ownership of key passes to the deleted list on success.  On allocation
+ * failure, or past LIST_DELTA_DELETES keys, change tracking is dropped, so
+ * the next delta save fails rather than missing the delete.
+ * @return true if key was kept
+ */
+static bool list_tombstone(list_store_t *store,void *key)
+{
+    if (store->ndeleted>=LIST_DELTA_DELETES) {
+        dbg("Tombstone limit %d, delta dropped",store->ndeleted);
+        list_clean(store);
+        store->snap=false;
+        return false;
+    }
+    if (store->ndeleted==store->maxdeleted) {
+        int increase=store->maxdeleted/4+8;
+        void *newmem=realloc(store->deleted,
+                sizeof(*store->deleted)*(store->maxdeleted+increase));
+        if (!newmem) {
+            dbg("Tombstone resize ERROR %d",store->maxdeleted+increase);
+            list_clean(store);
+            store->snap=false;
+            return false;
+        }
+        store->deleted=newmem;
+        store->maxdeleted+=increase;
+    }
+    store->deleted[store->ndeleted++]=key;
+    return true;
+}
+
+/** Mark the list as matching the last snapshot, lock must be held */
+static void list_clean(list_store_t *store)
+{
+    int i;
+    for (i=0;i<store->index;i++) {
+        (((_entry_t *)store->list)+i)->flags&=~ENTRY_DIRTY;
+    }
+    for (i=0;i<store->ndeleted;i++) {
+        free(store->deleted[i]);
+    }
+    store->ndeleted=0;
+}
+
 /* Internal function to enlarge storage as needed */
 static inline void *list_resize(list_store_t *store)
 {
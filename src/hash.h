@@ -50,6 +50,12 @@ typedef struct list_type_info list_type_info_t;
 struct repl_info;
 typedef struct repl_info repl_info_t;
 
+struct list_ttl;
+typedef struct list_ttl list_ttl_t;
+
+struct pq_store;
+typedef struct pq_store pq_store_t;
+
 /* Function pointer typedefs */
 /** Allocation function for key/value of entry */
 typedef void* (*_list_alloc_fn_t)(const void*);
@@ -57,6 +63,8 @@ typedef void* (*_list_alloc_fn_t)(const void*);
 typedef void* (*_list_copy_fn_t)(void *,const void*);
 /** Returns size of type, for varible sized types (strings) */
 typedef size_t (*_list_size_fn_t)(const void*);
+/** Range visit callback with the key reference, value and context */
+typedef bool (*_list_visit_fn_t)(const void*,void*,void*);
 /** Debug print function */
 typedef char* (*_list_print_fn_t)(const list_type_info_t*, const void*);
 
@@ -65,16 +73,46 @@ void *_list_reference(list_store_t *store,void *keyref);
 void *_list_keyref(list_store_t *store,int index);
 void *_list_valref(list_store_t *store,int index);
 bool _list_copy(list_store_t *store,void *keyref,void *value);
+bool _list_visit(list_store_t *store,void *keyref,_list_visit_fn_t fn,void *ctx);
+int  _list_copy_many(list_store_t *store,void *keys,int n,void *vals,bool *found);
 bool _list_items(list_store_t *store,int index,void *key,void *value);
 int  _list_index(list_store_t *store,void *keyref);
+int  _list_bound(list_store_t *store,void *keyref,bool upper);
+int  _list_range(list_store_t *store,void *lo,void *hi,_list_visit_fn_t fn,void *ctx);
+int  _list_prefix(list_store_t *store,const char *prefix,_list_visit_fn_t fn,void *ctx);
 bool _list_insert(list_store_t *store,void *keyref,void *value);
+bool _list_insert_ttl(list_store_t *store,void *keyref,void *value,long ttlms);
+bool _list_update(list_store_t *store,void *keyref,_list_visit_fn_t fn,void *ctx,bool insert);
+bool _list_cas(list_store_t *store,void *keyref,void *expected,void *desired);
 bool _list_netstart(list_store_t *store, uint16_t port);
+bool _list_netlocal(list_store_t *store, uint16_t port);
+bool _list_netsync(list_store_t *store,long tmOutms);
+bool _list_netcoalesce(list_store_t *store,long tmOutms);
+bool _list_netpace(list_store_t *store,long rate,long burst);
+bool _list_netfilter(list_store_t *store,void *lo,void *hi);
+bool _list_netpartition(list_store_t *store,int replicas);
+bool _list_cache(list_store_t *store,int max,size_t bytes);
 bool _list_load(list_store_t *store,char *file);
 bool _list_save(list_store_t *store,char *file);
+bool _list_save_delta(list_store_t *store,char *file);
+void _list_delta_track(list_store_t *store,bool enable);
+bool _list_load_delta(list_store_t *store,char *file);
+bool _list_compact(list_store_t *store,char *file,char *base,char **deltas,int count);
+bool _list_save_sharded(list_store_t *store,char *dir,int shards);
+bool _list_load_parallel(list_store_t *store,char *dir,int threads);
 bool _list_free(list_store_t *store);
+uint32_t _list_type_id(const list_type_info_t *key,const list_type_info_t *value);
 bool _list_remove(list_store_t *store,void *keyref);
 bool _list_remove_value(list_store_t *store,int index,void *value);
 bool _list_lock(list_store_t *store,void *keyref,bool lock);
+int  _pq_push(pq_store_t *pq,void *prio,void *value);
+bool _pq_pop(pq_store_t *pq,void *prio,void *value);
+bool _pq_peek(pq_store_t *pq,void *prio,void *value);
+bool _pq_decrease(pq_store_t *pq,int handle,void *prio);
+bool _pq_remove(pq_store_t *pq,int handle,void *prio,void *value);
+bool _pq_load(pq_store_t *pq,char *file);
+bool _pq_save(pq_store_t *pq,char *file);
+bool _pq_free(pq_store_t *pq);
 static inline int _index_wrap(int i,size_t m);
 /* Replication Thread Function */
 
@@ -111,13 +149,49 @@ struct list_store {
     size_t index;               /**< Index for next new item */
     size_t size;                /**< Size of a complete Key/Value item */
     uint16_t port;              /**< Port for network replication */
-    pthread_t nethandle;        /**< Handle for network thread */
+    bool local;                 /**< Replicate through shared memory */
     repl_info_t *net;           /**< Information on the network service */
     list_type_info_t key;       /**< Key info and callbacks */
     list_type_info_t value;     /**< Value info and callbacks */
+    bool snap;                  /**< Track changes since last snapshot */
+    bool delta;                 /**< Deleted keys are kept for SaveDelta */
+    void **deleted;             /**< Keys deleted since last snapshot */
+    int ndeleted;               /**< Number of keys in deleted */
+    int maxdeleted;             /**< Allocated size of deleted */
+    void **filter;              /**< Key ranges received, lo/hi pairs */
+    int nfilter;                /**< Number of ranges in filter */
+    int partition;              /**< Owners of each key, 0 keeps every key */
+    list_ttl_t *ttl;            /**< Expiry wheel and reaper, NULL until a SetTTL */
+    int capacity;               /**< Cache entry limit, 0 for none */
+    size_t budget;              /**< Cache byte limit, 0 for none */
+    size_t bytes;               /**< Bytes of the entries while caching */
+    size_t hand;                /**< CLOCK hand, next entry index to check */
     pthread_mutex_t lock;       /**< Lock for list list access */
 };
 
+/**
+ * @brief Priority queue storage structure
+ * A d-ary heap of nodes holding a handle, the priority and the value, with
+ * the heap position of each handle for DecreaseKey and Remove.
+ */
+struct pq_store {
+    const char *name;           /**< Name of queue */
+    uint32_t id;                /**< Id unique to data types, in saved files */
+    uint8_t *heap;              /**< Nodes in heap order */
+    uint8_t *tmp;               /**< One node moving through the heap */
+    size_t count;               /**< Nodes in the heap */
+    size_t max;                 /**< Nodes allocated */
+    size_t size;                /**< Bytes of a node */
+    size_t prioOff;             /**< Offset of the priority in a node */
+    size_t valOff;              /**< Offset of the value in a node */
+    uint32_t *pos;              /**< Heap position of each handle */
+    size_t npos;                /**< Handles allocated */
+    uint32_t freeHandle;        /**< First unused handle, chained in pos */
+    list_type_info_t prio;      /**< Priority info and callbacks */
+    list_type_info_t value;     /**< Value info and callbacks */
+    pthread_mutex_t lock;       /**< Lock for queue access */
+};
+
 /** String key value support:
  * Use as "STR" in macro */
 typedef char* STR;
@@ -141,20 +215,29 @@ typedef char* STR;
     static HN##_v HN##_zero; \
     LIST_FUNCTION_GET(HN,&key) \
     LIST_FUNCTION_SET(HN,&key) \
+    LIST_FUNCTION_SETTTL(HN,&key) \
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
+    LIST_FUNCTION_GETMANY(HN) \
     LIST_FUNCTION_PTR(HN,&key) \
     LIST_FUNCTION_VAL(HN,&key) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_KEYS(HN,key) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_INDEX(HN,&key) \
+    LIST_FUNCTION_RANGE(HN,&key,&lo,&hi) \
+    LIST_FUNCTION_VISIT(HN,&key) \
+    LIST_FUNCTION_UPDATE(HN,&key) \
     LIST_FUNCTION_HASKEY(HN,&key) \
     LIST_FUNCTION_DEL(HN,&key) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
+    LIST_FUNCTION_CACHE(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_NETSTART(HN) \
+    LIST_FUNCTION_NETFILTER(HN,&lo,&hi) \
     DECLARE_HANDLER_TYPE(HN) \
     DECLARE_INSTANCE(HN)
 
@@ -176,20 +259,30 @@ typedef char* STR;
     static HN##_v HN##_zero; \
     LIST_FUNCTION_GET(HN,key) \
     LIST_FUNCTION_SET(HN,key) \
+    LIST_FUNCTION_SETTTL(HN,key) \
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
+    LIST_FUNCTION_GETMANY(HN) \
     LIST_FUNCTION_PTR(HN,key) \
     LIST_FUNCTION_VAL(HN,key) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_KEYS(HN,&key) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_INDEX(HN,key) \
+    LIST_FUNCTION_RANGE(HN,key,lo,hi) \
+    LIST_FUNCTION_PREFIX(HN) \
+    LIST_FUNCTION_VISIT(HN,key) \
+    LIST_FUNCTION_UPDATE(HN,key) \
     LIST_FUNCTION_HASKEY(HN,key) \
     LIST_FUNCTION_DEL(HN,key) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
+    LIST_FUNCTION_CACHE(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_NETSTART(HN) \
+    LIST_FUNCTION_NETFILTER(HN,lo,hi) \
     DECLARE_HANDLER_TYPE(HN) \
     DECLARE_INSTANCE(HN)
 
@@ -214,10 +307,13 @@ typedef struct timespec timespec_t;
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
     LIST_FUNCTION_PUSH(HN) \
+    LIST_FUNCTION_RANGE(HN,&key,&lo,&hi) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_NETSTART(HN) \
     DECLARE_FIFO_HANDLER_TYPE(HN) \
@@ -243,20 +339,29 @@ typedef struct timespec timespec_t;
     static HN##_v HN##_zero; \
     LIST_FUNCTION_GET(HN,&key) \
     LIST_FUNCTION_SET(HN,&key) \
+    LIST_FUNCTION_SETTTL(HN,&key) \
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
+    LIST_FUNCTION_GETMANY(HN) \
     LIST_FUNCTION_PTR(HN,&key) \
     LIST_FUNCTION_VAL(HN,&key) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_KEYS(HN,key) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_INDEX(HN,&key) \
+    LIST_FUNCTION_RANGE(HN,&key,&lo,&hi) \
+    LIST_FUNCTION_VISIT(HN,&key) \
+    LIST_FUNCTION_UPDATE(HN,&key) \
     LIST_FUNCTION_HASKEY(HN,&key) \
     LIST_FUNCTION_DEL(HN,&key) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
+    LIST_FUNCTION_CACHE(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_NETSTART(HN) \
+    LIST_FUNCTION_NETFILTER(HN,&lo,&hi) \
     DECLARE_HANDLER_TYPE(HN) \
     DECLARE_INSTANCE(HN)
 
@@ -277,20 +382,30 @@ typedef struct timespec timespec_t;
     static HN##_v HN##_zero; \
     LIST_FUNCTION_GET(HN,key) \
     LIST_FUNCTION_SET(HN,key) \
+    LIST_FUNCTION_SETTTL(HN,key) \
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
+    LIST_FUNCTION_GETMANY(HN) \
     LIST_FUNCTION_PTR(HN,key) \
     LIST_FUNCTION_VAL(HN,key) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_INDEX(HN,key) \
+    LIST_FUNCTION_RANGE(HN,key,lo,hi) \
+    LIST_FUNCTION_PREFIX(HN) \
+    LIST_FUNCTION_VISIT(HN,key) \
+    LIST_FUNCTION_UPDATE(HN,key) \
     LIST_FUNCTION_HASKEY(HN,key) \
     LIST_FUNCTION_DEL(HN,key) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
+    LIST_FUNCTION_CACHE(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_KEYS(HN,&key) \
     LIST_FUNCTION_NETSTART(HN) \
+    LIST_FUNCTION_NETFILTER(HN,lo,hi) \
     DECLARE_HANDLER_TYPE(HN) \
     DECLARE_INSTANCE(HN)
 
@@ -311,15 +426,53 @@ typedef struct timespec timespec_t;
     LIST_FUNCTION_POP(HN) \
     LIST_FUNCTION_NEXT(HN) \
     LIST_FUNCTION_PUSH(HN) \
+    LIST_FUNCTION_RANGE(HN,&key,&lo,&hi) \
     LIST_FUNCTION_COUNT(HN) \
     LIST_FUNCTION_ITEM(HN) \
     LIST_FUNCTION_LOAD(HN) \
     LIST_FUNCTION_SAVE(HN) \
+    LIST_FUNCTION_DELTA(HN) \
+    LIST_FUNCTION_SHARDED(HN) \
     LIST_FUNCTION_FREE(HN) \
     LIST_FUNCTION_NETSTART(HN) \
     DECLARE_FIFO_HANDLER_TYPE(HN) \
     DECLARE_FIFO_INSTANCE(HN)
 
+/**
+ * @brief Priority queue generation macro
+ * @param HN Queue name prefix.  Accessor functions begin with this name
+ * @param HP Type for the priority, an arithmetic type compared with <
+ * @param HV Type for queue value.  Must be a defined type, and not a pointer to a type.
+ * The queue is a 4-ary heap, Push and PopMin take O(log n) steps.
+ * @copydetails HASH
+ */
+#define DEFINE_PQUEUE(HN,HP,HV) \
+    LIST_KEYTYPE(HN,HP) \
+    PQUEUE_TYPEFN(HN##_k) \
+    LIST_VALTYPE(HN,HV) \
+    LIST_TYPEFN(HN##_v) \
+    static DECLARE_PQUEUE(HN) \
+    PQUEUE_FUNCTIONS(HN) \
+    DECLARE_PQUEUE_HANDLER_TYPE(HN) \
+    DECLARE_PQUEUE_INSTANCE(HN)
+
+/**
+ * @brief Reference extern priority queue generated in another C source file
+ * @param HN Queue name prefix.  Accessor functions begin with this name
+ * @param HP Type for the priority, an arithmetic type compared with <
+ * @param HV Type for queue value.  Must be a defined type, and not a pointer to a type.
+ * @copydetails HASH
+ */
+#define EXTERN_PQUEUE(HN,HP,HV) \
+    LIST_KEYTYPE(HN,HP) \
+    PQUEUE_TYPEFN(HN##_k) \
+    LIST_VALTYPE(HN,HV) \
+    LIST_TYPEFN(HN##_v) \
+    extern pq_store_t HN##_store; \
+    PQUEUE_FUNCTIONS(HN) \
+    DECLARE_PQUEUE_HANDLER_TYPE(HN) \
+    DECLARE_PQUEUE_INSTANCE(HN)
+
 /**
  * @brief List and Hash storage structure creation macro
  * Creates the list storage data structure for list/hash access. 
@@ -355,6 +508,11 @@ typedef struct timespec timespec_t;
         bool (*del)(HN##_k); \
         bool (*load)(char*); \
         bool (*save)(char*); \
+        bool (*saveDelta)(char*); \
+        bool (*loadDelta)(char*); \
+        bool (*compact)(char*,char*,char**,int); \
+        bool (*saveSharded)(char*,int); \
+        bool (*loadParallel)(char*,int); \
         bool (*free)(void); \
     } HN##_handler_t;
 
@@ -375,6 +533,11 @@ typedef struct timespec timespec_t;
         .del=HN##Del, \
         .load=HN##Load, \
         .save=HN##Save, \
+        .saveDelta=HN##SaveDelta, \
+        .loadDelta=HN##LoadDelta, \
+        .compact=HN##Compact, \
+        .saveSharded=HN##SaveSharded, \
+        .loadParallel=HN##LoadParallel, \
         .free=HN##Free, \
     };
 
@@ -388,6 +551,11 @@ typedef struct timespec timespec_t;
         bool (*item)(int,HN##_v*); \
         bool (*load)(char*); \
         bool (*save)(char*); \
+        bool (*saveDelta)(char*); \
+        bool (*loadDelta)(char*); \
+        bool (*compact)(char*,char*,char**,int); \
+        bool (*saveSharded)(char*,int); \
+        bool (*loadParallel)(char*,int); \
         bool (*free)(void); \
     } HN##_handler_t;
 
@@ -401,10 +569,53 @@ typedef struct timespec timespec_t;
         .item=HN##Item, \
         .load=HN##Load, \
         .save=HN##Save, \
+        .saveDelta=HN##SaveDelta, \
+        .loadDelta=HN##LoadDelta, \
+        .compact=HN##Compact, \
+        .saveSharded=HN##SaveSharded, \
+        .loadParallel=HN##LoadParallel, \
         .free=HN##Free, \
     };
 
 
+/**
+ * @brief Priority queue storage structure creation macro
+ * Can be used to create a global version of the queue structure
+ * @param HN Queue name prefix.  Accessor functions begin with this name
+ */
+#define DECLARE_PQUEUE(HN) \
+    pq_store_t HN##_store={.name=#HN,.lock=PTHREAD_MUTEX_INITIALIZER,\
+        .prio=LIST_TYPEINFO(HN##_k),.value=LIST_TYPEINFO(HN##_v), \
+};
+
+/** Internal macro used by DEFINE_PQUEUE */
+#define DECLARE_PQUEUE_HANDLER_TYPE(HN) \
+    typedef struct { \
+        int (*push)(HN##_k,HN##_v); \
+        bool (*popMin)(HN##_k*,HN##_v*); \
+        bool (*min)(HN##_k*,HN##_v*); \
+        bool (*decreaseKey)(int,HN##_k); \
+        bool (*remove)(int,HN##_v*); \
+        int (*count)(void); \
+        bool (*load)(char*); \
+        bool (*save)(char*); \
+        bool (*free)(void); \
+    } HN##_handler_t;
+
+/** An instance of the priority queue that includes methods for accessing data */
+#define DECLARE_PQUEUE_INSTANCE(HN) \
+    HN##_handler_t HN={ \
+        .push=HN##Push, \
+        .popMin=HN##PopMin, \
+        .min=HN##Min, \
+        .decreaseKey=HN##DecreaseKey, \
+        .remove=HN##Remove, \
+        .count=HN##Count, \
+        .load=HN##Load, \
+        .save=HN##Save, \
+        .free=HN##Free, \
+    };
+
 /**
  * Macro to generate handler functions for key.
  * @param HN List name
@@ -510,6 +721,33 @@ typedef struct timespec timespec_t;
     }
 
 
+/**
+ * Callbacks for priorities, compared as numbers.  Unlike the list callbacks
+ * cmp gets pointers to the priorities themselves.
+ * @param KT priority type
+ */
+#define PQUEUE_TYPEFN(KT) \
+    static int KT##_cmp(const void *m1, const void *m2) \
+    { \
+        KT a=*(const KT *)m1; \
+        KT b=*(const KT *)m2; \
+        return (a<b) ? -1 : (b<a); \
+    } \
+    static void *KT##_cp(void *dst, const void *src) \
+    { \
+        return memcpy(dst,src,sizeof(KT));\
+    } \
+    static size_t KT##_sz(const void *src) \
+    { \
+        return sizeof(KT);\
+    } \
+    static void *KT##_alloc(const void *src) \
+    { \
+        void *dst=calloc(1,sizeof(KT)); \
+        if (dst) return memcpy(dst,src,sizeof(KT));\
+        else return NULL; \
+    }
+
 /* Access methods */
 /**
  * @par ListGet static inline bool LNameGet(List_k key,List_v *value);
@@ -546,6 +784,33 @@ typedef struct timespec timespec_t;
         return _list_insert(&HN##_store, KEY, &value); \
     }
 
+/**
+ * @par ListSetTTL static inline bool LNameSetTTL(LKeyType key,LValType value,long ttlms)
+ * Set the value of a key that expires ttlms milliseconds later, to the
+ * LIST_TTL_TICK_MS resolution.  Expiry times wait in a timer wheel and a
+ * reaper thread, started by the first SetTTL, deletes expired entries, so
+ * the cost follows the number of entries expiring and not the store size.
+ * The reaper sleeps until the next tick with keys expiring, and a SetTTL
+ * that extends an expiry moves the pending timer rather than adding one.
+ * An expired entry is also deleted when it is read.  Expiry deletes are
+ * sent like any delete.  A later Set of the key, or a SetTTL with 0, keeps
+ * it until deleted.  The expiry is kept by the node that set it, and is not
+ * saved in snapshots.
+ * @param key Key of the entry
+ * @param value Value to set
+ * @param ttlms Time to live in milliseconds, 0 for no expiry
+ * @return true on success, false on allocation failure, or for a key the
+ * node does not own in a partitioned store
+ * \code{.c}
+ * ListSetTTL(session,state,30000);
+ * \endcode
+ */
+#define LIST_FUNCTION_SETTTL(HN,KEY) \
+    static inline bool HN##SetTTL(HN##_k key,HN##_v value,long ttlms) \
+    { \
+        return _list_insert_ttl(&HN##_store, KEY, &value, ttlms); \
+    }
+
 /**
  * @par ListPop static inline bool LNamePop(List_v *value);
  * ListPop Pull the value from the end of the list and delete it
@@ -598,6 +863,30 @@ typedef struct timespec timespec_t;
     }
 
 
+/**
+ * @par ListGetMany static inline int LNameGetMany(LKeyType *keys,int n,LValType *vals,bool *found)
+ * Get the values of n keys with one lock.  The keys are sorted, unless they
+ * already are, and the list is walked once from the smallest, so each search
+ * only covers the distance to the previous key.  vals[i] is only written for
+ * a key that is found.
+ * @param keys Array of n keys
+ * @param n Number of keys
+ * @param vals Array of n values for return
+ * @param found Array of n flags set for the keys found, or NULL
+ * @return Number of keys found
+ * \code{.c}
+ * int keys[3]={1,5,9};
+ * int vals[3];
+ * bool found[3];
+ * ListGetMany(keys,3,vals,found);
+ * \endcode
+ */
+#define LIST_FUNCTION_GETMANY(HN) \
+    static inline int HN##GetMany(HN##_k *keys,int n,HN##_v *vals,bool *found) \
+    { \
+        return _list_copy_many(&HN##_store,keys,n,vals,found); \
+    }
+
 /**
  * @par ListPtr static inline LValType *LNamePtr(LKeyType key)
  * Return the pointer to a List entry
@@ -743,6 +1032,129 @@ typedef struct timespec timespec_t;
         return _list_index(&HN##_store,KEY); \
     }
 
+/**
+ * @par ListLowerBound static inline int LNameLowerBound(LKeyType key)\n
+ * static inline int LNameUpperBound(LKeyType key)\n
+ * static inline int LNameRange(LKeyType lo,LKeyType hi,LName_visit_t fn,void *ctx)
+ * LowerBound returns the index of the first entry with a key not less than
+ * key, UpperBound the first with a key greater than key, in the order of the
+ * key compare, strcmp for a hash and byte order for a list.  Both are the
+ * count when every key is before the bound.  Range calls fn for each entry
+ * from lo to hi inclusive with one search and one lock, fn gets the key
+ * reference, the string for a hash, and the value, and returns false to
+ * stop.  fn runs under the store lock and must not call into the same store.
+ * @param key Key to search for
+ * @param lo First key of the range
+ * @param hi Last key of the range
+ * @param fn Callback for each entry
+ * @param ctx Pointer passed to fn
+ * @return Index of the bound, or the number of entries visited for Range
+ * \code{.c}
+ * bool sum(const void *key,int *value,void *ctx) {
+ *     *(long *)ctx+=*value;
+ *     return true;
+ * }
+ * long total=0;
+ * ListRange(start,end,sum,&total);
+ * \endcode
+ */
+#define LIST_FUNCTION_RANGE(HN,KEY,LO,HI) \
+    typedef bool (*HN##_visit_t)(const void *key,HN##_v *value,void *ctx); \
+    static inline int HN##LowerBound(HN##_k key) \
+    { \
+        return _list_bound(&HN##_store,KEY,false); \
+    }\
+    static inline int HN##UpperBound(HN##_k key) \
+    { \
+        return _list_bound(&HN##_store,KEY,true); \
+    }\
+    static inline int HN##Range(HN##_k lo,HN##_k hi,HN##_visit_t fn,void *ctx) \
+    { \
+        return _list_range(&HN##_store,LO,HI,(_list_visit_fn_t)fn,ctx); \
+    }
+
+/**
+ * @par HashPrefixScan static inline int LNamePrefixScan(const char *prefix,LName_visit_t fn,void *ctx)
+ * Calls fn for each entry of a hash with a key starting with prefix.  The
+ * start is found with one binary search and the scan ends at the first key
+ * without the prefix, all under one lock.  fn is called as for Range, and
+ * must not call into the same store.
+ * @param prefix Leading characters of the keys, "" for every key
+ * @param fn Callback for each entry, returns false to stop
+ * @param ctx Pointer passed to fn
+ * @return Number of entries visited
+ * \code{.c}
+ * HashPrefixScan("tenant42/",count,&total);
+ * \endcode
+ */
+#define LIST_FUNCTION_PREFIX(HN) \
+    static inline int HN##PrefixScan(const char *prefix,HN##_visit_t fn,void *ctx) \
+    { \
+        return _list_prefix(&HN##_store,prefix,(_list_visit_fn_t)fn,ctx); \
+    }
+
+/**
+ * @par ListVisit static inline bool LNameVisit(LKeyType key,LName_visit_t fn,void *ctx)
+ * Calls fn with the stored value of key in place, under the store lock, so
+ * reading a field of a large value costs no copy.  fn is called as for Range,
+ * must only read the value, and must not call into the same store.  The value
+ * pointer is not valid after fn returns.
+ * @param key Key of the entry
+ * @param fn Callback for the entry
+ * @param ctx Pointer passed to fn
+ * @return false if the key is missing, otherwise the return of fn
+ * \code{.c}
+ * bool field(const void *key,big_t *value,void *ctx) {
+ *     *(int *)ctx=value->field;
+ *     return true;
+ * }
+ * int f;
+ * ListVisit(key,field,&f);
+ * \endcode
+ */
+#define LIST_FUNCTION_VISIT(HN,KEY) \
+    static inline bool HN##Visit(HN##_k key,HN##_visit_t fn,void *ctx) \
+    { \
+        return _list_visit(&HN##_store,KEY,(_list_visit_fn_t)fn,ctx); \
+    }
+
+/**
+ * @par ListUpdate static inline bool LNameUpdate(LKeyType key,LName_visit_t fn,void *ctx)\n
+ * static inline bool LNameCompareAndSet(LKeyType key,LValType expected,LValType desired)
+ * Update runs fn on the value of key under one lock and one search, and
+ * returns true and sends one update when fn returns true.  fn changes the
+ * value in place and returns false only when it leaves it unchanged.  A
+ * missing key starts from a zero value, and adding it costs a second search.
+ * CompareAndSet replaces the value of an existing key with desired only when
+ * it matches expected byte for byte, so its value type must have no padding,
+ * whose bytes are indeterminate.  fn must not call into the same store.  A partitioned store returns false
+ * for a key it does not own, the change has to run on an owner.
+ * @param key Key of the entry
+ * @param fn Mutator for the value
+ * @param ctx Pointer passed to fn
+ * @param expected Value to compare
+ * @param desired New value
+ * @return true if the value was changed
+ * \code{.c}
+ * bool add(const void *key,long *value,void *ctx) {
+ *     *value+=*(long *)ctx;
+ *     return true;
+ * }
+ * long n=1;
+ * ListUpdate(key,add,&n);
+ * ListCompareAndSet(key,0,1);
+ * \endcode
+ */
+#define LIST_FUNCTION_UPDATE(HN,KEY) \
+    static inline bool HN##Update(HN##_k key,HN##_visit_t fn,void *ctx) \
+    { \
+        return _list_update(&HN##_store,KEY,(_list_visit_fn_t)fn,ctx,true); \
+    }\
+    static inline bool HN##CompareAndSet(HN##_k key,HN##_v expected,HN##_v desired) \
+    { \
+        return _list_cas(&HN##_store,KEY,&expected,&desired); \
+    }
+
 /**
  * @par ListHasKey static inline bool LNameHasKey(LKeyType key)
  * @brief Bool indidicating if the key is in list.
@@ -795,14 +1207,68 @@ typedef struct timespec timespec_t;
         _list_lock(&HN##_store,KEY,false); \
     }
 
+/**
+ * @par ListCache static inline bool LNameCache(int max,size_t bytes)
+ * Bound the store as a cache of at most max entries and bytes of memory,
+ * counting each key, value and list slot.  An insert past a limit evicts
+ * with a CLOCK hand: a read through Get, Val, Ptr, Visit, Update, GetMany,
+ * HasKey or Index marks the entry referenced, and the hand passes over a
+ * referenced entry once, clearing the mark, and evicts the first entry
+ * without one.  Evictions are local, so a cache can not share over the
+ * network.  Free clears the limits.
+ * @param max Most entries, 0 for no limit
+ * @param bytes Most bytes, 0 for no limit
+ * @return false if sharing is started
+ * \code{.c}
+ * ListCache(10000,0);
+ * \endcode
+ */
+#define LIST_FUNCTION_CACHE(HN) \
+    static inline bool HN##Cache(int max,size_t bytes) \
+    { \
+        return _list_cache(&HN##_store,max,bytes); \
+    }
+
 /**
  * @par ListNetStart static inline bool LNameNetStart(uint16_t port)
+ * static inline bool LNameNetStartLocal(uint16_t port)\n
+ * static inline bool LNameNetSync(long tmOutms)\n
+ * static inline bool LNameNetCoalesce(long tmOutms)\n
+ * static inline bool LNameNetPartition(int replicas)\n
+ * static inline bool LNameNetPace(long rate,long burst)
  * Sets the port number for multicast packets and starts the sharing
- * thread.  Thread is closed when free is called.
+ * thread.  Thread is closed when free is called.  A joining node requests
+ * the current entries from the node with the most entries, NetSync waits for
+ * that transfer to complete.  NetCoalesce collapses repeated updates of a
+ * key within tmOutms to one update with the latest value.  NetStartLocal
+ * shares with processes on the same host through a shared memory ring
+ * named by the port instead of multicast.  NetPartition, called before
+ * NetStart, spreads the keys over the nodes by consistent hashing so each
+ * key is kept by replicas owner nodes, and a Get of a key held elsewhere is
+ * forwarded to its owners.  NetPace limits the send rate to rate bytes per
+ * second with bursts of up to burst bytes, and lower still when receivers
+ * advertise less free receive space, so senders slow down before receivers
+ * drop.
  * @param port Port for network sharing.
+ * @param tmOutms Maximum time to wait for the initial sync, or the
+ * coalescing window, 0 to send every update.
+ * @param replicas Number of nodes keeping each key, 1 to REPL_REPLICAS_MAX.
+ * @param rate Send limit in bytes per second, 0 for no limit.
+ * @param burst Bytes sent at full speed after an idle time.
  * @return true on successful start, false on failure or if already
  * running.
+ * @return NetSync returns true when in sync, false on timeout.
+ * @return NetCoalesce and NetPace return false if sharing is not started.
+ * @return NetPartition returns false if sharing is started.
+ * \code{.c}
+ * ListNetStart(6500);
+ * ListNetSync(5000);
+ * ListNetCoalesce(10);
+ * ListNetPace(10000000,256*1024);
+ * \endcode
+ * A partitioned store:
  * \code{.c}
+ * ListNetPartition(2);
  * ListNetStart(6500);
  * \endcode
  * 
@@ -812,6 +1278,119 @@ typedef struct timespec timespec_t;
     { \
         return _list_netstart(&HN##_store,port); \
     }\
+    static inline bool HN##NetStartLocal(uint16_t port) \
+    { \
+        return _list_netlocal(&HN##_store,port); \
+    }\
+    static inline bool HN##NetSync(long tmOutms) \
+    { \
+        return _list_netsync(&HN##_store,tmOutms); \
+    }\
+    static inline bool HN##NetCoalesce(long tmOutms) \
+    { \
+        return _list_netcoalesce(&HN##_store,tmOutms); \
+    }\
+    static inline bool HN##NetPartition(int replicas) \
+    { \
+        return _list_netpartition(&HN##_store,replicas); \
+    }\
+    static inline bool HN##NetPace(long rate,long burst) \
+    { \
+        return _list_netpace(&HN##_store,rate,burst); \
+    }\
+
+/**
+ * @par ListNetFilter static inline bool LNameNetFilter(LKeyType lo,LKeyType hi)
+ * Receive only keys from lo to hi inclusive, in the order of the key compare,
+ * strcmp for a hash and byte order for a list.  Each call adds a range, a
+ * string prefix is a range ending in the prefix followed by "\xff".  The
+ * ranges go out with the sync request, so the sending node only streams
+ * matching entries.  Local updates of any key are still sent.  Must be
+ * called before NetStart.
+ * @param lo First key of the range
+ * @param hi Last key of the range
+ * @return false if sharing is started or on allocation failure
+ * \code{.c}
+ * HashNetFilter("user:","user:\xff");
+ * HashNetStart(6500);
+ * \endcode
+ */
+#define LIST_FUNCTION_NETFILTER(HN,LO,HI) \
+    static inline bool HN##NetFilter(HN##_k lo,HN##_k hi) \
+    { \
+        return _list_netfilter(&HN##_store,LO,HI); \
+    }
+
+/**
+ * @par PQueuePush static inline int LNamePush(LPrioType prio,LValType value)\n
+ * static inline bool LNamePopMin(LPrioType *prio,LValType *value)\n
+ * static inline bool LNameMin(LPrioType *prio,LValType *value)\n
+ * static inline bool LNameDecreaseKey(int handle,LPrioType prio)\n
+ * static inline bool LNameRemove(int handle,LValType *value)\n
+ * static inline int LNameCount(void)\n
+ * static inline bool LNameLoad(char *file)\n
+ * static inline bool LNameSave(char *file)\n
+ * static inline bool LNameFree(void)
+ * Priority queue access.  Push adds a value and returns its handle, which
+ * stays valid until the value leaves the queue and is then reused.  PopMin
+ * removes the value with the lowest priority, Min reads it in place.
+ * DecreaseKey lowers the priority of a queued value and Remove takes it out
+ * of the queue, both in O(log n) steps.  Either priority or value may be NULL
+ * when not needed.  Save writes the queue in heap order, and Load pushes the
+ * saved values, with new handles.
+ * @param prio Priority, lowest first
+ * @param value Value to queue, or for return
+ * @param handle Handle returned by Push
+ * @return Push returns the handle, -1 on allocation failure
+ * @return PopMin and Min return false for an empty queue
+ * @return DecreaseKey returns false for an unused handle or a higher priority
+ * @return Remove returns false for an unused handle
+ * \code{.c}
+ * DEFINE_PQUEUE(Timers,uint64_t,timer_t);
+ * int h=TimersPush(deadline,timer);
+ * TimersDecreaseKey(h,deadline-10);
+ * while ((TimersMin(&when,NULL))&&(when<=now)) {
+ *     TimersPopMin(&when,&timer);
+ * }
+ * \endcode
+ */
+#define PQUEUE_FUNCTIONS(HN) \
+    static inline int HN##Push(HN##_k prio,HN##_v value) \
+    { \
+        return _pq_push(&HN##_store,&prio,&value); \
+    }\
+    static inline bool HN##PopMin(HN##_k *prio,HN##_v *value) \
+    { \
+        return _pq_pop(&HN##_store,prio,value); \
+    }\
+    static inline bool HN##Min(HN##_k *prio,HN##_v *value) \
+    { \
+        return _pq_peek(&HN##_store,prio,value); \
+    }\
+    static inline bool HN##DecreaseKey(int handle,HN##_k prio) \
+    { \
+        return _pq_decrease(&HN##_store,handle,&prio); \
+    }\
+    static inline bool HN##Remove(int handle,HN##_v *value) \
+    { \
+        return _pq_remove(&HN##_store,handle,NULL,value); \
+    }\
+    static inline int HN##Count(void) \
+    { \
+        return HN##_store.count; \
+    }\
+    static inline bool HN##Load(char *file) \
+    { \
+        return _pq_load(&HN##_store,file); \
+    }\
+    static inline bool HN##Save(char *file) \
+    { \
+        return _pq_save(&HN##_store,file); \
+    }\
+    static inline bool HN##Free(void) \
+    { \
+        return _pq_free(&HN##_store); \
+    }
 
 /**
  * @par ListLoad static inline bool LNameLoad(char *file)
@@ -845,6 +1424,77 @@ typedef struct timespec timespec_t;
         return _list_save(&HN##_store,file);\
     }
 
+/**
+ * @par ListSaveDelta static inline bool LNameSaveDelta(char *file)
+ * static inline bool LNameLoadDelta(char *file)\n
+ * static inline bool LNameCompact(char *file,char *base,char **deltas,int count)\n
+ * static inline void LNameDeltaTrack(bool enable)
+ * Incremental snapshots.  Once a full snapshot has been saved (or loaded into
+ * an empty list) the entries changed are tracked, and with DeltaTrack enabled
+ * the keys deleted.  A delete that is not tracked leaves no base, SaveDelta
+ * then fails until the next full snapshot, as it does once more than
+ * LIST_DELTA_DELETES keys are waiting.  SaveDelta writes only the changes and
+ * starts a new delta.  LoadDelta applies a delta
+ * to the list.  Compact merges a base file and its deltas, in order, into a
+ * new full snapshot without touching the list contents.
+ * @return true on success
+ * @return false on failure, or SaveDelta without a prior full snapshot
+ * \code{.c}
+ * char *deltas[]={"/var/data/datafile.d1","/var/data/datafile.d2"};
+ * ListDeltaTrack(true);
+ * ListSave("/var/data/datafile.hash");
+ * ListSet(1,10);
+ * ListSaveDelta("/var/data/datafile.d1");
+ * ListDel(1);
+ * ListSaveDelta("/var/data/datafile.d2");
+ * ListCompact("/var/data/datafile.hash","/var/data/datafile.hash",deltas,2);
+ * \endcode
+ *
+ */
+#define LIST_FUNCTION_DELTA(HN) \
+    static inline bool HN##SaveDelta(char *file) \
+    { \
+        return _list_save_delta(&HN##_store,file);\
+    } \
+    static inline bool HN##LoadDelta(char *file) \
+    { \
+        return _list_load_delta(&HN##_store,file);\
+    } \
+    static inline bool HN##Compact(char *file,char *base,char **deltas,int count) \
+    { \
+        return _list_compact(&HN##_store,file,base,deltas,count);\
+    } \
+    static inline void HN##DeltaTrack(bool enable) \
+    { \
+        _list_delta_track(&HN##_store,enable);\
+    }
+
+/**
+ * @par ListSaveSharded static inline bool LNameSaveSharded(char *dir,int shards)
+ * static inline bool LNameLoadParallel(char *dir,int threads)
+ * Save the list as key range partitioned files dir/ListName.0 to
+ * dir/ListName.(shards-1).  LoadParallel reads and decodes the shards on up
+ * to threads threads.  Loading into an empty list places the sorted shards
+ * directly in the list, otherwise each entry is inserted.
+ * @return true on success
+ * @return false on failure
+ * \code{.c}
+ * ListSaveSharded("/var/data",8);
+ * ListFree();
+ * ListLoadParallel("/var/data",8);
+ * \endcode
+ *
+ */
+#define LIST_FUNCTION_SHARDED(HN) \
+    static inline bool HN##SaveSharded(char *dir,int shards) \
+    { \
+        return _list_save_sharded(&HN##_store,dir,shards);\
+    } \
+    static inline bool HN##LoadParallel(char *dir,int threads) \
+    { \
+        return _list_load_parallel(&HN##_store,dir,threads);\
+    }
+
 /**
  * @par ListFree static inline bool LNameFree(void)
  * Free entire list, and reset to empty working list.  All allocated memory
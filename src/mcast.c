@@ -16,6 +16,7 @@
  *
  */
  
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -26,27 +27,41 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
-#include <pthread.h>
+#include <linux/sock_diag.h>
 
+#define BASE_ADDRESS "239.0.0.1"
+#ifndef MCAST_RCVBUF
+#define MCAST_RCVBUF (4*1024*1024) /**< Receive buffer for bursts, capped by rmem_max */
+#endif
+#ifndef MCAST_BATCH
+#define MCAST_BATCH 64  /**< Most datagrams moved by one batch call */
+#endif
 
-/**< Lock for list list access */
-static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
-/** Static address for all sends/recv calls */
-static struct sockaddr_in mcAddr;
+/** Fill in the group address for a port.  Built per call so concurrent
+ * senders on different ports need no shared state.
+ * @param addr Address to fill
+ * @param port Port number
+ */
+static inline void mcast_addr(struct sockaddr_in *addr,uint16_t port)
+{
+    memset(addr,0,sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = inet_addr(BASE_ADDRESS);
+    addr->sin_port = htons(port);
+}
 
-#define BASE_ADDRESS "239.0.0.1"
 int mcast_init(uint16_t port)
 {
+    struct sockaddr_in mcAddr;
     struct ip_mreq mreq;
     int opt=1;
+    int rcvbuf=MCAST_RCVBUF;
     int sock;
-    pthread_mutex_lock(&lock);
 
     /* set up socket */
     sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
         perror("socket");
-        pthread_mutex_unlock(&lock);
         return sock;
     }
 
@@ -58,14 +73,17 @@ int mcast_init(uint16_t port)
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))<0) {
         perror("setsockopt reuse");
         close(sock);
-        pthread_mutex_unlock(&lock);
         return -1;
     }         
 
+    /* Best effort, the kernel limits this to rmem_max */
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf))<0) {
+        perror("setsockopt rcvbuf");
+    }
+
     if (bind(sock, (struct sockaddr *) &mcAddr, sizeof(mcAddr)) < 0) {
         perror("bind");
         close(sock);
-        pthread_mutex_unlock(&lock);
         return -1;
     }    
     mreq.imr_multiaddr.s_addr = inet_addr(BASE_ADDRESS);         
@@ -76,11 +94,8 @@ int mcast_init(uint16_t port)
          * sudo route add -net 224.0.0.0 netmask 224.0.0.0 eth0
          */
         close(sock);
-        pthread_mutex_unlock(&lock);
         return -1;
     }         
-    mcAddr.sin_addr.s_addr = inet_addr(BASE_ADDRESS);
-    pthread_mutex_unlock(&lock);
     return sock;
 }
 
@@ -102,20 +117,112 @@ int mcast_recv(int sock, uint8_t *buf, int size,int opt)
 
 int mcast_send(int sock,uint16_t port, uint8_t *buf, int size,int opt)
 {
-    socklen_t addrlen;
+    struct sockaddr_in addr;
     int bytes;
-    addrlen = sizeof(mcAddr);
 
-    pthread_mutex_lock(&lock);
-    /* Set port */
-    mcAddr.sin_port = htons(port);
-    /* send */
-    bytes = sendto(sock,buf,size, opt,(struct sockaddr *) &mcAddr, addrlen);
+    mcast_addr(&addr,port);
+    bytes = sendto(sock,buf,size, opt,(struct sockaddr *) &addr, sizeof(addr));
     if (bytes < 0) {
         perror("sendto");
     }
-
-    pthread_mutex_unlock(&lock);
     return bytes;
 }
 
+/**
+ * Receive up to count datagrams with one system call.
+ * @param sock Multicast socket
+ * @param buf count slots of size bytes, one datagram per slot
+ * @param size Size of each slot
+ * @param lens Set to the number of bytes received in each slot
+ * @param count Number of slots
+ * @param opt recvmmsg flags, MSG_DONTWAIT to poll
+ * @return Number of datagrams received, 0 if none are waiting, <0 on error
+ */
+int mcast_recv_batch(int sock, uint8_t *buf, int size, int *lens, int count, int opt)
+{
+    struct mmsghdr msgs[MCAST_BATCH];
+    struct iovec iov[MCAST_BATCH];
+    int i,ret;
+
+    if (count>MCAST_BATCH) count=MCAST_BATCH;
+    memset(msgs,0,count*sizeof(msgs[0]));
+    for (i=0;i<count;i++) {
+        iov[i].iov_base=buf+(size_t)i*size;
+        iov[i].iov_len=size;
+        msgs[i].msg_hdr.msg_iov=&iov[i];
+        msgs[i].msg_hdr.msg_iovlen=1;
+    }
+    ret = recvmmsg(sock, msgs, count, opt, NULL);
+    if (ret < 0) {
+        if (errno==EAGAIN) ret=0;
+        else perror("recvmmsg");
+    }
+    for (i=0;i<ret;i++) {
+        lens[i]=msgs[i].msg_len;
+    }
+    return ret;
+}
+
+/**
+ * Send count datagrams to the group with as few system calls as possible.
+ * @param sock Multicast socket
+ * @param port Destination port
+ * @param buf count slots of size bytes, one datagram per slot
+ * @param size Size of each slot
+ * @param lens Number of bytes to send from each slot
+ * @param count Number of slots
+ * @param opt sendmmsg flags
+ * @return Number of datagrams sent, <0 on error
+ */
+int mcast_send_batch(int sock,uint16_t port, uint8_t *buf, int size, int *lens,
+        int count, int opt)
+{
+    struct sockaddr_in addr;
+    struct mmsghdr msgs[MCAST_BATCH];
+    struct iovec iov[MCAST_BATCH];
+    int sent=0;
+
+    mcast_addr(&addr,port);
+    while (sent<count) {
+        int i,ret;
+        int n=count-sent;
+
+        if (n>MCAST_BATCH) n=MCAST_BATCH;
+        memset(msgs,0,n*sizeof(msgs[0]));
+        for (i=0;i<n;i++) {
+            iov[i].iov_base=buf+(size_t)(sent+i)*size;
+            iov[i].iov_len=lens[sent+i];
+            msgs[i].msg_hdr.msg_name=&addr;
+            msgs[i].msg_hdr.msg_namelen=sizeof(addr);
+            msgs[i].msg_hdr.msg_iov=&iov[i];
+            msgs[i].msg_hdr.msg_iovlen=1;
+        }
+        ret = sendmmsg(sock, msgs, n, opt);
+        if (ret <= 0) {
+            perror("sendmmsg");
+            return (sent) ? sent : ret;
+        }
+        sent+=ret;
+    }
+    return sent;
+}
+
+/**
+ * Free space in the receive buffer of a socket, in the kernel's accounting,
+ * which charges each datagram more than its payload.
+ * @param sock Socket
+ * @return Bytes free, or -1 if the kernel does not report it
+ */
+long mcast_rx_free(int sock)
+{
+#ifdef SO_MEMINFO
+    uint32_t mem[SK_MEMINFO_VARS];
+    socklen_t len=sizeof(mem);
+
+    if (getsockopt(sock,SOL_SOCKET,SO_MEMINFO,mem,&len)<0) return -1;
+    if (mem[SK_MEMINFO_RMEM_ALLOC]>=mem[SK_MEMINFO_RCVBUF]) return 0;
+    return (long)(mem[SK_MEMINFO_RCVBUF]-mem[SK_MEMINFO_RMEM_ALLOC]);
+#else
+    return -1;
+#endif
+}
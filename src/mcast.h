@@ -28,6 +28,10 @@ extern "C" {
 int mcast_init(uint16_t port);
 int mcast_recv(int sock, void *buf, int size,int opt);
 int mcast_send(int sock,uint16_t port, void *buf, int size,int opt);
+int mcast_recv_batch(int sock, uint8_t *buf, int size, int *lens, int count, int opt);
+int mcast_send_batch(int sock,uint16_t port, uint8_t *buf, int size, int *lens,
+        int count, int opt);
+long mcast_rx_free(int sock);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,432 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @brief Priority queue generated by DEFINE_PQUEUE.  Values are kept in a
+ * PQ_ARITY-ary heap of fixed size nodes, holding the priority and value by
+ * copy, so a heap step compares neighbouring memory rather than following
+ * pointers.  The wider heap is half the depth of a binary one, which makes
+ * Push cheaper and costs PopMin a few more compares on nodes that share cache
+ * lines.  Each node carries a handle, and the handle table gives the heap
+ * position of a value for DecreaseKey and Remove.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "hash.h"
+#include "dbg.h"
+
+#define PQ_ARITY 4              /**< Children of a heap node */
+#define PQ_ALIGN 8              /**< Alignment of priority and value in a node */
+#define PQ_FREE 0x80000000u     /**< Handle table entry is on the free chain */
+
+/** Size rounded up to the node alignment */
+#define PQ_ROUND(s) (((s)+PQ_ALIGN-1)&~(size_t)(PQ_ALIGN-1))
+/** Node at a heap position */
+#define PQ_NODE(store,i) ((store)->heap+(size_t)(i)*(store)->size)
+/** Handle of a node, the first member of each node */
+#define PQ_HANDLE(node) (*(uint32_t *)(node))
+
+/** Set up node layout and id on first use, lock must be held */
+static void pq_init(pq_store_t *store)
+{
+    if (store->size) return;
+    store->prioOff=PQ_ALIGN;
+    store->valOff=store->prioOff+PQ_ROUND(store->prio.size);
+    store->size=store->valOff+PQ_ROUND(store->value.size);
+    store->id=_list_type_id(&store->prio,&store->value);
+}
+
+/** Compare the priorities of two nodes */
+static inline int pq_cmp(pq_store_t *store,const uint8_t *a,const uint8_t *b)
+{
+    return store->prio.cmp(a+store->prioOff,b+store->prioOff);
+}
+
+/** Copy a node to a heap position and record where its handle is */
+static inline void pq_place(pq_store_t *store,size_t i,const uint8_t *node)
+{
+    memcpy(PQ_NODE(store,i),node,store->size);
+    store->pos[PQ_HANDLE(node)]=i;
+}
+
+/**
+ * Move the node at i towards the root while it is lower than its parent.
+ * The node is held in tmp and parents shift down into the hole.
+ * @return final position of the node
+ */
+static size_t pq_up(pq_store_t *store,size_t i)
+{
+    memcpy(store->tmp,PQ_NODE(store,i),store->size);
+    while (i>0) {
+        size_t parent=(i-1)/PQ_ARITY;
+        if (pq_cmp(store,store->tmp,PQ_NODE(store,parent))>=0) break;
+        pq_place(store,i,PQ_NODE(store,parent));
+        i=parent;
+    }
+    pq_place(store,i,store->tmp);
+    return i;
+}
+
+/** Move the node at i towards the leaves while a child is lower */
+static void pq_down(pq_store_t *store,size_t i)
+{
+    memcpy(store->tmp,PQ_NODE(store,i),store->size);
+    for (;;) {
+        size_t first=i*PQ_ARITY+1;
+        size_t last=first+PQ_ARITY;
+        size_t min=first;
+        size_t c;
+
+        if (first>=store->count) break;
+        if (last>store->count) last=store->count;
+        for (c=first+1;c<last;c++) {
+            if (pq_cmp(store,PQ_NODE(store,c),PQ_NODE(store,min))<0) min=c;
+        }
+        if (pq_cmp(store,PQ_NODE(store,min),store->tmp)>=0) break;
+        pq_place(store,i,PQ_NODE(store,min));
+        i=min;
+    }
+    pq_place(store,i,store->tmp);
+}
+
+/** Give out an unused handle, growing the table when none are free */
+static int pq_handle(pq_store_t *store)
+{
+    uint32_t handle;
+
+    if (store->freeHandle==0) {
+        size_t n=(store->npos) ? store->npos*2 : 16;
+        uint32_t *pos;
+        size_t i;
+
+        if (n>=PQ_FREE) return -1;
+        if ((pos=realloc(store->pos,n*sizeof(*pos)))==NULL) {
+            dbg("Handle table resize ERROR %lu",n);
+            return -1;
+        }
+        /* Chain the new handles, each entry holds the next handle+1 */
+        for (i=store->npos;i<n;i++) pos[i]=PQ_FREE|((i+1<n) ? i+2 : 0);
+        store->freeHandle=store->npos+1;
+        store->pos=pos;
+        store->npos=n;
+    }
+    handle=store->freeHandle-1;
+    store->freeHandle=store->pos[handle]&~PQ_FREE;
+    return handle;
+}
+
+/** Return a handle to the free chain */
+static inline void pq_release(pq_store_t *store,uint32_t handle)
+{
+    store->pos[handle]=PQ_FREE|store->freeHandle;
+    store->freeHandle=handle+1;
+}
+
+/** Heap position of a handle, or -1 for a handle not in the queue */
+static inline long pq_find(pq_store_t *store,int handle)
+{
+    if ((handle<0)||(handle>=store->npos)||(store->pos[handle]&PQ_FREE)) return -1;
+    return store->pos[handle];
+}
+
+/** Copy out and remove the node at i, lock must be held */
+static void pq_take(pq_store_t *store,size_t i,void *prio,void *value)
+{
+    uint8_t *node=PQ_NODE(store,i);
+
+    if (prio) memcpy(prio,node+store->prioOff,store->prio.size);
+    if (value) memcpy(value,node+store->valOff,store->value.size);
+    pq_release(store,PQ_HANDLE(node));
+    if (i!=--store->count) {
+        /* Fill the hole with the last node and restore the order around it */
+        pq_place(store,i,PQ_NODE(store,store->count));
+        if (pq_up(store,i)==i) pq_down(store,i);
+    }
+}
+
+/**
+ * Add a value to the queue.
+ * @param store pointer to queue structure.
+ * @param prio pointer to the priority
+ * @param value pointer to the value
+ * @return handle of the value, -1 on allocation failure
+ */
+int _pq_push(pq_store_t *store,void *prio,void *value)
+{
+    uint8_t *node;
+    int handle;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    pq_init(store);
+    if (store->count==store->max) {
+        size_t max=(store->max) ? store->max*2 : 16;
+        uint8_t *heap=realloc(store->heap,max*store->size);
+
+        if (heap==NULL) {
+            dbg("Queue resize ERROR %lu",max);
+            pthread_mutex_unlock(&store->lock);
+            return -1;
+        }
+        store->heap=heap;
+        store->max=max;
+    }
+    if ((store->tmp==NULL)&&((store->tmp=malloc(store->size))==NULL)) {
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+    }
+    if ((handle=pq_handle(store))<0) {
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+    }
+    node=PQ_NODE(store,store->count);
+    memset(node,0x00,store->size);
+    PQ_HANDLE(node)=handle;
+    memcpy(node+store->prioOff,prio,store->prio.size);
+    memcpy(node+store->valOff,value,store->value.size);
+    store->pos[handle]=store->count++;
+    pq_up(store,store->count-1);
+    pthread_mutex_unlock(&store->lock);
+    return handle;
+}
+
+/**
+ * Remove the value with the lowest priority.
+ * @param store pointer to queue structure.
+ * @param prio priority return, or NULL
+ * @param value value return, or NULL
+ * @return false for an empty queue
+ */
+bool _pq_pop(pq_store_t *store,void *prio,void *value)
+{
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    if (store->count==0) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    pq_take(store,0,prio,value);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Read the value with the lowest priority, leaving it queued.
+ * @param store pointer to queue structure.
+ * @param prio priority return, or NULL
+ * @param value value return, or NULL
+ * @return false for an empty queue
+ */
+bool _pq_peek(pq_store_t *store,void *prio,void *value)
+{
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    if (store->count==0) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    if (prio) memcpy(prio,store->heap+store->prioOff,store->prio.size);
+    if (value) memcpy(value,store->heap+store->valOff,store->value.size);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Lower the priority of a queued value.
+ * @param store pointer to queue structure.
+ * @param handle handle returned by _pq_push
+ * @param prio pointer to the new priority
+ * @return false for a handle not in the queue or a higher priority
+ */
+bool _pq_decrease(pq_store_t *store,int handle,void *prio)
+{
+    uint8_t *node;
+    long i;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    if ((i=pq_find(store,handle))<0) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    node=PQ_NODE(store,i);
+    if (store->prio.cmp(prio,node+store->prioOff)>0) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    memcpy(node+store->prioOff,prio,store->prio.size);
+    pq_up(store,i);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Remove a queued value by handle.
+ * @param store pointer to queue structure.
+ * @param handle handle returned by _pq_push
+ * @param prio priority return, or NULL
+ * @param value value return, or NULL
+ * @return false for a handle not in the queue
+ */
+bool _pq_remove(pq_store_t *store,int handle,void *prio,void *value)
+{
+    long i;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    if ((i=pq_find(store,handle))<0) {
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+    pq_take(store,i,prio,value);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Push the values saved in a file, the queue keeps its current values.
+ * @param store pointer to queue structure.
+ * @param file file written by _pq_save
+ * @return true on success, false on fail
+ */
+bool _pq_load(pq_store_t *store,char *file)
+{
+    FILE *fp=NULL;
+    uint32_t loadId=0;
+    uint8_t *buf;
+    bool ok=true;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    pq_init(store);
+    pthread_mutex_unlock(&store->lock);
+
+    /* Open file for reading */
+    if ((fp=fopen(file,"r"))==NULL) {
+        dbg("Failed to open file %s for reading: %s",file,strerror(errno));
+        return false;
+    }
+
+    /* Check header matches this queue type and data sizes */
+    if ((fread(&loadId,sizeof(loadId),1,fp)!=1)||
+        (loadId!=store->id)) {
+        dbg("Header error for %s: %s",file,strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    /* One buffer holds the priority followed by the value */
+    if ((buf=malloc(store->prio.size+store->value.size))==NULL) {
+        dbg("Memory error for %s: %s",file,strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    /* Loop through records and push */
+    while (fread(buf,store->prio.size,1,fp)==1) {
+        if ((fread(buf+store->prio.size,store->value.size,1,fp)!=1)||
+            (_pq_push(store,buf,buf+store->prio.size)<0)) {
+            dbg("Record failed for %s: %s",file,strerror(errno));
+            ok=false;
+            break;
+        }
+    }
+    free(buf);
+    fclose(fp);
+    return ok;
+}
+
+/**
+ * Save the queued values in heap order, each as priority then value.
+ * @param store pointer to queue structure.
+ * @param file file name
+ * @return true on success, false on fail
+ */
+bool _pq_save(pq_store_t *store,char *file)
+{
+    FILE *fp=NULL;
+    size_t i;
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    pq_init(store);
+
+    /* Open file for writting */
+    if ((fp=fopen(file,"w"))==NULL) {
+        dbg("Failed to open file %s for writting: %s",file,strerror(errno));
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    /* Header: type id, so only a queue of the same types loads the file */
+    if (fwrite(&store->id,sizeof(store->id),1,fp)!=1) {
+        dbg("Header error for %s: %s",file,strerror(errno));
+        fclose(fp); unlink(file);
+        pthread_mutex_unlock(&store->lock);
+        return false;
+    }
+
+    for (i=0;i<store->count;i++) {
+        uint8_t *node=PQ_NODE(store,i);
+        if ((fwrite(node+store->prioOff,store->prio.size,1,fp)!=1)||
+            (fwrite(node+store->valOff,store->value.size,1,fp)!=1)) {
+            dbg("Record write error for %s: %s",file,strerror(errno));
+            fclose(fp); unlink(file);
+            pthread_mutex_unlock(&store->lock);
+            return false;
+        }
+    }
+
+    /* Save complete close file and return success */
+    fclose(fp);
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+
+/**
+ * Release all memory of a queue, handles given out are no longer valid.
+ * @param store pointer to queue structure.
+ * @return true
+ */
+bool _pq_free(pq_store_t *store)
+{
+    assert(store);
+
+    pthread_mutex_lock(&store->lock);
+    free(store->heap);
+    free(store->tmp);
+    free(store->pos);
+    store->heap=NULL;
+    store->tmp=NULL;
+    store->pos=NULL;
+    store->count=0;
+    store->max=0;
+    store->npos=0;
+    store->freeHandle=0;
+    pthread_mutex_unlock(&store->lock);
+    return true;
+}
+/**@}*/
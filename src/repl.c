@@ -18,6 +18,12 @@
  * Sharing is done via Multcast packets.  Sets and Deletes are shared on the
  * network.  When new clients join they ask for the current set of values.
  *
+ * All replicated stores share one epoll reactor.  Stores on the same port
+ * share one socket and a small pool of threads receives packets and
+ * dispatches them to the local stores by hash id.  Stores started with
+ * NetStartLocal share a shared memory ring instead, read by a thread of
+ * the port, and the reactor sends their updates as soon as it wakes.
+ *
  * The network feature is started 
  * @addtogroup HASH
  * @{
@@ -26,6 +32,8 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdio.h>
@@ -41,25 +49,192 @@
 #include "hash.h"
 #include "entry.h"
 #include "mcast.h"
+#include "shm.h"
 #include "repl.h"
 
-/** Return current time as long in miliseconds since epoch.
- * @return Time in miliseconds since boot
+/** Return current time as long in microseconds.
+ * @return Time in microseconds since boot
  */
-static inline long mtime() {
+static inline long utime() {
    struct timespec ts;
-   clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
-   return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec*1000000 + ts.tv_nsec/1000;
 }
 
+#ifndef REPL_MTU
+#define REPL_MTU 1472       /**< Multicast packet size, Ethernet MTU less IP/UDP */
+#endif
+#ifndef REPL_FLUSH_US
+#define REPL_FLUSH_US 1000  /**< Longest time a record waits in a batch */
+#endif
+#ifndef REPL_SYNC_BURST
+#define REPL_SYNC_BURST 16  /**< Sync packets sent per REPL_SYNC_PACE_US */
+#endif
+#ifndef REPL_SYNC_PACE_US
+#define REPL_SYNC_PACE_US 1000 /**< Sync pacing interval */
+#endif
+#ifndef REPL_THREADS
+#define REPL_THREADS 2      /**< Reactor threads shared by all stores */
+#endif
+#define REPL_START_US 200000    /**< Time to collect OP_STAT replies */
+#define REPL_IDLE_US 500000     /**< Longest reactor sleep */
+#define REPL_EVENTS 16          /**< epoll events handled per wakeup */
+#define REPL_RX_BURST 64        /**< Packets read from a socket per event */
+#define REPL_RX_BATCH 16        /**< Packets read per system call */
+#define REPL_RX_SIZE 65536      /**< Receive slot, largest UDP datagram */
+#ifndef REPL_TX_BATCH
+#define REPL_TX_BATCH REPL_SYNC_BURST /**< Packets sent per system call */
+#endif
+#ifndef REPL_HISTORY
+#define REPL_HISTORY 512    /**< Sent packets kept for retransmission */
+#endif
+#ifndef REPL_REORDER
+#define REPL_REORDER 256    /**< Out of order packets held per peer */
+#endif
+#define REPL_NACK_US 5000       /**< Time between NACKs for one gap */
+#define REPL_GAP_US 200000      /**< Time before a gap falls back to OP_SYNC */
+#define REPL_ANNOUNCE_US 10000  /**< Quiet time before the last seq is sent */
+#define REPL_PEER_US 1000000    /**< Silence before a peer's receive state is dropped */
+#ifndef REPL_BUCKETS
+#define REPL_BUCKETS 128        /**< Digest buckets, a power of 2 */
+#endif
+#define REPL_SYNC_SCAN 16384    /**< Entries checked per sync burst */
+#define REPL_PULL_US 1000000    /**< Idle time before a pull is restarted */
+#ifndef REPL_TOMBS
+#define REPL_TOMBS 1024         /**< Recent deletes sent to repair a replica */
+#endif
+#define REPL_CTL_MAX (64+REPL_BUCKETS*8) /**< Largest control payload */
+#define REPL_FILTERS 16         /**< Key ranges sent in a sync request */
+#define REPL_FILTER_MAX 512     /**< Bytes of key ranges in a sync request */
+#define REPL_VNODES 64          /**< Ring points per partition member */
+#define REPL_HELLO_US 100000    /**< Partition member announcement interval */
+#define REPL_MEMBER_US 1000000  /**< Silence before a member is dropped */
+#define REPL_SETTLE_US 50000    /**< Quiet time after a view change */
+#define REPL_FETCH_US 100000    /**< Wait for each owner of a forwarded get */
+#define REPL_WINDOW_US 20000    /**< Receive window advertisement interval */
+#ifndef REPL_QUEUE
+#define REPL_QUEUE (256*1024)   /**< Outbound record queue, a power of 2 */
+#endif
+
 int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes);
-static int socketReady(int sock, long tmOutms);
+static bool repl_queue(list_store_t *store,uint8_t op,void *key,int keysize,
+        void *val,int valsize);
+static bool repl_batch_add(list_store_t *store,uint8_t op,void *key,int keysize,
+        void *val,int valsize);
+static bool repl_drain(list_store_t *store,bool paced);
+static bool repl_flush(list_store_t *store);
+static bool repl_finish(list_store_t *store,uint8_t op);
+static bool repl_send_held(list_store_t *store);
+static bool repl_sync_burst(list_store_t *store);
+static void repl_wake(void);
+static void repl_accept(list_store_t *store,void *vpkt,int bytes);
+static long repl_gap_check(list_store_t *store);
+static void repl_retransmit(list_store_t *store,uint32_t first,uint32_t count);
+static void repl_peers_free(list_store_t *store);
+static void repl_pull_start(list_store_t *store,id_t node,bool join);
+static void repl_pull_compare(list_store_t *store,void *vmsg);
+static void repl_pull_done(list_store_t *store);
+static void repl_digest_all(list_store_t *store);
+static void repl_tomb(list_store_t *store,void *key);
+static bool repl_tombed(list_store_t *store,void *key);
+static void repl_sync_drops(list_store_t *store);
+static void repl_pend_flush(list_store_t *store);
+static bool repl_in_range(list_store_t *store,void *key,void **range,int n);
+static int repl_filter_parse(list_store_t *store,uint8_t *buf,int bytes,
+        void **range,int *used);
+static void repl_sync_ranges(list_store_t *store,uint8_t *buf,int bytes,
+        bool merge);
+static uint64_t repl_digest_range(list_store_t *store,uint64_t *digest,
+        void **range,int n);
 
 /** Type for IDs */
 typedef uint32_t id_t;
 
+static void repl_member_seen(list_store_t *store,id_t node);
+static void repl_member_drop(list_store_t *store,id_t node);
+static void repl_repair(list_store_t *store,id_t node);
+static long repl_partition_tick(list_store_t *store,long now);
+static void repl_get_reply(list_store_t *store,id_t node,void *vreq,int bytes);
+static void repl_reassemble(list_store_t *store,id_t node,uint8_t *data,int bytes);
+
+/** Socket or ring shared by the local stores replicating on one port */
+typedef struct {
+    int sock;               /**< Multicast socket, -1 when closed */
+    uint16_t port;          /**< Port number */
+    bool local;             /**< Shared memory port */
+    shm_ring_t *ring;       /**< Ring of a local port, NULL when closed */
+    shm_reader_t reader;    /**< Read position in ring */
+    pthread_t thread;       /**< Receive thread of a local port */
+    bool quit;              /**< Stops the receive thread */
+    int nstores;            /**< Number of stores on this port */
+    int maxstores;          /**< Allocated size of stores */
+    list_store_t **stores;  /**< Stores on this port */
+    long rxStart;           /**< Time in usec the receive space period began */
+    long rxFree;            /**< Least receive space seen this period */
+    long rxWindow;          /**< Least receive space of the last period */
+} repl_port_t;
+
+/** Receive state for one remote node sending on a store */
+typedef struct {
+    id_t node;              /**< Node id of the sender */
+    uint32_t next;          /**< Next sequence number to deliver */
+    uint32_t want;          /**< One past the highest sequence known sent */
+    long gapTime;           /**< Time in usec the current gap was seen */
+    long nackTime;          /**< Time in usec of the last NACK */
+    uint8_t *held;          /**< REPL_REORDER slots of txMax bytes, by seq */
+    int heldLen[REPL_REORDER];   /**< Size of each held packet, 0 if empty */
+    uint8_t *frag;          /**< Record being reassembled from OP_FRAG */
+    uint32_t fragLen;       /**< Bytes of the record received */
+    uint32_t fragTotal;     /**< Size of the record, 0 if none in progress */
+    long rxTime;            /**< Time in usec of its last batch packet */
+    long seen;              /**< Time in usec of its last packet */
+    long window;            /**< Receive space it advertised */
+    long windowTime;        /**< Time in usec of its last OP_WINDOW */
+} repl_peer_t;
+
+/** Point of a member on the consistent hash ring */
+typedef struct {
+    uint32_t hash;          /**< Position on the ring */
+    id_t node;              /**< Member owning the arc ending here */
+} repl_point_t;
+
+/** Consistent hash ring of the members of a partition */
+typedef struct {
+    id_t *nodes;            /**< Member ids, sorted */
+    int nnodes;             /**< Number of members */
+    repl_point_t *points;   /**< REPL_VNODES points per member, sorted */
+    int npoints;            /**< Number of points */
+} repl_ring_t;
+
+/** Partition member heard from */
+typedef struct {
+    id_t node;              /**< Node id of the member */
+    long seen;              /**< Time in usec of its last OP_HELLO */
+} repl_member_t;
+
+/** Replication reactor shared by all stores */
+static struct {
+    pthread_mutex_t lock;       /**< Serializes start and close */
+    pthread_rwlock_t rwlock;    /**< Held for reading while dispatching */
+    int epfd;                   /**< epoll instance */
+    int wake;                   /**< eventfd to recompute timeouts or exit */
+    bool running;               /**< Threads keep running while set */
+    pthread_t threads[REPL_THREADS];
+    int nthreads;               /**< Number of threads started */
+    repl_port_t **ports;        /**< Ports ever opened, freed on stop */
+    int nports;                 /**< Number of entries in ports */
+    int nstores;                /**< Number of stores being replicated */
+    uint32_t seq;               /**< Node id sequence */
+} reactor = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .rwlock = PTHREAD_RWLOCK_INITIALIZER,
+    .epfd = -1,
+    .wake = -1,
+};
+
 struct repl_info {
-    int sock;
+    int sock;               /**< Shared socket for the port */
+    repl_port_t *rport;     /**< Port entry holding this store */
     uint16_t port;
     id_t id;
     id_t self;
@@ -68,27 +243,165 @@ struct repl_info {
 #define STATE_RUN 1         /**< Runtime state */
 #define STATE_START_SYNC 2  /**< Initialize and start a SYNC Transmission */
 #define STATE_SYNC 3        /**< Transmit SYNC packets */
+    long startTime;         /**< Time in usec to leave STATE_START */
+    long syncNext;          /**< Time in usec for the next sync burst */
     uint32_t maxCount;      /**< Maximum number of entries in OP_STAT responses */
     id_t maxNode;           /**< Node with most entries */
+    bool synced;            /**< Initial state received from maxNode */
+    size_t syncIndex;       /**< Next index for sync response */
+    void *syncKey;          /**< Last key sent in sync response */
+    bool syncHasKey;        /**< syncKey is valid */
+    size_t syncSent;        /**< Entries sent in sync response */
+    uint8_t syncMask[REPL_BUCKETS/8]; /**< Buckets sent in sync response */
+    uint8_t syncFilter[REPL_FILTER_MAX]; /**< Packed ranges of the request */
+    int syncFilterLen;      /**< Bytes used in syncFilter */
+    void *syncRange[REPL_FILTERS*2];  /**< Keys in syncFilter, lo/hi pairs */
+    int nSyncRange;         /**< Ranges sent in sync response, 0 for all */
+    bool pulling;           /**< Waiting on buckets from pullNode */
+    bool pullRanged;        /**< pullNode digests cover only our ranges */
+    bool pullJoin;          /**< Join pull, pullNode's table replaces ours */
+    bool pullEnd;           /**< OP_SYNC_DONE came ahead of a gap from pullNode */
+    bool pullAgain;         /**< pullNode's stream lost records, pull once done */
+    id_t pullNode;          /**< Node the differing buckets come from */
+    long pullTime;          /**< Time in usec of the last pull progress */
+    uint64_t digest[REPL_BUCKETS]; /**< XOR of entry hashes per key bucket */
+    uint8_t *tombs;         /**< Keys of the last REPL_TOMBS deletes, a ring */
+    uint32_t ntombs;        /**< Deletes recorded, under store->lock */
+    long coalesceUs;        /**< Window for collapsing updates of a key */
+    uint8_t *pend;          /**< Keys updated in the window, under store->lock */
+    int npend;              /**< Number of keys in pend */
+    int maxpend;            /**< Allocated keys in pend */
+    long pendStart;         /**< Time in usec the window opened */
+    repl_ring_t ring;       /**< Owners of keys, set under store->lock */
+    repl_ring_t viewOld;    /**< Ring the table matches until rebalanced */
+    repl_member_t *members; /**< Other members of the partition */
+    int nmembers;           /**< Number of members */
+    long helloTime;         /**< Time in usec of the last OP_HELLO */
+    bool viewChanged;       /**< Members changed, a rebalance is due */
+    long viewTime;          /**< Time in usec of the last view change */
+    bool rebalancing;       /**< Walking the table to move keys */
+    long rebalNext;         /**< Time in usec for the next rebalance burst */
+    size_t rebalIndex;      /**< Next index to check */
+    void *rebalKey;         /**< Last key kept by the walk */
+    bool rebalHasKey;       /**< rebalKey is valid */
+    size_t rebalSent;       /**< Entries sent to new owners */
+    pthread_mutex_t fetchLock;  /**< Serializes forwarded gets */
+    pthread_cond_t fetchCond;   /**< Signals the reply of a forwarded get */
+    uint32_t fetchReq;      /**< Request number of the forwarded get */
+    void *fetchDst;         /**< Value output of the waiting get */
+    bool fetchDone;         /**< An owner replied */
+    bool fetchFound;        /**< The owner had the key */
     pthread_cond_t startCond;
     pthread_mutex_t netLock;
+    pthread_mutex_t runLock;/**< Held while packets or timers are processed */
+    bool armed;             /**< Wake already sent for the pending records */
+    uint8_t *q;             /**< Outbound record queue, one producer */
+    size_t qSize;           /**< Size of q, a power of 2 */
+    size_t qHead;           /**< Queue write position, producers only */
+    size_t qTail;           /**< Queue read position, under txLock */
+    pthread_mutex_t txLock; /**< Lock for the outbound batch */
+    uint8_t *txBuf;         /**< REPL_TX_BATCH packet slots of txMax bytes */
+    uint8_t *tx;            /**< Outbound batch packet, a slot in txBuf */
+    int txLen;              /**< Bytes used in tx, including the header */
+    int txMax;              /**< Size of tx */
+    int txLens[REPL_TX_BATCH]; /**< Sizes of the finished packets held */
+    int txHeld;             /**< Finished packets waiting in txBuf */
+    bool txHold;            /**< Hold finished packets to send together */
+    uint32_t txSeq;         /**< Sequence number of the last batch packet */
+    uint32_t txSeqSent;     /**< Sequence number of the last packet sent */
+    uint32_t txSeqTold;     /**< Last sequence number announced */
+    long txSentTime;        /**< Time in usec of the last batch send */
+    uint8_t *hist;          /**< REPL_HISTORY sent packets of txMax bytes */
+    int histLen[REPL_HISTORY];      /**< Size of each history packet */
+    uint32_t histSeq[REPL_HISTORY]; /**< Sequence number in each slot */
+    repl_peer_t *peers;     /**< Receive state of each remote node */
+    int npeers;             /**< Number of peers */
+    int maxpeers;           /**< Allocated size of peers */
+    long txStart;           /**< Time in usec the first record was queued */
+    long paceRate;          /**< Send limit in bytes/sec, 0 for none */
+    long paceBurst;         /**< Bucket size in bytes */
+    long paceTokens;        /**< Bucket level in bytes*1000000, under txLock */
+    long paceTime;          /**< Time in usec of the last refill */
+    long paceWindow;        /**< Rate the receivers can take, 0 if unknown */
+    bool rxActive;          /**< Batch packets received since the last OP_WINDOW */
+    long windowTime;        /**< Time in usec of the last OP_WINDOW */
+    unsigned long txCount;  /**< Number of batch packets sent */
 };
 
 typedef struct __attribute__ ((packed)) {
     uint16_t size;
     id_t hashid;
     id_t nodeid;
+    uint32_t seq;       /**< OP_BATCH sequence, else the last one sent */
     uint8_t op;
     uint8_t data[];
 } packet_t;
 
 /* Mcast shared operations */
-#define OP_NOP 0xef     /**< Null Op, wakes select/recv to check exit flag */
+#define OP_NOP 0xef     /**< Null Op, announces the last sequence sent */
 #define OP_SET 1        /**< Set a value */
 #define OP_DEL 2        /**< Delete a value */
 #define OP_SYNC 3       /**< Request that node provides all entries */
 #define OP_STAT_REQ 4   /**< Request Status information */
 #define OP_STAT 5       /**< Status info reply with count of entries */
+#define OP_BATCH 6      /**< Sequence of op byte and SET/DEL record pairs */
+#define OP_SYNC_DONE 7  /**< Sync response complete, with count of entries */
+#define OP_NACK 8       /**< Request retransmission of a sequence range */
+#define OP_DIGEST_REQ 9 /**< Request the bucket digests of a node and ranges */
+#define OP_DIGEST 10    /**< Bucket digests for the requesting node */
+#define OP_HELLO 11     /**< Partition member announcement */
+#define OP_BYE 12       /**< Partition member leaving */
+#define OP_GET 13       /**< Get forwarded to an owner of the key */
+#define OP_GET_REP 14   /**< Value of a forwarded get */
+#define OP_REPAIR 15    /**< Send the sender the keys it owns again */
+#define OP_WINDOW 16    /**< Receive space per sender, bytes per REPL_WINDOW_US */
+#define OP_FRAG 17      /**< Part of a record too large for one packet */
+#define OP_DROP 18      /**< Recent delete, removes a key a pull marked stale */
+#define OP_COPY 19      /**< Set from a sync stream */
+
+/** OP_SYNC payload, followed by the key ranges to send */
+typedef struct __attribute__ ((packed)) {
+    id_t node;          /**< Node to send the buckets */
+    uint8_t mask[REPL_BUCKETS/8]; /**< Buckets to send */
+} sync_req_t;
+
+/** OP_DIGEST payload */
+typedef struct __attribute__ ((packed)) {
+    id_t node;          /**< Node that requested the digests */
+    uint64_t count;     /**< Number of entries */
+    uint64_t digest[REPL_BUCKETS];
+} digest_msg_t;
+
+/** OP_NACK payload */
+typedef struct __attribute__ ((packed)) {
+    id_t node;          /**< Node to retransmit */
+    uint32_t first;     /**< First missing sequence number */
+    uint32_t count;     /**< Number of packets missing */
+} nack_t;
+
+/** OP_FRAG payload, followed by bytes of the record */
+typedef struct __attribute__ ((packed)) {
+    uint32_t total;     /**< Size of the record, op byte included */
+    uint32_t offset;    /**< Position of these bytes in the record */
+} frag_t;
+
+/** OP_GET payload, followed by the key */
+typedef struct __attribute__ ((packed)) {
+    id_t owner;         /**< Owner asked for the value */
+    uint32_t req;       /**< Request number, returned in the reply */
+} get_req_t;
+
+/** OP_GET_REP payload, followed by the value if found */
+typedef struct __attribute__ ((packed)) {
+    id_t node;          /**< Node that forwarded the get */
+    uint32_t req;       /**< Request number of the get */
+    uint8_t found;      /**< The owner has the key */
+} get_rep_t;
+
+#ifdef UNIT_TEST
+unsigned int repl_test_drop;    /**< Drop every Nth OP_BATCH or OP_FRAG received */
+static unsigned int dropCount;
+#endif
 
 #ifdef HDEBUG
 static char *opLu[] = {
@@ -98,154 +411,691 @@ static char *opLu[] = {
     [OP_SYNC] = "SYNC",
     [OP_STAT_REQ] = "STAT_REQ",
     [OP_STAT] = "STAT",
+    [OP_BATCH] = "BATCH",
+    [OP_SYNC_DONE] = "SYNC_DONE",
+    [OP_NACK] = "NACK",
+    [OP_DIGEST_REQ] = "DIGEST_REQ",
+    [OP_DIGEST] = "DIGEST",
+    [OP_HELLO] = "HELLO",
+    [OP_BYE] = "BYE",
+    [OP_GET] = "GET",
+    [OP_GET_REP] = "GET_REP",
+    [OP_REPAIR] = "REPAIR",
+    [OP_WINDOW] = "WINDOW",
+    [OP_FRAG] = "FRAG",
+    [OP_DROP] = "DROP",
+    [OP_COPY] = "COPY",
 };
 #endif
 
-/** Macro to send message header
+/**
+ * Send packets on the transport of a store.
+ * @param store List master structure
+ * @param buf count slots of size bytes, one packet per slot
+ * @param size Size of each slot
+ * @param lens Number of bytes to send from each slot
+ * @param count Number of slots
+ * @return Number of packets sent, <0 on error
+ */
+static int repl_send(list_store_t *store,uint8_t *buf,int size,int *lens,int count)
+{
+    repl_port_t *rport=store->net->rport;
+
+    if (rport->ring) return shm_send_batch(rport->ring,buf,size,lens,count);
+    return mcast_send_batch(store->net->sock,store->port,buf,size,lens,count,0);
+}
+
+/** Send a control message.  The packet is built on the stack, so control
+ * messages never allocate and may be sent from any thread.
  * @param store List master structure
  * @param op opcode for message
- * @param size number of bytes in complete message
+ * @param buf payload, may be NULL
+ * @param size number of payload bytes, at most REPL_CTL_MAX
  * @return number of bytes sent or error from sendto.  This includes the
  * header size.
  */
 static inline int send_msg(list_store_t *store, uint8_t op,void *buf,int size)
 {
-    int ret=-1;
+    uint8_t raw[sizeof(packet_t)+REPL_CTL_MAX];
+    packet_t *pkt=(packet_t *)raw;
     int msize=offsetof(packet_t,data)+size;
-    packet_t *pkt=NULL;
+    int ret;
 
-    /* Alocate send buffer and populate */
-    if ((pkt=malloc(msize))) {
-        pkt->size=msize;
-        pkt->hashid=store->id;
-        pkt->nodeid=store->net->self;
-        pkt->op=op;
-        if (buf) {
-            memcpy(&pkt->data[0],buf,size);
-        }
-        ret=mcast_send(store->net->sock,store->port,pkt,msize,0);
-        if (ret<msize) {
-            fprintf(stderr,"send_MSg size issue: expected: %d, actual: %d\n",msize,ret);
-        }
-        free(pkt);
+    assert(size<=REPL_CTL_MAX);
+    pkt->size=msize;
+    pkt->hashid=store->id;
+    pkt->nodeid=store->net->self;
+    /* Lets receivers see a lost packet at the end of a burst */
+    pthread_mutex_lock(&store->net->txLock);
+    pkt->seq=store->net->txSeqSent;
+    pthread_mutex_unlock(&store->net->txLock);
+    pkt->op=op;
+    if (buf) {
+        memcpy(&pkt->data[0],buf,size);
+    }
+    ret=(repl_send(store,raw,msize,&msize,1)==1) ? msize : -1;
+    if (ret<msize) {
+        fprintf(stderr,"send_MSg size issue: expected: %d, actual: %d\n",msize,ret);
     }
     return ret;
 }
 
-/** This function serves as the main thread for recieving hash updates */
-static void *store_replication(void *vstore)
+/** Send rate in bytes/sec, the configured rate capped by the receivers.
+ * A full receiver still gets one packet per REPL_WINDOW_US. */
+static inline long repl_pace_rate(repl_info_t *net)
 {
-    /* Global data structures */
-    list_store_t *store=(list_store_t *)vstore;
-    repl_info_t *net=store->net;    /**< Pointer to data structure */
+    long rate=net->paceRate;
+    long floor=(long)net->txMax*(1000000/REPL_WINDOW_US);
 
-    uint8_t *buf;                   /**< Buffer for received data */
-    int bytes;                      /**< Number of bytes read */
+    if ((net->paceWindow)&&(net->paceWindow<rate)) {
+        rate=(net->paceWindow>floor) ? net->paceWindow : floor;
+        if (rate>net->paceRate) rate=net->paceRate;
+    }
+    return rate;
+}
+
+/**
+ * Refill the token bucket of a paced store, txLock must be held.
+ * @param store List master structure
+ * @param now Current time in usec
+ * @return Time in usec until the bucket has tokens, 0 if sending may go on
+ */
+static long repl_pace_delay(list_store_t *store,long now)
+{
+    repl_info_t *net=store->net;
+    long full=net->paceBurst*1000000L;
+    long rate;
+
+    if (net->paceRate==0) return 0;
+    rate=repl_pace_rate(net);
+    /* Long idle times fill the bucket without overflowing the product */
+    if (now-net->paceTime>=(full-net->paceTokens)/rate+1) {
+        net->paceTokens=full;
+    } else {
+        net->paceTokens+=(now-net->paceTime)*rate;
+    }
+    net->paceTime=now;
+    if (net->paceTokens>0) return 0;
+    return -net->paceTokens/rate+1;
+}
+
+/** Take sent bytes from the bucket, txLock must be held.  The bucket may go
+ * negative, the next send waits for it to refill. */
+static inline void repl_pace_use(repl_info_t *net,int *lens,int count)
+{
+    int i;
+
+    if (net->paceRate==0) return;
+    for (i=0;i<count;i++) net->paceTokens-=lens[i]*1000000L;
+}
+
+/** Time in usec until a paced store may send its next burst */
+static long repl_pace_wait(list_store_t *store,long now)
+{
+    long wait;
+
+    if (store->net->paceRate==0) return 0;
+    pthread_mutex_lock(&store->net->txLock);
+    wait=repl_pace_delay(store,now);
+    pthread_mutex_unlock(&store->net->txLock);
+    return wait;
+}
+
+/** Note the receive space of a port as packets arrive, keeping the least
+ * seen in each REPL_WINDOW_US period.  Only the receiving thread of the
+ * port calls this. */
+static void repl_rx_space(repl_port_t *rport,long space)
+{
+    long now=utime();
+
+    if (space<0) return;
+    if (now-rport->rxStart>=REPL_WINDOW_US) {
+        if (rport->rxStart) rport->rxWindow=rport->rxFree;
+        rport->rxFree=space;
+        rport->rxStart=now;
+    } else if (space<rport->rxFree) {
+        rport->rxFree=space;
+    }
+}
+
+/**
+ * Advertise the receive space of the store's port, shared among the peers
+ * that sent batch packets recently.  runLock must be held.
+ * @param store List master structure
+ * @param now Current time in usec
+ */
+static void repl_window_send(list_store_t *store,long now)
+{
+    repl_info_t *net=store->net;
+    repl_port_t *rport=net->rport;
+    long space=__atomic_load_n(&rport->rxWindow,__ATOMIC_RELAXED);
+    long cur=__atomic_load_n(&rport->rxFree,__ATOMIC_RELAXED);
+    uint32_t window;
+    int senders=0;
+    int i;
+
+    if ((space<0)||((cur>=0)&&(cur<space))) space=cur;
+    if (space<0) return;
+    for (i=0;i<net->npeers;i++) {
+        if (now-net->peers[i].rxTime<2*REPL_WINDOW_US) senders++;
+    }
+    if (senders>1) space/=senders;
+    window=(space>UINT32_MAX) ? UINT32_MAX : (uint32_t)space;
+    send_msg(store,OP_WINDOW,&window,sizeof(window));
+}
+
+/** Least rate in bytes/sec the peers advertised recently, 0 if none did,
+ * runLock must be held */
+static long repl_window_rate(list_store_t *store,long now)
+{
+    repl_info_t *net=store->net;
+    long rate=0;
+    int i;
+
+    for (i=0;i<net->npeers;i++) {
+        repl_peer_t *peer=&net->peers[i];
+        if ((peer->windowTime)&&(now-peer->windowTime<3*REPL_WINDOW_US)) {
+            long r=peer->window*(1000000/REPL_WINDOW_US);
+            if ((rate==0)||(r<rate)) rate=r;
+        }
+    }
+    return rate;
+}
+
+/**
+ * Run the timers and state machine of one store, runLock must be held.
+ * @param store List master structure
+ * @return Time in usec until the store next needs service
+ */
+static long repl_tick(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    int hdrSize=offsetof(packet_t,data);
+    long now=utime();
+    long next=REPL_IDLE_US;
+    bool announce=false;
+
+    /* Send the latest value of keys updated in a closed window */
+    if (__atomic_load_n(&net->npend,__ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&store->lock);
+        if (net->npend) {
+            long age=now-net->pendStart;
+            if (age>=net->coalesceUs) repl_pend_flush(store);
+            else next=net->coalesceUs-age;
+        }
+        pthread_mutex_unlock(&store->lock);
+    }
+
+    /* Tell the senders how much this node can take */
+    if (net->rxActive) {
+        if (now-net->windowTime>=REPL_WINDOW_US) {
+            repl_window_send(store,now);
+            net->rxActive=false;
+            net->windowTime=now;
+        } else if (net->windowTime+REPL_WINDOW_US-now<next) {
+            next=net->windowTime+REPL_WINDOW_US-now;
+        }
+    }
+    if (net->paceRate) {
+        long rate=repl_window_rate(store,now);
+        pthread_mutex_lock(&net->txLock);
+        net->paceWindow=rate;
+        pthread_mutex_unlock(&net->txLock);
+    }
+
+    /* Move queued records to the batch and send it once it has waited
+     * REPL_FLUSH_US, a paced store moves only what the bucket allows.  A
+     * ring send costs no system call, so a local store sends the records
+     * that collected since the wake at once, packed into as few slots as
+     * they fit. */
+    pthread_mutex_lock(&net->txLock);
+    repl_pace_delay(store,now);
+    repl_drain(store,true);
+    if (net->txLen>hdrSize) {
+        long age=now-net->txStart;
+        if ((age>=REPL_FLUSH_US)||(net->rport->ring)) repl_flush(store);
+        else if (REPL_FLUSH_US-age<next) next=REPL_FLUSH_US-age;
+    }
+    if (__atomic_load_n(&net->qHead,__ATOMIC_SEQ_CST)!=net->qTail) {
+        long wait=repl_pace_delay(store,now);
+        if (wait) {
+            /* Records left for the bucket to refill */
+            if (wait<next) next=wait;
+        } else if (!__atomic_load_n(&net->armed,__ATOMIC_SEQ_CST)) {
+            /* A record queued as the flush cleared armed did not wake us */
+            next=0;
+        }
+    }
+    /* Once sending stops, announce the last seq so a lost tail is seen */
+    if (net->txSeqTold!=net->txSeqSent) {
+        long quiet=now-net->txSentTime;
+        if (quiet>=REPL_ANNOUNCE_US) {
+            net->txSeqTold=net->txSeqSent;
+            announce=true;
+        } else if (REPL_ANNOUNCE_US-quiet<next) {
+            next=REPL_ANNOUNCE_US-quiet;
+        }
+    }
+    pthread_mutex_unlock(&net->txLock);
+    if (announce) send_msg(store,OP_NOP,NULL,0);
+
+    /* Start a stalled pull again */
+    if (net->pulling) {
+        if (now-net->pullTime>=REPL_PULL_US) {
+            repl_pull_start(store,net->pullNode,net->pullJoin);
+        } else if (net->pullTime+REPL_PULL_US-now<next) {
+            next=net->pullTime+REPL_PULL_US-now;
+        }
+    }
+
+    /* Repeat NACKs or give up on old gaps */
+    if (net->npeers) {
+        long gap=repl_gap_check(store);
+        if (gap<next) next=gap;
+    }
+
+    /* Announce membership and move keys after a view change */
+    if (store->partition) {
+        long part=repl_partition_tick(store,now);
+        if (part<next) next=part;
+    }
+
+    /* Run State machine */
+    switch (net->state) {
+        case STATE_RUN:
+            break;
+        case STATE_START_SYNC:
+            dbg("Sync requested");
+            net->syncIndex=0;
+            net->syncHasKey=false;
+            net->syncSent=0;
+            net->syncNext=now;
+            net->state=STATE_SYNC;
+            /* Fall through */
+        case STATE_SYNC:
+            /* Keep sync bursts paced, but moving */
+            if (now>=net->syncNext) {
+                long wait=repl_pace_wait(store,now);
+                if (wait) {
+                    net->syncNext=now+wait;
+                } else if (repl_sync_burst(store)) {
+                    uint64_t sent=net->syncSent;
+                    dbg("Sync complete: %lu",net->syncSent);
+                    send_msg(store,OP_SYNC_DONE,&sent,sizeof(sent));
+                    net->state=STATE_RUN;
+                    break;
+                } else {
+                    net->syncNext=now+REPL_SYNC_PACE_US;
+                }
+            }
+            if (net->syncNext-now<next) next=net->syncNext-now;
+            break;
+        case STATE_START:
+            if (now>=net->startTime) {
+                net->state=STATE_RUN;
+                /* Reconcile with the running node holding the most data,
+                 * partition owners send their keys to new members */
+                if ((net->maxCount)&&(!store->partition)) {
+                    dbg("Requesting digests from id: %x count: %d\n",
+                            net->maxNode,net->maxCount);
+                    repl_pull_start(store,net->maxNode,true);
+                } else {
+                    /* Nothing to wait for */
+                    pthread_mutex_lock(&net->netLock);
+                    net->synced=true;
+                    pthread_cond_broadcast(&net->startCond);
+                    pthread_mutex_unlock(&net->netLock);
+                }
+            } else if (net->startTime-now<next) {
+                next=net->startTime-now;
+            }
+            break;
+        default:
+            break;
+    } /* End of switch */
+    return next;
+}
+
+/**
+ * Dispatch received packets to the local stores with the same hash id.
+ * Packets sent by a store are not returned to it.
+ * @param rport Port the packets arrived on
+ * @param buf n slots of size bytes, one packet per slot
+ * @param size Size of each slot
+ * @param lens Size of each packet
+ * @param n Number of packets
+ */
+static void repl_dispatch(repl_port_t *rport,uint8_t *buf,int size,int *lens,int n)
+{
     /** Header Size, includes Hash ID, Self ID and OP */
     int hdrSize=offsetof(packet_t,data);
-    int size=5*(hdrSize+store->key.sz(NULL)+store->value.sz(NULL));
+    int j;
 
+    for (j=0;j<n;j++) {
+        packet_t *ptr=(packet_t *)(buf+(size_t)j*size);
+        int bytes=lens[j];
+        int i;
 
-    /* Alocate buffer for received data packets */
-    buf=calloc(1,size);
+        /* Drop truncated or malformed packets */
+        if ((bytes<hdrSize)||(ptr->size!=bytes)) continue;
+        for (i=0;i<rport->nstores;i++) {
+            list_store_t *store=rport->stores[i];
+            repl_info_t *net=store->net;
+
+            /* discard packets from self or other hashes */
+            if ((ptr->hashid!=store->id)||(ptr->nodeid==net->self)) continue;
+
+            /* Process message */
+            dbg("process(%s): n: %x b: %d",opLu[ptr->op],ptr->nodeid,bytes);
+            pthread_mutex_lock(&net->runLock);
+            repl_accept(store,ptr,bytes);
+            pthread_mutex_unlock(&net->runLock);
+        }
+    }
+}
+
+/**
+ * Read the waiting packets on a port socket and dispatch them.
+ * @param rport Port with data ready
+ * @param buf Receive buffer
+ * @param size Size of buf
+ */
+static void repl_receive(repl_port_t *rport,uint8_t *buf,int size)
+{
+    int lens[REPL_RX_BATCH];
+    int count=0;
+    int n;
+
+    /* The kernel charges a full datagram about twice its payload */
+    n=mcast_rx_free(rport->sock);
+    repl_rx_space(rport,(n>0) ? n/2 : n);
+    /* Read available packets, the socket is rearmed if more remain */
+    while ((count<REPL_RX_BURST)&&
+            ((n=mcast_recv_batch(rport->sock,buf,size,lens,REPL_RX_BATCH,
+                                 MSG_DONTWAIT))>0)) {
+        repl_dispatch(rport,buf,size,lens,n);
+        count+=n;
+        if (n<REPL_RX_BATCH) break;
+    }
+}
+
+/** Receive thread of a shared memory port.  Store timers stay with the
+ * reactor threads. */
+static void *repl_local(void *arg)
+{
+    repl_port_t *rport=arg;
+    int size=shm_mtu();
+    int lens[REPL_RX_BATCH];
+    uint8_t *buf;
+
+    buf=malloc((size_t)REPL_RX_BATCH*size);
     if (buf==NULL) {
-        fprintf(stderr,"memory allocation failure: %d bytes\n",5*size);
+        fprintf(stderr,"memory allocation failure: %d bytes\n",
+                REPL_RX_BATCH*size);
         return NULL;
     }
+    while (!__atomic_load_n(&rport->quit,__ATOMIC_ACQUIRE)) {
+        int n;
 
+        repl_rx_space(rport,shm_space(rport->ring,&rport->reader));
+        n=shm_recv_batch(rport->ring,&rport->reader,buf,size,lens,
+                REPL_RX_BATCH);
 
-    dbg("Replication Thread Started");
+        if (n>0) {
+            pthread_rwlock_rdlock(&reactor.rwlock);
+            repl_dispatch(rport,buf,size,lens,n);
+            pthread_rwlock_unlock(&reactor.rwlock);
+        } else {
+            shm_wait(rport->ring,&rport->reader,REPL_IDLE_US);
+        }
+    }
+    free(buf);
+    return NULL;
+}
 
-    /* Generate own id from pthread_self() */
-    net->self=pthread_self();
+/** Stop the receive thread and unmap the ring of a local port without
+ * stores, reactor.lock must be held and reactor.rwlock must not be. */
+static void repl_local_close(repl_port_t *rport)
+{
+    if (rport->ring==NULL) return;
+    __atomic_store_n(&rport->quit,true,__ATOMIC_RELEASE);
+    shm_wake(rport->ring);
+    pthread_join(rport->thread,NULL);
+    shm_close(rport->ring);
+    rport->ring=NULL;
+}
 
-    /* Set initial state */
-    net->state=STATE_START;
+/** Reactor thread, receives packets for all ports and runs store timers */
+static void *repl_reactor(void *arg)
+{
+    struct epoll_event events[REPL_EVENTS];
+    uint8_t *buf;                   /**< Buffer for received data */
+    long tmOut=0;                   /**< Wait time in usec */
 
-    /* See if existing nodes have more data */
-    send_msg(store,OP_STAT_REQ,NULL,0);
+    /* Alocate buffer for received data packets */
+    buf=malloc(REPL_RX_BATCH*REPL_RX_SIZE);
+    if (buf==NULL) {
+        fprintf(stderr,"memory allocation failure: %d bytes\n",
+                REPL_RX_BATCH*REPL_RX_SIZE);
+        return NULL;
+    }
+    while (reactor.running) {
+        int n,i,p;
 
-    dbg("Replicator Starting: id: %x, self: %x, sock: %d port: %u",store->id,
-            net->self,net->sock,store->port);
+        n=epoll_wait(reactor.epfd,events,REPL_EVENTS,(tmOut+999)/1000);
+        /* Leave the wake set so every thread sees the exit */
+        if (!reactor.running) break;
+        if (n<0) {
+            /* Error, sleep to stop runaway error */
+            if (errno!=EINTR) usleep(10000);
+            n=0;
+        }
 
-    /* Notify parent thread we are running */
-    pthread_mutex_lock(&net->netLock);
-    pthread_cond_broadcast(&net->startCond);
-    pthread_mutex_unlock(&net->netLock);
+        pthread_rwlock_rdlock(&reactor.rwlock);
+        for (i=0;i<n;i++) {
+            repl_port_t *rport=events[i].data.ptr;
 
-    /* Runtime Processing */
-    {
-        /* Assign offsets in data buffer */
-        int delay=200;      /**< Time to sleep waiting for next packet */
-        long startTime=mtime()+delay;   /**< Time to wait before entering run
-                                          *  state */
-        int index=0;          /**< Current index for sync response */
-        _entry_t *eptr=NULL;  /**< Pointer for entries in sync response */
-
-        /* Main loop */
-        while (store->port) {
-            /* Wait for/process incoming data */
-            if (socketReady(net->sock,delay)) {
-                int hdrSize=offsetof(packet_t,data);
-
-                /* Read all available packets until empty */
-                while ((bytes=mcast_recv(net->sock,buf,size,MSG_DONTWAIT))>0) {
-                    packet_t *ptr=(packet_t *)buf;
-                    assert(ptr->size==bytes);
-                    /* discard packets from self or other hashes */
-                    if ((ptr->hashid!=store->id)||(ptr->nodeid==net->self)) continue;
-
-                    /* Process message */
-                    dbg("process(%s): n: %x b: %d",opLu[ptr->op],ptr->nodeid,bytes);
-                    /* Process message */
-                    processOp(store,ptr->op,ptr->nodeid,ptr->data,ptr->size-hdrSize);
-                }
+            if (rport==NULL) {
+                uint64_t count;
+                /* Timeouts are recomputed below */
+                if (read(reactor.wake,&count,sizeof(count))<0) continue;
+            } else if (rport->sock>=0) {
+                struct epoll_event ev;
+
+                repl_receive(rport,buf,REPL_RX_SIZE);
+
+                /* One shot keeps each socket on one thread, in order */
+                ev.events=EPOLLIN|EPOLLONESHOT;
+                ev.data.ptr=rport;
+                epoll_ctl(reactor.epfd,EPOLL_CTL_MOD,rport->sock,&ev);
             }
+        }
 
-            /* Run State machine */
-            switch (net->state) {
-                case STATE_RUN:
-                    break;
-                case STATE_START_SYNC:
-                    dbg("Sync requested");
-                    eptr=store->list;
-                    index=0;
-                    net->state=STATE_SYNC;
-                    /* Fall through */
-                case STATE_SYNC:
-                    if (index<store->index) {
-                        dbg("Sync %d of %lu",index,store->index);
-                        repl_update(store,eptr++);
-                        index++;
-                    } else {
-                        net->state=STATE_RUN;
-                        delay=500;
-                    }
-                    break;
-                case STATE_START:
-                    if (mtime()>startTime) {
-                        net->state=STATE_RUN;
-                        delay=500;
-                        /* See if existing nodes have more data */
-                        if (net->maxCount>store->index) {
-                            dbg("Requesting update from id: %x count: %d\n",
-                                    net->maxNode,net->maxCount);
-                            send_msg(store,OP_SYNC,&net->maxNode,sizeof(net->maxNode));
-                        }
-                    }
-                default:
-                    break;
-            } /* End of switch */
+        /* Service the store timers, finding the next deadline */
+        tmOut=REPL_IDLE_US;
+        for (p=0;p<reactor.nports;p++) {
+            repl_port_t *rport=reactor.ports[p];
+            for (i=0;i<rport->nstores;i++) {
+                repl_info_t *net=rport->stores[i]->net;
+                long next=REPL_FLUSH_US;
 
-          } /* End of main loop */
+                /* A store busy on another thread is checked again soon */
+                if (pthread_mutex_trylock(&net->runLock)==0) {
+                    next=repl_tick(rport->stores[i]);
+                    pthread_mutex_unlock(&net->runLock);
+                }
+                if (next<tmOut) tmOut=next;
+            }
+        }
+        pthread_rwlock_unlock(&reactor.rwlock);
     }
 
     /* Free allocated buffers */
-    if (buf) free(buf);
-    dbg("Thread Closed");
+    free(buf);
     return NULL;
 }
 
+/** Wake the reactor threads to recompute their timeouts */
+static void repl_wake(void)
+{
+    uint64_t one=1;
+    if (write(reactor.wake,&one,sizeof(one))!=sizeof(one)) {
+        perror("reactor wake");
+    }
+}
+
+/** Start the reactor threads, reactor.lock must be held
+ * @return true if the reactor is running
+ */
+static bool repl_reactor_start(void)
+{
+    struct epoll_event ev;
+
+    if (reactor.running) return true;
+
+    reactor.epfd=epoll_create1(EPOLL_CLOEXEC);
+    reactor.wake=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if ((reactor.epfd<0)||(reactor.wake<0)) {
+        perror("reactor");
+        if (reactor.epfd>=0) close(reactor.epfd);
+        if (reactor.wake>=0) close(reactor.wake);
+        reactor.epfd=reactor.wake=-1;
+        return false;
+    }
+    ev.events=EPOLLIN;
+    ev.data.ptr=NULL;
+    epoll_ctl(reactor.epfd,EPOLL_CTL_ADD,reactor.wake,&ev);
+
+    reactor.running=true;
+    for (reactor.nthreads=0;reactor.nthreads<REPL_THREADS;reactor.nthreads++) {
+        if (pthread_create(&reactor.threads[reactor.nthreads],NULL,
+                    repl_reactor,NULL)) break;
+    }
+    if (reactor.nthreads==0) {
+        reactor.running=false;
+        close(reactor.epfd);
+        close(reactor.wake);
+        reactor.epfd=reactor.wake=-1;
+        return false;
+    }
+    return true;
+}
+
+/** Stop the reactor threads and free the ports, reactor.lock must be held */
+static void repl_reactor_stop(void)
+{
+    int i;
+
+    if (!reactor.running) return;
+
+    reactor.running=false;
+    repl_wake();
+    for (i=0;i<reactor.nthreads;i++) {
+        pthread_join(reactor.threads[i],NULL);
+    }
+    reactor.nthreads=0;
+    close(reactor.epfd);
+    close(reactor.wake);
+    reactor.epfd=reactor.wake=-1;
+
+    /* Ports are kept while running, a thread may hold a stale event */
+    for (i=0;i<reactor.nports;i++) {
+        free(reactor.ports[i]->stores);
+        free(reactor.ports[i]);
+    }
+    free(reactor.ports);
+    reactor.ports=NULL;
+    reactor.nports=0;
+}
+
+/**
+ * Find the open port or open the socket and add it to the reactor.
+ * A local port maps the shared memory ring and starts its receive thread.
+ * reactor.lock must be held.
+ * @param port Multicast port number
+ * @param local true for the shared memory ring of the port
+ * @return port entry or NULL on failure
+ */
+static repl_port_t *repl_port_get(uint16_t port,bool local)
+{
+    repl_port_t *rport=NULL;
+    struct epoll_event ev;
+    int i;
+
+    for (i=0;i<reactor.nports;i++) {
+        if ((reactor.ports[i]->port==port)&&(reactor.ports[i]->local==local)) {
+            rport=reactor.ports[i];
+            if ((rport->sock>=0)||(rport->ring)) return rport;
+            break;
+        }
+    }
+    if (rport==NULL) {
+        repl_port_t **ports;
+
+        rport=calloc(1,sizeof(*rport));
+        if (rport==NULL) return NULL;
+        rport->port=port;
+        rport->local=local;
+        rport->sock=-1;
+        rport->rxFree=-1;
+        rport->rxWindow=-1;
+        pthread_rwlock_wrlock(&reactor.rwlock);
+        ports=realloc(reactor.ports,(reactor.nports+1)*sizeof(*ports));
+        if (ports) {
+            reactor.ports=ports;
+            reactor.ports[reactor.nports++]=rport;
+        }
+        pthread_rwlock_unlock(&reactor.rwlock);
+        if (ports==NULL) {
+            free(rport);
+            return NULL;
+        }
+    }
+
+    if (local) {
+        rport->ring=shm_init(port);
+        if (rport->ring==NULL) return NULL;
+        shm_reader(rport->ring,&rport->reader);
+        rport->quit=false;
+        if (pthread_create(&rport->thread,NULL,repl_local,rport)) {
+            shm_close(rport->ring);
+            rport->ring=NULL;
+            return NULL;
+        }
+        return rport;
+    }
+
+    /* Initialize Multicast */
+    i=mcast_init(port);
+    if (i<=0) return NULL;
+    ev.events=EPOLLIN|EPOLLONESHOT;
+    ev.data.ptr=rport;
+    if (epoll_ctl(reactor.epfd,EPOLL_CTL_ADD,i,&ev)<0) {
+        perror("epoll_ctl");
+        close(i);
+        return NULL;
+    }
+    rport->sock=i;
+    return rport;
+}
+
+/** Generate a node id unique to each replicated store, reactor.lock must be
+ * held.
+ * @return New node id
+ */
+static id_t repl_node_id(void)
+{
+    struct timespec ts;
+    uint32_t x;
+
+    clock_gettime(CLOCK_REALTIME,&ts);
+    x=((uint32_t)getpid()<<16)^(uint32_t)ts.tv_nsec^(uint32_t)ts.tv_sec;
+    x^=(++reactor.seq)*0x9e3779b9;
+    /* Final mix so nearby inputs give unrelated ids */
+    x^=x>>16; x*=0x85ebca6b; x^=x>>13; x*=0xc2b2ae35; x^=x>>16;
+    return x;
+}
+
 /**
  * Processes one operation message.
  * @param store pointer to global data structure
@@ -265,17 +1115,44 @@ int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes)
 
     /* Ensure hash type match */
     switch (op) {
+        case OP_COPY:
+            /* A repair pull does not bring back a key deleted here, the
+             * OP_DROP this node sends removes it from the peer */
+            if ((bytes>0)&&(net->pulling)&&(!net->pullJoin)&&
+                    (node==net->pullNode)) {
+                bool skip=false;
+                keySize=store->key.sz(key);
+                value=key+keySize;
+                if (bytes>=(keySize+store->value.sz(value))) {
+                    pthread_mutex_lock(&store->lock);
+                    skip=repl_tombed(store,key);
+                    pthread_mutex_unlock(&store->lock);
+                }
+                if (skip) {
+                    bytes-=(keySize+store->value.sz(value));
+                    break;
+                }
+            }
+            /* Fall through */
         case OP_SET:
             if (bytes>0) {
                 _entry_t *eptr=NULL;
                 keySize=store->key.sz(key);
                 value=key+keySize;
-                if (bytes>=0) {
+                if (bytes>=(keySize+store->value.sz(value))) {
+                    /* Keys outside the received ranges are dropped */
+                    if (!repl_in_range(store,key,store->filter,store->nfilter)) {
+                        bytes-=(keySize+store->value.sz(value));
+                        break;
+                    }
                     pthread_mutex_lock(&store->lock);
-                    eptr=_hash_search(store,key,value);
+                    /* A partitioned store keeps only the keys it owns */
+                    if (repl_owned(store,key)) {
+                        eptr=_hash_search(store,key,value);
+                        if (eptr) dbgentry(eptr);
+                        else dbg("Insert Failure");
+                    }
                     pthread_mutex_unlock(&store->lock);
-                    if (eptr) dbgentry(eptr);
-                    else dbg("Insert Failure");
                     bytes-=(keySize+store->value.sz(value));
                 } else {
                     dbg("Value Size Error, OP_Set, bytes: %d, key: %d val: %lu",
@@ -290,6 +1167,10 @@ int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes)
                 keySize=store->key.sz(key);
                 if (bytes>=keySize) {
                     int index;
+                    if (!repl_in_range(store,key,store->filter,store->nfilter)) {
+                        bytes-=keySize;
+                        break;
+                    }
 #ifdef LIST_ENTRY_LOCK
                     /* Check if we have index. with the two locks, entry and
                      * list, we have more to do for cleanup to avoid holding
@@ -303,6 +1184,7 @@ int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes)
                     index=_find_index(store,key);
                     dbgindex(index);
                     if (index>=0) {
+                        repl_tomb(store,key);
                         _delete_entry(store,index);
                     }
                     pthread_mutex_unlock(&store->lock);
@@ -314,6 +1196,29 @@ int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes)
                 dbg("Key Missing, OP_Del, bytes: %d",bytes);
             }
             break;
+        case OP_DROP:
+            /* Only a pull from the sender removes, and only entries
+             * unchanged since its digests were compared */
+            if ((bytes<=0)||(bytes<store->key.sz(key))) {
+                dbg("Key Size Error, OP_Drop, bytes: %d",bytes);
+                break;
+            }
+            keySize=store->key.sz(key);
+            if ((net->pulling)&&(node==net->pullNode)&&
+                    (repl_in_range(store,key,store->filter,store->nfilter))) {
+                int index;
+                pthread_mutex_lock(&store->lock);
+                index=_find_index(store,key);
+                if ((index>=0)&&
+                        ((((_entry_t *)store->list)+index)->flags&ENTRY_STALE)) {
+                    dbgindex(index);
+                    repl_tomb(store,key);
+                    _delete_entry(store,index);
+                }
+                pthread_mutex_unlock(&store->lock);
+            }
+            bytes-=keySize;
+            break;
         case OP_STAT_REQ: {
             /* Request for list index size for a sync operation */
             if (store->index) {
@@ -331,175 +1236,2078 @@ int processOp(list_store_t *store,uint8_t op,id_t node,void* data,int bytes)
             }
             bytes-=sizeof(store->index);
             } break;
-        case OP_SYNC:
-            dbg("sync: %x ?= %d",*((id_t*) data),net->self);
-            if (*((id_t*) data)==net->self) {
-                net->state=STATE_START_SYNC;
-                dbg("State -> STATE_START_SYNC");
+        case OP_SYNC: {
+            sync_req_t *req=(sync_req_t *)data;
+            if (bytes>=sizeof(*req)) {
+                dbg("sync: %x ?= %d",req->node,net->self);
+                if (req->node==net->self) {
+                    bool merge=((net->state==STATE_SYNC)||
+                            (net->state==STATE_START_SYNC));
+                    int i;
+                    /* Restart, adding the buckets of any stream in progress */
+                    if (!merge) {
+                        memset(net->syncMask,0,sizeof(net->syncMask));
+                    }
+                    for (i=0;i<sizeof(net->syncMask);i++) {
+                        net->syncMask[i]|=req->mask[i];
+                    }
+                    repl_sync_ranges(store,(uint8_t *)(req+1),
+                            bytes-sizeof(*req),merge);
+                    net->state=STATE_START_SYNC;
+                    dbg("State -> STATE_START_SYNC");
+                }
             }
-            bytes-=sizeof(net->self);
-            break;
-        case OP_NOP:
-            dbg("nop: %d, %d",bytes,net->sock);
+            bytes-=sizeof(*req);
+            } break;
+        case OP_SYNC_DONE:
+            /* The stream of differing buckets is complete */
+            if ((net->pulling)&&(node==net->pullNode)) {
+                dbg("Sync done from: %x",node);
+                repl_pull_done(store);
+            }
+            bytes-=sizeof(uint64_t);
+            break;
+        case OP_DIGEST_REQ:
+            if ((bytes>=sizeof(id_t))&&(*((id_t*) data)==net->self)) {
+                void *range[REPL_FILTERS*2];
+                digest_msg_t msg;
+                int n;
+                /* The digests cover only the ranges the requester receives */
+                n=repl_filter_parse(store,(uint8_t *)data+sizeof(id_t),
+                        bytes-sizeof(id_t),range,NULL);
+                msg.node=node;
+                pthread_mutex_lock(&store->lock);
+                if (n) {
+                    uint64_t digest[REPL_BUCKETS];
+                    msg.count=repl_digest_range(store,digest,range,n);
+                    memcpy(msg.digest,digest,sizeof(msg.digest));
+                } else {
+                    msg.count=store->index;
+                    memcpy(msg.digest,net->digest,sizeof(msg.digest));
+                }
+                pthread_mutex_unlock(&store->lock);
+                send_msg(store,OP_DIGEST,&msg,sizeof(msg));
+            }
+            bytes-=sizeof(id_t);
+            break;
+        case OP_DIGEST:
+            if ((bytes>=sizeof(digest_msg_t))&&
+                    (((digest_msg_t *)data)->node==net->self)&&
+                    (net->pulling)&&(node==net->pullNode)) {
+                repl_pull_compare(store,data);
+            }
+            bytes-=sizeof(digest_msg_t);
+            break;
+        case OP_BATCH: {
+            /* Records are an op byte followed by the SET/DEL payload */
+            uint8_t *rec=data;
+            while (bytes>0) {
+                int left;
+                if ((rec[0]!=OP_SET)&&(rec[0]!=OP_DEL)&&(rec[0]!=OP_DROP)&&
+                        (rec[0]!=OP_COPY)) {
+                    dbg("Batch record error, op: %u",rec[0]);
+                    break;
+                }
+                left=processOp(store,rec[0],node,rec+1,bytes-1);
+                if ((left<0)||(left>=bytes-1)) break;
+                rec+=bytes-left;
+                bytes=left;
+            }
+            } break;
+        case OP_FRAG:
+            repl_reassemble(store,node,data,bytes);
+            bytes=0;
+            break;
+        case OP_NACK: {
+            nack_t *nack=(nack_t *)data;
+            if (bytes>=sizeof(*nack)) {
+                if (nack->node==net->self) {
+                    dbg("nack: %u count: %u",nack->first,nack->count);
+                    repl_retransmit(store,nack->first,nack->count);
+                }
+            }
+            bytes-=sizeof(*nack);
+            } break;
+        case OP_HELLO:
+            if (store->partition) repl_member_seen(store,node);
+            break;
+        case OP_BYE:
+            if (store->partition) repl_member_drop(store,node);
+            break;
+        case OP_REPAIR:
+            if (store->partition) repl_repair(store,node);
+            break;
+        case OP_GET:
+            if ((bytes>sizeof(get_req_t))&&
+                    (((get_req_t *)data)->owner==net->self)) {
+                repl_get_reply(store,node,data,bytes);
+            }
+            bytes=0;
+            break;
+        case OP_GET_REP: {
+            get_rep_t *rep=(get_rep_t *)data;
+            if ((bytes>=sizeof(*rep))&&(rep->node==net->self)) {
+                void *val=rep+1;
+                pthread_mutex_lock(&net->netLock);
+                if ((net->fetchDst)&&(!net->fetchDone)&&
+                        (rep->req==net->fetchReq)) {
+                    net->fetchFound=(rep->found)&&(bytes>sizeof(*rep))&&
+                        (bytes-sizeof(*rep)>=store->value.sz(val));
+                    if (net->fetchFound) store->value.cp(net->fetchDst,val);
+                    net->fetchDone=true;
+                    pthread_cond_broadcast(&net->fetchCond);
+                }
+                pthread_mutex_unlock(&net->netLock);
+            }
+            bytes=0;
+            } break;
+        case OP_WINDOW:
+            if (bytes>=sizeof(uint32_t)) {
+                uint32_t window;
+                int i;
+                memcpy(&window,data,sizeof(window));
+                for (i=0;i<net->npeers;i++) {
+                    if (net->peers[i].node==node) {
+                        net->peers[i].window=window;
+                        net->peers[i].windowTime=utime();
+                        break;
+                    }
+                }
+            }
+            bytes-=sizeof(uint32_t);
+            break;
+        case OP_NOP:
+            dbg("nop: %d, %d",bytes,net->sock);
             break;
         default:
             dbg("unknown: %u",op);
             break;
     }
-    return bytes;
+    return bytes;
+}
+
+/**
+ * Find the receive state for a node, adding it on first contact.  A new peer
+ * starts at the sequence of its first packet, nothing older is requested.
+ * @param store List master structure
+ * @param node Node id of the sender
+ * @param seq Sequence number from the packet
+ * @param data true if seq numbers this packet, false if it is the last sent
+ * @return Peer or NULL on allocation failure
+ */
+static repl_peer_t *repl_peer(list_store_t *store,id_t node,uint32_t seq,bool data)
+{
+    repl_info_t *net=store->net;
+    repl_peer_t *peer;
+    int i;
+
+    for (i=0;i<net->npeers;i++) {
+        if (net->peers[i].node==node) {
+            net->peers[i].seen=utime();
+            return &net->peers[i];
+        }
+    }
+    if (net->npeers==net->maxpeers) {
+        int max=(net->maxpeers) ? net->maxpeers*2 : 4;
+        peer=realloc(net->peers,max*sizeof(*peer));
+        if (peer==NULL) return NULL;
+        net->peers=peer;
+        net->maxpeers=max;
+    }
+    peer=&net->peers[net->npeers++];
+    memset(peer,0,sizeof(*peer));
+    peer->node=node;
+    peer->seen=utime();
+    peer->next=(data) ? seq : seq+1;
+    peer->want=peer->next;
+    return peer;
+}
+
+/** Free the held packets and receive state of all peers */
+static void repl_peers_free(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    int i;
+
+    for (i=0;i<net->npeers;i++) {
+        if (net->peers[i].held) free(net->peers[i].held);
+        if (net->peers[i].frag) free(net->peers[i].frag);
+    }
+    if (net->peers) free(net->peers);
+    net->peers=NULL;
+    net->npeers=0;
+    net->maxpeers=0;
+}
+
+/**
+ * Drop the receive state of peers silent for REPL_PEER_US with nothing
+ * outstanding, so restarted nodes do not leave their old ids behind.  A
+ * dropped peer that sends again starts over at its next packet.
+ * @param store List master structure
+ * @param now Current time in usec
+ */
+static void repl_peers_expire(list_store_t *store,long now)
+{
+    repl_info_t *net=store->net;
+    int i;
+
+    for (i=0;i<net->npeers;i++) {
+        repl_peer_t *peer=&net->peers[i];
+
+        if ((now-peer->seen<REPL_PEER_US)||(peer->gapTime)||
+                (peer->fragTotal)) continue;
+        dbg("Peer expired: %x",peer->node);
+        if (peer->held) free(peer->held);
+        if (peer->frag) free(peer->frag);
+        *peer=net->peers[--net->npeers];
+        i--;
+    }
+}
+
+/** Deliver the held packets that are next in sequence */
+static void repl_deliver(list_store_t *store,repl_peer_t *peer)
+{
+    int hdrSize=offsetof(packet_t,data);
+    int slot;
+
+    while (peer->heldLen[(slot=peer->next%REPL_REORDER)]) {
+        packet_t *pkt=(packet_t *)(peer->held+(size_t)slot*store->net->txMax);
+        processOp(store,pkt->op,pkt->nodeid,pkt->data,peer->heldLen[slot]-hdrSize);
+        peer->heldLen[slot]=0;
+        peer->next++;
+    }
+    if ((int32_t)(peer->want-peer->next)<=0) {
+        peer->want=peer->next;
+        peer->gapTime=0;
+        /* The stream the sync was done with has all arrived */
+        if ((store->net->pullEnd)&&(peer->node==store->net->pullNode)) {
+            store->net->pullEnd=false;
+            if (store->net->pulling) repl_pull_done(store);
+        }
+    }
+}
+
+/** Ask the sender for the packets missing before the first held or up to
+ * want.  NACKs for one gap are sent at most every REPL_NACK_US.
+ */
+static void repl_nack(list_store_t *store,repl_peer_t *peer,long now)
+{
+    nack_t nack;
+
+    if ((peer->nackTime)&&(now-peer->nackTime<REPL_NACK_US)) return;
+
+    nack.node=peer->node;
+    nack.first=peer->next;
+    for (nack.count=1;nack.first+nack.count!=peer->want;nack.count++) {
+        if (peer->heldLen[(nack.first+nack.count)%REPL_REORDER]) break;
+    }
+    dbg("Gap from: %x seq: %u count: %u",peer->node,nack.first,nack.count);
+    send_msg(store,OP_NACK,&nack,sizeof(nack));
+    peer->nackTime=now;
+}
+
+/**
+ * Give up on a gap.  Held packets are delivered in order, and the buckets
+ * that differ from the sender are pulled to replace what was lost.  A pull
+ * already streaming from the sender is left to finish and then repeated,
+ * restarting its stream would lose to the same load again.
+ */
+static void repl_skip(list_store_t *store,repl_peer_t *peer)
+{
+    repl_info_t *net=store->net;
+
+    dbg("Gap timeout from: %x seq: %u",peer->node,peer->next);
+    while ((int32_t)(peer->want-peer->next)>0) {
+        if (peer->heldLen[peer->next%REPL_REORDER]) repl_deliver(store,peer);
+        else peer->next++;
+    }
+    peer->gapTime=0;
+    peer->nackTime=0;
+    /* Digests of a partition differ by owner, the owners resend instead */
+    if (store->partition) send_msg(store,OP_REPAIR,NULL,0);
+    else if ((net->pulling)&&(peer->node==net->pullNode)) net->pullAgain=true;
+    else repl_pull_start(store,peer->node,false);
+    /* A done that waited on the gap ends the pull */
+    if ((net->pullEnd)&&(peer->node==net->pullNode)) {
+        net->pullEnd=false;
+        if (net->pulling) repl_pull_done(store);
+    }
+}
+
+/** Note that packets up to want have been sent by a peer and request any
+ * that are missing */
+static void repl_gap(list_store_t *store,repl_peer_t *peer,uint32_t want)
+{
+    long now=utime();
+
+    if ((int32_t)(want-peer->want)>0) peer->want=want;
+    if ((int32_t)(peer->want-peer->next)<=0) return;
+    if (peer->gapTime==0) {
+        peer->gapTime=now;
+        peer->nackTime=0;
+    }
+    repl_nack(store,peer,now);
+}
+
+/**
+ * Check every peer for a gap to NACK again or give up on, dropping the
+ * peers that have gone silent.
+ * @param store List master structure
+ * @return Time in usec until a peer next needs service
+ */
+static long repl_gap_check(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    long now=utime();
+    long next=REPL_IDLE_US;
+    int i;
+
+    repl_peers_expire(store,now);
+    for (i=0;i<net->npeers;i++) {
+        repl_peer_t *peer=&net->peers[i];
+        long wait;
+
+        if (peer->gapTime==0) continue;
+        if (now-peer->gapTime>=REPL_GAP_US) {
+            repl_skip(store,peer);
+            continue;
+        }
+        repl_nack(store,peer,now);
+        wait=peer->nackTime+REPL_NACK_US-now;
+        if (wait<next) next=wait;
+    }
+    return next;
+}
+
+/**
+ * Deliver a received packet in sequence order.  Packets ahead of a gap are
+ * held while the missing ones are requested, duplicates are dropped.
+ * Control packets carry the last sequence sent, so a lost batch is noticed
+ * at the next control packet as well as at the next batch.  An OP_SYNC_DONE
+ * behind a gap ends the pull only once the gap is delivered.  runLock must
+ * be held.
+ * @param store List master structure
+ * @param vpkt Received packet
+ * @param bytes Size of the packet
+ */
+static void repl_accept(list_store_t *store,void *vpkt,int bytes)
+{
+    packet_t *pkt=(packet_t *)vpkt;
+    int hdrSize=offsetof(packet_t,data);
+    bool data=((pkt->op==OP_BATCH)||(pkt->op==OP_FRAG));
+    repl_peer_t *peer=repl_peer(store,pkt->nodeid,pkt->seq,data);
+    int32_t ahead;
+
+    /* A pull is idle only when nothing arrives from its node */
+    if ((store->net->pulling)&&(pkt->nodeid==store->net->pullNode)) {
+        store->net->pullTime=utime();
+    }
+
+    if (!data) {
+        if (peer) repl_gap(store,peer,pkt->seq+1);
+        /* The end of a pull waits for the records sent before it */
+        if ((pkt->op==OP_SYNC_DONE)&&(peer)&&(store->net->pulling)&&
+                (pkt->nodeid==store->net->pullNode)&&
+                ((int32_t)(peer->want-peer->next)>0)) {
+            store->net->pullEnd=true;
+            return;
+        }
+        processOp(store,pkt->op,pkt->nodeid,pkt->data,bytes-hdrSize);
+        return;
+    }
+#ifdef UNIT_TEST
+    if ((repl_test_drop)&&((++dropCount%repl_test_drop)==0)) return;
+#endif
+    store->net->rxActive=true;
+    if (peer) peer->rxTime=utime();
+    if (peer==NULL) {
+        /* No memory to track order, apply as received */
+        processOp(store,pkt->op,pkt->nodeid,pkt->data,bytes-hdrSize);
+        return;
+    }
+
+    ahead=(int32_t)(pkt->seq-peer->next);
+    if (ahead<0) return;   /* Already delivered */
+    if (ahead>=REPL_REORDER) {
+        /* Too far ahead to hold, give up on the gap */
+        repl_gap(store,peer,pkt->seq);
+        repl_skip(store,peer);
+        ahead=0;
+    }
+    if (ahead==0) {
+        processOp(store,pkt->op,pkt->nodeid,pkt->data,bytes-hdrSize);
+        peer->next++;
+        repl_deliver(store,peer);
+        return;
+    }
+
+    /* Hold until the gap is filled, slots are allocated on the first gap */
+    if (peer->held==NULL) {
+        peer->held=malloc((size_t)REPL_REORDER*store->net->txMax);
+    }
+    if ((peer->held)&&(bytes<=store->net->txMax)) {
+        int slot=pkt->seq%REPL_REORDER;
+        if (peer->heldLen[slot]==0) {
+            memcpy(peer->held+(size_t)slot*store->net->txMax,pkt,bytes);
+            peer->heldLen[slot]=bytes;
+        }
+    }
+    repl_gap(store,peer,pkt->seq+1);
+}
+
+/**
+ * Resend packets from the history in answer to a NACK.  Packets no longer
+ * held are skipped, the receiver falls back to a sync for those.
+ * @param store List master structure
+ * @param first First sequence number
+ * @param count Number of packets
+ */
+static void repl_retransmit(list_store_t *store,uint32_t first,uint32_t count)
+{
+    repl_info_t *net=store->net;
+    uint32_t seq;
+    int start=-1;
+    int n=0;
+
+    if (count>REPL_HISTORY) count=REPL_HISTORY;
+
+    pthread_mutex_lock(&net->txLock);
+    for (seq=first;seq!=first+count;seq++) {
+        int slot=seq%REPL_HISTORY;
+        bool ok=((net->histSeq[slot]==seq)&&((int32_t)(net->txSeqSent-seq)>=0));
+
+        /* Send each run of contiguous slots with one call */
+        if ((n)&&((!ok)||(slot!=start+n))) {
+            repl_send(store,net->hist+(size_t)start*net->txMax,
+                    net->txMax,&net->histLen[start],n);
+            repl_pace_use(net,&net->histLen[start],n);
+            n=0;
+        }
+        if (ok) {
+            if (n==0) start=slot;
+            n++;
+        }
+    }
+    if (n) {
+        repl_send(store,net->hist+(size_t)start*net->txMax,
+                net->txMax,&net->histLen[start],n);
+        repl_pace_use(net,&net->histLen[start],n);
+    }
+    pthread_mutex_unlock(&net->txLock);
+}
+
+/** FNV-1a hash of a byte range, seeded to chain fields */
+static inline uint64_t repl_hash(const void *data,size_t size,uint64_t h)
+{
+    const uint8_t *p=data;
+    while (size--) {
+        h^=*p++;
+        h*=0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * Digest bucket of a key.  Buckets depend only on the key bytes, so every
+ * node places a key in the same bucket.
+ * @param store List master structure
+ * @param key Key data
+ * @param hash Set to the key hash if not NULL
+ * @return Bucket number
+ */
+static inline int repl_bucket(list_store_t *store,void *key,uint64_t *hash)
+{
+    uint64_t h=repl_hash(key,store->key.sz(key),0xcbf29ce484222325ULL);
+    h^=h>>29;
+    if (hash) *hash=h;
+    return (int)(h&(REPL_BUCKETS-1));
+}
+
+/**
+ * Check a key against key ranges.
+ * @param store List master structure
+ * @param key Key to check
+ * @param range lo/hi key pairs, inclusive
+ * @param n Number of ranges, 0 for all keys
+ * @return true if the key is in a range
+ */
+static bool repl_in_range(list_store_t *store,void *key,void **range,int n)
+{
+    int i;
+
+    if (n<=0) return true;
+    for (i=0;i<n*2;i+=2) {
+        if ((store->key.cmp(&key,&range[i])>=0)&&
+                (store->key.cmp(&key,&range[i+1])<=0)) return true;
+    }
+    return false;
+}
+
+/**
+ * Pack the received key ranges of a store as a count byte followed by the
+ * lo/hi keys.
+ * @param store List master structure
+ * @param buf Output of REPL_FILTER_MAX bytes
+ * @return Bytes used, a count of 0 asks for all keys if the ranges don't fit
+ */
+static int repl_filter_pack(list_store_t *store,uint8_t *buf)
+{
+    int len=1;
+    int i;
+
+    buf[0]=0;
+    if (store->nfilter>REPL_FILTERS) return 1;
+    for (i=0;i<store->nfilter*2;i++) {
+        size_t sz=store->key.sz(store->filter[i]);
+        if (len+sz>REPL_FILTER_MAX) return 1;
+        memcpy(buf+len,store->filter[i],sz);
+        len+=sz;
+    }
+    buf[0]=store->nfilter;
+    return len;
+}
+
+/**
+ * Find the keys of packed key ranges.
+ * @param store List master structure
+ * @param buf Packed ranges
+ * @param bytes Size of buf
+ * @param range Output of REPL_FILTERS lo/hi key pairs
+ * @param used Output of the bytes used, may be NULL
+ * @return Number of ranges, 0 for all keys or if malformed
+ */
+static int repl_filter_parse(list_store_t *store,uint8_t *buf,int bytes,
+        void **range,int *used)
+{
+    int len=1;
+    int i;
+
+    if ((bytes<1)||(buf[0]>REPL_FILTERS)) return 0;
+    for (i=0;i<buf[0]*2;i++) {
+        size_t sz;
+        if (len>=bytes) return 0;
+        sz=store->key.sz(buf+len);
+        if (len+sz>bytes) return 0;
+        range[i]=buf+len;
+        len+=sz;
+    }
+    if (used) *used=len;
+    return buf[0];
+}
+
+/**
+ * Set the key ranges of a sync response from an OP_SYNC request.  Ranges of
+ * a request made during a response are added to it.
+ * @param store List master structure
+ * @param buf Packed ranges
+ * @param bytes Size of buf
+ * @param merge true to add to the response in progress
+ */
+static void repl_sync_ranges(list_store_t *store,uint8_t *buf,int bytes,
+        bool merge)
+{
+    repl_info_t *net=store->net;
+    void *range[REPL_FILTERS*2];
+    int used=0;
+    int n;
+    int i;
+
+    if (!merge) {
+        net->nSyncRange=0;
+        net->syncFilterLen=0;
+    } else if (net->nSyncRange==0) {
+        /* Already sending all keys */
+        return;
+    }
+    n=repl_filter_parse(store,buf,bytes,range,&used);
+    if ((n==0)||(net->nSyncRange+n>REPL_FILTERS)||
+            (net->syncFilterLen+used-1>REPL_FILTER_MAX)) {
+        net->nSyncRange=0;
+        return;
+    }
+    memcpy(net->syncFilter+net->syncFilterLen,buf+1,used-1);
+    net->syncFilterLen+=used-1;
+    net->nSyncRange+=n;
+    for (i=0,used=0;i<net->nSyncRange*2;i++) {
+        net->syncRange[i]=net->syncFilter+used;
+        used+=store->key.sz(net->syncRange[i]);
+    }
+}
+
+/**
+ * Hash a whole entry.
+ * @param store List master structure
+ * @param eptr Entry to hash
+ * @param hash Output of the entry hash
+ * @return Bucket of the entry
+ */
+static int repl_entry_hash(list_store_t *store,_entry_t *eptr,uint64_t *hash)
+{
+    uint64_t h;
+    int b;
+
+    b=repl_bucket(store,eptr->key,&h);
+    h=repl_hash(eptr->val,store->value.sz(eptr->val),h);
+    /* Final mix so similar entries differ in every bit */
+    h^=h>>33; h*=0xff51afd7ed558ccdULL; h^=h>>33;
+    *hash=h;
+    return b;
+}
+
+/**
+ * Add or remove an entry in its bucket digest, store->lock must be held.
+ * The digest is an XOR, so the entry is removed by calling this before a
+ * change and added back by calling it after.
+ * @param store List master structure
+ * @param eptr Entry to toggle
+ */
+void repl_digest(list_store_t *store,_entry_t *eptr)
+{
+    repl_info_t *net=store->net;
+    uint64_t h;
+    int b;
+
+    if (!net) return;
+    b=repl_entry_hash(store,eptr,&h);
+    net->digest[b]^=h;
+}
+
+/**
+ * Compute the bucket digests of the entries in key ranges, store->lock must
+ * be held.
+ * @param store List master structure
+ * @param digest Output of REPL_BUCKETS digests
+ * @param range lo/hi key pairs
+ * @param n Number of ranges
+ * @return Number of entries in the ranges
+ */
+static uint64_t repl_digest_range(list_store_t *store,uint64_t *digest,
+        void **range,int n)
+{
+    uint64_t count=0;
+    size_t i;
+
+    memset(digest,0,REPL_BUCKETS*sizeof(*digest));
+    for (i=0;i<store->index;i++) {
+        _entry_t *eptr=((_entry_t *)store->list)+i;
+        uint64_t h;
+        int b;
+
+        if (!repl_in_range(store,eptr->key,range,n)) continue;
+        b=repl_entry_hash(store,eptr,&h);
+        digest[b]^=h;
+        count++;
+    }
+    return count;
+}
+
+/** Compute the bucket digests of the whole table */
+static void repl_digest_all(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    size_t i;
+
+    pthread_mutex_lock(&store->lock);
+    memset(net->digest,0,sizeof(net->digest));
+    for (i=0;i<store->index;i++) {
+        repl_digest(store,((_entry_t *)store->list)+i);
+    }
+    pthread_mutex_unlock(&store->lock);
+}
+
+/**
+ * Ask a node for its bucket digests to reconcile against it.
+ * @param store List master structure
+ * @param node Node to pull from
+ * @param join true when joining, entries node does not send are removed.
+ * Otherwise only the recent deletes node sends remove entries.
+ */
+static void repl_pull_start(list_store_t *store,id_t node,bool join)
+{
+    repl_info_t *net=store->net;
+    uint8_t buf[sizeof(node)+REPL_FILTER_MAX];
+    int len;
+
+    net->pulling=true;
+    net->pullJoin=join;
+    net->pullEnd=false;
+    net->pullAgain=false;
+    net->pullNode=node;
+    net->pullTime=utime();
+    memcpy(buf,&node,sizeof(node));
+    len=repl_filter_pack(store,buf+sizeof(node));
+    net->pullRanged=(buf[sizeof(node)]!=0);
+    send_msg(store,OP_DIGEST_REQ,buf,sizeof(node)+len);
+}
+
+/**
+ * Compare the digests of pullNode with the local ones and request only the
+ * buckets that differ.  Local entries in those buckets and in the received
+ * key ranges are marked stale, any change to an entry clears the mark.  A
+ * stale entry is removed by an OP_DROP from pullNode, or at the end of a
+ * join pull if pullNode did not send it.
+ * @param store List master structure
+ * @param vmsg OP_DIGEST payload
+ */
+static void repl_pull_compare(list_store_t *store,void *vmsg)
+{
+    repl_info_t *net=store->net;
+    digest_msg_t *msg=(digest_msg_t *)vmsg;
+    uint8_t buf[sizeof(sync_req_t)+REPL_FILTER_MAX];
+    sync_req_t *req=(sync_req_t *)buf;
+    uint64_t ranged[REPL_BUCKETS];
+    uint64_t *local=net->digest;
+    int diff=0;
+    int len;
+    size_t i;
+
+    memset(req,0,sizeof(*req));
+    req->node=net->pullNode;
+
+    pthread_mutex_lock(&store->lock);
+    if (net->pullRanged) {
+        repl_digest_range(store,ranged,store->filter,store->nfilter);
+        local=ranged;
+    }
+    for (i=0;i<REPL_BUCKETS;i++) {
+        if (msg->digest[i]!=local[i]) {
+            req->mask[i/8]|=1<<(i%8);
+            diff++;
+        }
+    }
+    for (i=0;(diff)&&(i<store->index);i++) {
+        _entry_t *eptr=((_entry_t *)store->list)+i;
+        int b=repl_bucket(store,eptr->key,NULL);
+        if ((req->mask[b/8]&(1<<(b%8)))&&
+                (repl_in_range(store,eptr->key,store->filter,store->nfilter))) {
+            eptr->flags|=ENTRY_STALE;
+        } else {
+            eptr->flags&=~ENTRY_STALE;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    dbg("Digest from: %x differs in %d buckets",net->pullNode,diff);
+    if (diff) {
+        net->pullTime=utime();
+        len=repl_filter_pack(store,buf+sizeof(*req));
+        send_msg(store,OP_SYNC,buf,sizeof(*req)+len);
+    } else {
+        net->pulling=false;
+        pthread_mutex_lock(&net->netLock);
+        net->synced=true;
+        pthread_cond_broadcast(&net->startCond);
+        pthread_mutex_unlock(&net->netLock);
+    }
+}
+
+/** The pull is complete.  A joining node removes the entries pullNode did
+ * not send, they were deleted or never replicated while it was away.  A
+ * repair keeps them, pullNode may not have received them yet.  A stream
+ * that lost records is followed by a repair of the buckets still differing. */
+static void repl_pull_done(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    size_t i;
+
+    pthread_mutex_lock(&store->lock);
+    for (i=store->index;i>0;i--) {
+        _entry_t *eptr=((_entry_t *)store->list)+i-1;
+        if (!(eptr->flags&ENTRY_STALE)) continue;
+        if (net->pullJoin) _delete_entry(store,i-1);
+        else eptr->flags&=~ENTRY_STALE;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    net->pulling=false;
+    pthread_mutex_lock(&net->netLock);
+    net->synced=true;
+    pthread_cond_broadcast(&net->startCond);
+    pthread_mutex_unlock(&net->netLock);
+    if (net->pullAgain) repl_pull_start(store,net->pullNode,false);
+}
+
+/**
+ * Record a deleted key for repair pulls, store->lock must be held.  Only the
+ * last REPL_TOMBS deletes are kept.
+ * @param store List master structure
+ * @param key Deleted key
+ */
+static void repl_tomb(list_store_t *store,void *key)
+{
+    repl_info_t *net=store->net;
+    size_t ksize=store->key.sz(NULL);
+
+    if ((net->tombs==NULL)&&((net->tombs=malloc(REPL_TOMBS*ksize))==NULL)) {
+        return;
+    }
+    memcpy(net->tombs+(size_t)(net->ntombs++%REPL_TOMBS)*ksize,key,
+            store->key.sz(key));
+}
+
+/**
+ * Check for a recent delete of a key no longer in the table, store->lock
+ * must be held.
+ * @param store List master structure
+ * @param key Key to look for
+ * @return true if the key was deleted and not set again
+ */
+static bool repl_tombed(list_store_t *store,void *key)
+{
+    repl_info_t *net=store->net;
+    size_t ksize=store->key.sz(NULL);
+    uint32_t n=(net->ntombs<REPL_TOMBS) ? net->ntombs : REPL_TOMBS;
+    uint32_t i;
+
+    for (i=0;i<n;i++) {
+        void *tomb=net->tombs+(size_t)i*ksize;
+        if (store->key.cmp(&tomb,&key)==0) return _find_index(store,key)<0;
+    }
+    return false;
+}
+
+/**
+ * Queue an OP_DROP for each recent delete in the requested buckets and
+ * ranges that has not been set again, store->lock and txLock must be held.
+ * @param store List master structure
+ */
+static void repl_sync_drops(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    size_t ksize=store->key.sz(NULL);
+    uint32_t n=(net->ntombs<REPL_TOMBS) ? net->ntombs : REPL_TOMBS;
+    uint32_t i;
+
+    for (i=0;i<n;i++) {
+        void *key=net->tombs+(size_t)i*ksize;
+        int b=repl_bucket(store,key,NULL);
+
+        if ((net->syncMask[b/8]&(1<<(b%8)))&&
+                (repl_in_range(store,key,net->syncRange,net->nSyncRange))&&
+                (_find_index(store,key)<0)) {
+            repl_batch_add(store,OP_DROP,key,store->key.sz(key),NULL,0);
+        }
+    }
+}
+
+/**
+ * Send the next burst of a sync response.
+ * Entries of the requested buckets are queued under the list lock until
+ * REPL_SYNC_BURST batch packets have been sent or REPL_SYNC_SCAN entries
+ * checked.  The walk resumes after the last key sent, so entries that
+ * move while the lock is released are neither skipped nor repeated.
+ * @param store List master structure
+ * @return true when every entry has been sent
+ */
+static bool repl_sync_burst(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    unsigned long start;
+    int scan=0;
+    bool done=false;
+
+    pthread_mutex_lock(&store->lock);
+    pthread_mutex_lock(&net->txLock);
+    /* Queued updates are older than the table, send them first */
+    repl_drain(store,true);
+    start=net->txCount;
+    /* Send the burst with one call */
+    net->txHold=true;
+
+    if (net->syncHasKey) {
+        net->syncIndex=_next_index(store,net->syncKey,net->syncIndex);
+    }
+    while (net->syncIndex<store->index) {
+        _entry_t *eptr=((_entry_t *)store->list)+net->syncIndex++;
+        int b=repl_bucket(store,eptr->key,NULL);
+
+        /* Only the requested buckets and ranges are sent */
+        if ((net->syncMask[b/8]&(1<<(b%8)))&&
+                (repl_in_range(store,eptr->key,net->syncRange,net->nSyncRange))) {
+            repl_batch_add(store,OP_COPY,eptr->key,store->key.sz(eptr->key),
+                    eptr->val,store->value.sz(eptr->val));
+            net->syncSent++;
+        }
+        if ((net->txCount-start>=REPL_SYNC_BURST)||
+                (net->txHeld>=REPL_TX_BATCH-1)||(++scan>=REPL_SYNC_SCAN)) break;
+    }
+    if (net->syncIndex>=store->index) {
+        done=true;
+        repl_sync_drops(store);
+    } else {
+        /* Remember where to resume */
+        _entry_t *eptr=((_entry_t *)store->list)+net->syncIndex-1;
+        store->key.cp(net->syncKey,eptr->key);
+        net->syncHasKey=true;
+    }
+    /* Writers may continue while the burst is sent */
+    pthread_mutex_unlock(&store->lock);
+
+    net->txHold=false;
+    /* Don't hold the tail of the table for the flush timer */
+    if (done) repl_flush(store);
+    else repl_send_held(store);
+    pthread_mutex_unlock(&net->txLock);
+    return done;
+}
+
+/** Order member ids */
+static int repl_id_cmp(const void *a,const void *b)
+{
+    id_t x=*(const id_t *)a;
+    id_t y=*(const id_t *)b;
+    return (x>y)-(x<y);
+}
+
+/** Order ring points by position, then member */
+static int repl_point_cmp(const void *a,const void *b)
+{
+    const repl_point_t *x=a;
+    const repl_point_t *y=b;
+
+    if (x->hash!=y->hash) return (x->hash>y->hash) ? 1 : -1;
+    return repl_id_cmp(&x->node,&y->node);
+}
+
+/** Ring position of a hash, mixed so nearby hashes spread over the ring */
+static inline uint32_t repl_ring_pos(uint64_t h)
+{
+    h^=h>>33;
+    h*=0xff51afd7ed558ccdULL;
+    h^=h>>33;
+    return (uint32_t)(h>>32);
+}
+
+/**
+ * Build a consistent hash ring.  Each member has REPL_VNODES points, so the
+ * keys of a member that leaves spread over all the others.
+ * @param ring Output ring
+ * @param nodes Member ids
+ * @param n Number of members
+ * @return false on allocation failure
+ */
+static bool repl_ring_build(repl_ring_t *ring,id_t *nodes,int n)
+{
+    repl_ring_t r;
+    int i,v;
+
+    r.nodes=malloc((n+1)*sizeof(*r.nodes));
+    r.points=malloc((size_t)(n+1)*REPL_VNODES*sizeof(*r.points));
+    if ((r.nodes==NULL)||(r.points==NULL)) {
+        if (r.nodes) free(r.nodes);
+        if (r.points) free(r.points);
+        return false;
+    }
+    memcpy(r.nodes,nodes,n*sizeof(*nodes));
+    qsort(r.nodes,n,sizeof(*r.nodes),repl_id_cmp);
+    r.nnodes=n;
+    r.npoints=0;
+    for (i=0;i<n;i++) {
+        for (v=0;v<REPL_VNODES;v++) {
+            uint64_t h=repl_hash(&r.nodes[i],sizeof(id_t),0xcbf29ce484222325ULL);
+            h=repl_hash(&v,sizeof(v),h);
+            r.points[r.npoints].hash=repl_ring_pos(h);
+            r.points[r.npoints++].node=r.nodes[i];
+        }
+    }
+    qsort(r.points,r.npoints,sizeof(*r.points),repl_point_cmp);
+    *ring=r;
+    return true;
+}
+
+/** Release the arrays of a ring */
+static void repl_ring_free(repl_ring_t *ring)
+{
+    if (ring->nodes) free(ring->nodes);
+    if (ring->points) free(ring->points);
+    memset(ring,0,sizeof(*ring));
+}
+
+/** Check if a node is a member of a ring */
+static inline bool repl_ring_has(repl_ring_t *ring,id_t node)
+{
+    return (ring->nnodes)&&
+        (bsearch(&node,ring->nodes,ring->nnodes,sizeof(node),repl_id_cmp));
+}
+
+/** Check if a node is in a list of owners */
+static inline bool repl_is_owner(id_t *owners,int n,id_t node)
+{
+    int i;
+
+    for (i=0;i<n;i++) if (owners[i]==node) return true;
+    return false;
+}
+
+/**
+ * Owners of a key, the first store->partition distinct members found
+ * clockwise from the key's position on the ring.
+ * @param store List master structure
+ * @param ring Ring to search
+ * @param key Key data
+ * @param owners Output of up to REPL_REPLICAS_MAX ids, preferred first
+ * @return Number of owners
+ */
+static int repl_owners(list_store_t *store,repl_ring_t *ring,void *key,
+        id_t *owners)
+{
+    int max=(store->partition<ring->nnodes) ? store->partition : ring->nnodes;
+    int lo=0,hi=ring->npoints;
+    uint32_t pos;
+    uint64_t h;
+    int n=0;
+    int i;
+
+    if (ring->npoints==0) return 0;
+    repl_bucket(store,key,&h);
+    pos=repl_ring_pos(h);
+    while (lo<hi) {
+        int mid=(lo+hi)/2;
+        if (ring->points[mid].hash<pos) lo=mid+1;
+        else hi=mid;
+    }
+    for (i=0;(n<max)&&(i<ring->npoints);i++) {
+        id_t node=ring->points[(lo+i)%ring->npoints].node;
+        if (!repl_is_owner(owners,n,node)) owners[n++]=node;
+    }
+    return n;
+}
+
+/**
+ * Check if this node keeps a key, store->lock must be held.
+ * @param store List master structure
+ * @param key Key data
+ * @return true if the key is owned here or the store is not partitioned
+ */
+bool repl_owned(list_store_t *store,void *key)
+{
+    repl_info_t *net=store->net;
+    id_t owners[REPL_REPLICAS_MAX];
+    int n;
+
+    if ((net==NULL)||(store->partition==0)) return true;
+    n=repl_owners(store,&net->ring,key,owners);
+    return repl_is_owner(owners,n,net->self);
+}
+
+/**
+ * Rebuild the ring from the members, runLock must be held.  The ring the
+ * table matches stays in viewOld until a rebalance walk completes.
+ * @param store List master structure
+ */
+static void repl_view_change(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    id_t *nodes=malloc((net->nmembers+1)*sizeof(*nodes));
+    repl_ring_t ring;
+    int i;
+
+    if (nodes==NULL) return;
+    nodes[0]=net->self;
+    for (i=0;i<net->nmembers;i++) nodes[i+1]=net->members[i].node;
+    if (repl_ring_build(&ring,nodes,net->nmembers+1)) {
+        pthread_mutex_lock(&store->lock);
+        if ((net->viewChanged)||(net->rebalancing)) repl_ring_free(&net->ring);
+        else net->viewOld=net->ring;
+        net->ring=ring;
+        pthread_mutex_unlock(&store->lock);
+        /* A walk in progress starts over against the new ring */
+        net->rebalancing=false;
+        net->viewChanged=true;
+        net->viewTime=utime();
+        dbg("View change: %d members",ring.nnodes);
+    }
+    free(nodes);
+}
+
+/** Note an OP_HELLO from a partition member, runLock must be held */
+static void repl_member_seen(list_store_t *store,id_t node)
+{
+    repl_info_t *net=store->net;
+    repl_member_t *members;
+    int i;
+
+    for (i=0;i<net->nmembers;i++) {
+        if (net->members[i].node==node) {
+            net->members[i].seen=utime();
+            return;
+        }
+    }
+    members=realloc(net->members,(net->nmembers+1)*sizeof(*members));
+    if (members==NULL) return;
+    net->members=members;
+    members[net->nmembers].node=node;
+    members[net->nmembers++].seen=utime();
+    repl_view_change(store);
+    /* The new member learns of this node without waiting */
+    send_msg(store,OP_HELLO,NULL,0);
+    net->helloTime=utime();
+}
+
+/** Remove a partition member, runLock must be held */
+static void repl_member_drop(list_store_t *store,id_t node)
+{
+    repl_info_t *net=store->net;
+    int i;
+
+    for (i=0;i<net->nmembers;i++) {
+        if (net->members[i].node==node) {
+            net->members[i]=net->members[--net->nmembers];
+            repl_view_change(store);
+            return;
+        }
+    }
+}
+
+/**
+ * Send a member the keys it owns again, after it lost updates that are no
+ * longer held for retransmission.  The walk compares against the ring
+ * without the member, as if it had just joined.  runLock must be held.
+ * @param store List master structure
+ * @param node Member missing updates
+ */
+static void repl_repair(list_store_t *store,id_t node)
+{
+    repl_info_t *net=store->net;
+    bool due=((net->viewChanged)||(net->rebalancing));
+    repl_ring_t *from=(due) ? &net->viewOld : &net->ring;
+    id_t *nodes=malloc((from->nnodes+1)*sizeof(*nodes));
+    repl_ring_t ring;
+    int n=0;
+    int i;
+
+    if (nodes==NULL) return;
+    for (i=0;i<from->nnodes;i++) {
+        if (from->nodes[i]!=node) nodes[n++]=from->nodes[i];
+    }
+    if (repl_ring_build(&ring,nodes,n)) {
+        if (due) repl_ring_free(&net->viewOld);
+        net->viewOld=ring;
+        net->rebalancing=false;
+        net->viewChanged=true;
+        /* Nothing to settle, start on the next pass */
+        net->viewTime=utime()-REPL_SETTLE_US;
+    }
+    free(nodes);
+}
+
+/**
+ * Send the next burst of a rebalance walk, runLock must be held.  A key
+ * whose owners gained a member is sent by the first of its previous owners
+ * that is still a member, and keys no longer owned here are dropped.
+ * @param store List master structure
+ * @return true when the whole table has been checked
+ */
+static bool repl_rebalance_burst(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    id_t old[REPL_REPLICAS_MAX];
+    id_t cur[REPL_REPLICAS_MAX];
+    unsigned long start;
+    int scan=0;
+    bool done=false;
+
+    pthread_mutex_lock(&store->lock);
+    pthread_mutex_lock(&net->txLock);
+    repl_drain(store,true);
+    start=net->txCount;
+    net->txHold=true;
+
+    if (net->rebalHasKey) {
+        net->rebalIndex=_next_index(store,net->rebalKey,net->rebalIndex);
+    }
+    while (net->rebalIndex<store->index) {
+        _entry_t *eptr=((_entry_t *)store->list)+net->rebalIndex;
+        int nold=repl_owners(store,&net->viewOld,eptr->key,old);
+        int ncur=repl_owners(store,&net->ring,eptr->key,cur);
+        id_t sender=0;
+        bool gained=false;
+        int i;
+
+        for (i=0;i<nold;i++) {
+            if (repl_ring_has(&net->ring,old[i])) {
+                sender=old[i];
+                break;
+            }
+        }
+        for (i=0;(i<ncur)&&(!gained);i++) {
+            gained=!repl_is_owner(old,nold,cur[i]);
+        }
+        if ((gained)&&(sender==net->self)) {
+            repl_batch_add(store,OP_SET,eptr->key,store->key.sz(eptr->key),
+                    eptr->val,store->value.sz(eptr->val));
+            net->rebalSent++;
+        }
+        if (repl_is_owner(cur,ncur,net->self)) net->rebalIndex++;
+        else _delete_entry(store,net->rebalIndex);
+        if ((net->txCount-start>=REPL_SYNC_BURST)||
+                (net->txHeld>=REPL_TX_BATCH-1)||(++scan>=REPL_SYNC_SCAN)) break;
+    }
+    if (net->rebalIndex>=store->index) {
+        done=true;
+    } else if (net->rebalIndex) {
+        /* Entries before the index are kept, resume after the last one */
+        _entry_t *eptr=((_entry_t *)store->list)+net->rebalIndex-1;
+        store->key.cp(net->rebalKey,eptr->key);
+        net->rebalHasKey=true;
+    } else {
+        net->rebalHasKey=false;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    net->txHold=false;
+    if (done) repl_flush(store);
+    else repl_send_held(store);
+    pthread_mutex_unlock(&net->txLock);
+    return done;
+}
+
+/**
+ * Partition timers, runLock must be held.  Members are announced every
+ * REPL_HELLO_US and dropped after REPL_MEMBER_US of silence.  Once the
+ * members settle the table is walked in paced bursts to move keys to their
+ * new owners.
+ * @param store List master structure
+ * @param now Current time in usec
+ * @return Time in usec until the next timer
+ */
+static long repl_partition_tick(list_store_t *store,long now)
+{
+    repl_info_t *net=store->net;
+    long next;
+    int i;
+
+    if (now-net->helloTime>=REPL_HELLO_US) {
+        send_msg(store,OP_HELLO,NULL,0);
+        net->helloTime=now;
+    }
+    next=net->helloTime+REPL_HELLO_US-now;
+
+    /* Dropping swaps in the last member, which was already checked */
+    for (i=net->nmembers;i>0;i--) {
+        if (now-net->members[i-1].seen>=REPL_MEMBER_US) {
+            dbg("Member expired: %x",net->members[i-1].node);
+            repl_member_drop(store,net->members[i-1].node);
+        }
+    }
+
+    if (net->viewChanged) {
+        if (now-net->viewTime>=REPL_SETTLE_US) {
+            dbg("Rebalance start: %d members",net->ring.nnodes);
+            net->viewChanged=false;
+            net->rebalancing=true;
+            net->rebalIndex=0;
+            net->rebalHasKey=false;
+            net->rebalSent=0;
+            net->rebalNext=now;
+        } else if (net->viewTime+REPL_SETTLE_US-now<next) {
+            next=net->viewTime+REPL_SETTLE_US-now;
+        }
+    }
+    if (net->rebalancing) {
+        if (now>=net->rebalNext) {
+            long wait=repl_pace_wait(store,now);
+            if (wait) {
+                net->rebalNext=now+wait;
+            } else if (repl_rebalance_burst(store)) {
+                dbg("Rebalance complete: %lu",net->rebalSent);
+                net->rebalancing=false;
+                repl_ring_free(&net->viewOld);
+                return next;
+            } else {
+                net->rebalNext=now+REPL_SYNC_PACE_US;
+            }
+        }
+        if (net->rebalNext-now<next) next=net->rebalNext-now;
+    }
+    return next;
+}
+
+/**
+ * Answer a get forwarded to this node.  A value too large for a control
+ * message is answered as not found.
+ * @param store List master structure
+ * @param node Node that forwarded the get
+ * @param vreq OP_GET payload
+ * @param bytes Size of the payload
+ */
+static void repl_get_reply(list_store_t *store,id_t node,void *vreq,int bytes)
+{
+    uint8_t buf[REPL_CTL_MAX];
+    get_req_t *req=(get_req_t *)vreq;
+    get_rep_t *rep=(get_rep_t *)buf;
+    void *key=req+1;
+    int len=sizeof(*rep);
+    _entry_t *eptr;
+
+    if (bytes-(int)sizeof(*req)<store->key.sz(key)) return;
+    rep->node=node;
+    rep->req=req->req;
+    rep->found=0;
+    pthread_mutex_lock(&store->lock);
+    eptr=_hash_search(store,key,false);
+    if ((eptr)&&(len+store->value.sz(eptr->val)<=REPL_CTL_MAX)) {
+        memcpy(buf+len,eptr->val,store->value.sz(eptr->val));
+        len+=store->value.sz(eptr->val);
+        rep->found=1;
+    }
+    pthread_mutex_unlock(&store->lock);
+    send_msg(store,OP_GET_REP,buf,len);
+}
+
+/**
+ * Get a key this node does not hold from its owners.  Each owner is asked in
+ * turn and given REPL_FETCH_US to reply.
+ * @param store List master structure
+ * @param keyref Key data
+ * @param value Output of the value
+ * @return true if an owner had the key
+ */
+bool repl_fetch(list_store_t *store,void *keyref,void *value)
+{
+    repl_info_t *net=store->net;
+    uint8_t buf[REPL_CTL_MAX];
+    get_req_t *req=(get_req_t *)buf;
+    id_t owners[REPL_REPLICAS_MAX];
+    int ksize=store->key.sz(keyref);
+    bool found=false;
+    int n,i;
+
+    if ((!net)||(!store->partition)||(sizeof(*req)+ksize>REPL_CTL_MAX)) {
+        return false;
+    }
+    pthread_mutex_lock(&store->lock);
+    n=repl_owners(store,&net->ring,keyref,owners);
+    pthread_mutex_unlock(&store->lock);
+    memcpy(req+1,keyref,ksize);
+
+    pthread_mutex_lock(&net->fetchLock);
+    for (i=0;(i<n)&&(!found);i++) {
+        struct timespec ts;
+
+        if (owners[i]==net->self) continue;
+        clock_gettime(CLOCK_REALTIME,&ts);
+        ts.tv_nsec+=REPL_FETCH_US*1000;
+        if (ts.tv_nsec>=1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec-=1000000000;
+        }
+        pthread_mutex_lock(&net->netLock);
+        req->owner=owners[i];
+        req->req=++net->fetchReq;
+        net->fetchDst=value;
+        net->fetchDone=false;
+        pthread_mutex_unlock(&net->netLock);
+        send_msg(store,OP_GET,buf,sizeof(*req)+ksize);
+
+        pthread_mutex_lock(&net->netLock);
+        while (!net->fetchDone) {
+            if (pthread_cond_timedwait(&net->fetchCond,&net->netLock,&ts)) break;
+        }
+        found=(net->fetchDone)&&(net->fetchFound);
+        /* A late reply must not write to value */
+        net->fetchDst=NULL;
+        pthread_mutex_unlock(&net->netLock);
+    }
+    pthread_mutex_unlock(&net->fetchLock);
+    return found;
+}
+
+/**
+ * Wait for the initial state to be received from the existing nodes.
+ * @param store List master structure
+ * @param tmOutms Maximum time to wait
+ * @return true when the list is in sync
+ */
+bool repl_wait_sync(list_store_t *store,long tmOutms)
+{
+    repl_info_t *net=store->net;
+    struct timespec ts;
+    bool ret;
+
+    if (!net) return false;
+
+    clock_gettime(CLOCK_REALTIME,&ts);
+    ts.tv_sec+=tmOutms/1000;
+    ts.tv_nsec+=(tmOutms%1000)*1000000;
+    if (ts.tv_nsec>=1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec-=1000000000;
+    }
+    pthread_mutex_lock(&net->netLock);
+    while (!net->synced) {
+        if (pthread_cond_timedwait(&net->startCond,&net->netLock,&ts)) break;
+    }
+    ret=net->synced;
+    pthread_mutex_unlock(&net->netLock);
+    return ret;
 }
 
-/** Transmit an update packet */
+/**
+ * Hold an update until the coalescing window closes, store->lock must be
+ * held.  A key updated again in the same window is sent once, with the value
+ * it has when the window closes.
+ * @param store List master structure
+ * @param eptr Entry updated
+ * @return false if the key could not be held
+ */
+static bool repl_pend(list_store_t *store,_entry_t *eptr)
+{
+    repl_info_t *net=store->net;
+    size_t ksize=store->key.sz(NULL);
+
+    if (eptr->flags&ENTRY_PENDING) return true;
+    if (net->npend==net->maxpend) {
+        int max=(net->maxpend) ? net->maxpend*2 : 64;
+        uint8_t *pend=realloc(net->pend,max*ksize);
+        if (pend==NULL) return false;
+        net->pend=pend;
+        net->maxpend=max;
+    }
+    memcpy(net->pend+net->npend*ksize,eptr->key,store->key.sz(eptr->key));
+    eptr->flags|=ENTRY_PENDING;
+    if (net->npend==0) {
+        /* Open the window and let the reactor time it */
+        net->pendStart=utime();
+        __atomic_store_n(&net->npend,1,__ATOMIC_RELEASE);
+        repl_wake();
+    } else {
+        net->npend++;
+    }
+    return true;
+}
+
+/** Queue the current value of each key held in the window, store->lock must
+ * be held.  Keys deleted in the window were already sent as OP_DEL. */
+static void repl_pend_flush(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    size_t ksize=store->key.sz(NULL);
+    int i;
+
+    for (i=0;i<net->npend;i++) {
+        int index=_find_index(store,net->pend+i*ksize);
+        if (index>=0) {
+            _entry_t *eptr=((_entry_t *)store->list)+index;
+            if (eptr->flags&ENTRY_PENDING) {
+                eptr->flags&=~ENTRY_PENDING;
+                repl_queue(store,OP_SET,eptr->key,store->key.sz(eptr->key),
+                        eptr->val,store->value.sz(eptr->val));
+            }
+        }
+    }
+    __atomic_store_n(&net->npend,0,__ATOMIC_RELEASE);
+}
+
+/**
+ * Set the coalescing window.  Updates of a key within the window are
+ * collapsed to one OP_SET with the latest value.
+ * @param store List master structure
+ * @param tmOutms Window in milliseconds, 0 sends every update
+ * @return false if sharing is not started
+ */
+bool repl_coalesce(list_store_t *store,long tmOutms)
+{
+    repl_info_t *net=store->net;
+
+    if (!net) return false;
+    pthread_mutex_lock(&store->lock);
+    net->coalesceUs=(tmOutms>0) ? tmOutms*1000 : 0;
+    pthread_mutex_unlock(&store->lock);
+    /* Held keys are sent on the reactor's next pass */
+    repl_wake();
+    return true;
+}
+
+/**
+ * Limit the send rate with a token bucket.  The rate is also capped by the
+ * receive space the receivers advertise.
+ * @param store List master structure
+ * @param rate Bytes per second, 0 for no limit
+ * @param burst Bytes sent at full speed after an idle time
+ * @return false if sharing is not started
+ */
+bool repl_pace(list_store_t *store,long rate,long burst)
+{
+    repl_info_t *net=store->net;
+
+    if (!net) return false;
+    pthread_mutex_lock(&net->txLock);
+    net->paceRate=(rate>0) ? rate : 0;
+    net->paceBurst=(burst>net->txMax) ? burst : net->txMax;
+    net->paceTokens=net->paceBurst*1000000L;
+    net->paceTime=utime();
+    pthread_mutex_unlock(&net->txLock);
+    /* Records held back by the old rate go out on the next pass */
+    repl_wake();
+    return true;
+}
+
+/** Queue an update record */
 bool repl_update(list_store_t *store,_entry_t *eptr)
 {
     repl_info_t *net=store->net;
-    int bytes=0;
 
-    /* Ensure buffer is allocated */
+    /* Ensure network is up */
     if ((net)&&(net->sock)) {
-        int keysize=store->key.sz(eptr->key);
-        int valsize=store->value.sz(eptr->val);
-        int msize=offsetof(packet_t,data)+keysize+valsize;
-        packet_t *pkt=NULL;
-
         dbgentry(eptr);
-        /* Alocate send buffer and populate */
-        if ((pkt=malloc(msize))) {
-            pkt->size=msize;
-            pkt->hashid=store->id;
-            pkt->nodeid=store->net->self;
-            pkt->op=OP_SET;
-            memcpy(&pkt->data[0],eptr->key,keysize);
-            memcpy(&pkt->data[keysize],eptr->val,valsize);
-            bytes=mcast_send(store->net->sock,store->port,pkt,msize,0);
-            free(pkt);
-        }
-        if (bytes>=(keysize+valsize)) return true;
-        fprintf(stderr,"Set size issue: Bytes: %d, Size: %d\n",bytes,keysize+valsize);
+        /* Keys sent on to their owners are not kept to coalesce */
+        if ((net->coalesceUs)&&(repl_owned(store,eptr->key))&&
+                (repl_pend(store,eptr))) return true;
+        return repl_queue(store,OP_SET,eptr->key,store->key.sz(eptr->key),
+                eptr->val,store->value.sz(eptr->val));
+    }
+    return false;
+}
+
+/** Queue an update record for a key only other nodes keep, store->lock must
+ * be held.  The owners take the record from the batch and this node does not
+ * store it. */
+bool repl_forward(list_store_t *store,void *keyref,void *valref)
+{
+    repl_info_t *net=store->net;
+
+    /* Ensure network is up */
+    if ((net)&&(net->sock)) {
+        return repl_queue(store,OP_SET,keyref,store->key.sz(keyref),
+                valref,store->value.sz(valref));
     }
     return false;
 }
 
+/** Queue a delete record, store->lock must be held */
 bool repl_remove(list_store_t *store,void *keyref)
 {
     repl_info_t *net=store->net;
-    int bytes=0;
 
-    /* Ensure buffer is allocated */
+    /* Ensure network is up */
     if ((net)&&(net->sock)) {
-        int keysize=store->key.sz(keyref);
-        bytes=send_msg(store,OP_DEL,keyref,keysize);
-        if (bytes>=keysize) return true;
-        fprintf(stderr,"Del size issue: Bytes: %d, Size: %d\n",bytes,keysize);
+        repl_tomb(store,keyref);
+        return repl_queue(store,OP_DEL,keyref,store->key.sz(keyref),NULL,0);
     }
     return false;
 }
 
-/** Allocate resources and start the receive thread */
-bool repl_start(list_store_t *store)
+/**
+ * Wait, before the writer takes store->lock, until the outbound queue of a
+ * paced store has room for a record of the largest size.  The reactor
+ * drains the queue as the bucket refills, so a burst of Sets is slowed here
+ * without holding up readers or the reactor.
+ * @param store List master structure
+ */
+void repl_reserve(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+    size_t rsize;
+
+    if ((!net)||(!net->sock)||(net->paceRate==0)) return;
+    /* A record may also pad to the end of the queue */
+    rsize=2*((sizeof(uint32_t)+1+store->key.sz(NULL)+store->value.sz(NULL)+3)&~(size_t)3);
+    while (__atomic_load_n(&net->qHead,__ATOMIC_ACQUIRE)+rsize-
+            __atomic_load_n(&net->qTail,__ATOMIC_ACQUIRE)>net->qSize) {
+        long wait=repl_pace_wait(store,utime());
+        usleep((wait) ? wait : REPL_FLUSH_US);
+    }
+}
+
+/**
+ * Wait as repl_reserve does, then count the deletes that fit the outbound
+ * queue of a paced store, so a batch of expiries under store->lock is no
+ * larger than the queue takes.
+ * @param store List master structure
+ * @param count most deletes wanted
+ * @return deletes of the largest key that fit, at most count
+ */
+int repl_room(list_store_t *store,int count)
+{
+    repl_info_t *net=store->net;
+    size_t rsize,room;
+
+    repl_reserve(store);
+    if ((!net)||(!net->sock)||(net->paceRate==0)) return count;
+    rsize=(sizeof(uint32_t)+1+store->key.sz(NULL)+3)&~(size_t)3;
+    room=net->qSize-(__atomic_load_n(&net->qHead,__ATOMIC_ACQUIRE)-
+            __atomic_load_n(&net->qTail,__ATOMIC_ACQUIRE));
+    /* Less one record for the padding to the end of the queue */
+    room=room/rsize-1;
+    return (room<(size_t)count) ? (int)room : count;
+}
+
+/**
+ * Append a SET or DEL record to the outbound queue.  The caller holds
+ * store->lock, which serializes the producers, and the reactor drains the
+ * queue into batch packets.  Only when the queue is full does the caller
+ * drain and send it, past the rate of a paced store rather than wait under
+ * the lock; paced writers wait for room in repl_reserve first.
+ * @param store List master structure
+ * @param op OP_SET or OP_DEL
+ * @param key key data
+ * @param keysize number of key bytes
+ * @param val value data, NULL for OP_DEL
+ * @param valsize number of value bytes
+ * @return false if a full queue could not be sent
+ */
+static bool repl_queue(list_store_t *store,uint8_t op,void *key,int keysize,
+        void *val,int valsize)
 {
+    repl_info_t *net=store->net;
+    uint32_t len=1+keysize+valsize;
+    size_t rec=(sizeof(len)+len+3)&~(size_t)3;  /**< Keeps records aligned */
+    size_t head=net->qHead;
+    size_t off=head&(net->qSize-1);
+    size_t room=net->qSize-off;
+    size_t need=(rec>room) ? room+rec : rec;
     bool ret=true;
 
-    if ((store->port)&&(!store->net)) {
-        repl_info_t *net=calloc(1,sizeof(*(store->net)));
-        if (net) {
-            pthread_mutex_init(&net->netLock,NULL);
-            pthread_cond_init(&net->startCond,NULL);
-
-            /* Initialize Multicast */
-            net->sock=mcast_init(store->port);
-            if (net->sock<=0) {
-                if (net) free(net);
-                return false;
-            } else {
-                /* Save net structure where thread will access */
-                store->net=net;
+    if (head+need-__atomic_load_n(&net->qTail,__ATOMIC_ACQUIRE)>net->qSize) {
+        /* Full, the writer has to move the records itself */
+        pthread_mutex_lock(&net->txLock);
+        repl_pace_delay(store,utime());
+        ret=repl_drain(store,true);
+        if (head+need-net->qTail>net->qSize) ret=repl_drain(store,false);
+        pthread_mutex_unlock(&net->txLock);
+    }
+    if (rec>room) {
+        /* A zero length pads to the end of the queue */
+        uint32_t pad=0;
+        memcpy(&net->q[off],&pad,sizeof(pad));
+        head+=room;
+        off=0;
+    }
+    memcpy(&net->q[off],&len,sizeof(len));
+    net->q[off+sizeof(len)]=op;
+    memcpy(&net->q[off+sizeof(len)+1],key,keysize);
+    if (valsize) memcpy(&net->q[off+sizeof(len)+1+keysize],val,valsize);
+    __atomic_store_n(&net->qHead,head+rec,__ATOMIC_SEQ_CST);
 
-                /* Lock condition */
-                pthread_mutex_lock(&net->netLock);
-                pthread_create(&store->nethandle, NULL, store_replication,(void*)store);
+    /* Wake the reactor for the first record since the last batch */
+    if (!__atomic_exchange_n(&net->armed,true,__ATOMIC_SEQ_CST)) repl_wake();
+    return ret;
+}
 
-                /* Wait for start */
-                pthread_cond_wait(&net->startCond, &net->netLock);
-                pthread_mutex_unlock(&net->netLock);
-            }
+/** Move the queued records into batch packets, txLock must be held
+ * @param store List master structure
+ * @param paced true to stop when the bucket of a paced store is empty
+ * @return false if a full batch could not be sent
+ */
+static bool repl_drain(list_store_t *store,bool paced)
+{
+    repl_info_t *net=store->net;
+    size_t tail=net->qTail;
+    size_t head=__atomic_load_n(&net->qHead,__ATOMIC_ACQUIRE);
+    bool ret=true;
+
+    while (tail!=head) {
+        size_t off=tail&(net->qSize-1);
+        uint32_t len;
+
+        /* A paced store leaves the rest for the bucket to refill */
+        if ((paced)&&(net->paceRate)&&(net->paceTokens<=0)) break;
+
+        memcpy(&len,&net->q[off],sizeof(len));
+        if (len==0) {
+            tail+=net->qSize-off;
+            continue;
+        }
+        /* The record is already op, key and value */
+        if (!repl_batch_add(store,net->q[off+sizeof(len)],
+                    &net->q[off+sizeof(len)+1],len-1,NULL,0)) ret=false;
+        tail+=(sizeof(len)+len+3)&~(size_t)3;
+    }
+    __atomic_store_n(&net->qTail,tail,__ATOMIC_RELEASE);
+    return ret;
+}
+
+/**
+ * Send a record too large for one packet as a run of OP_FRAG packets,
+ * txLock must be held.  Each fragment has its own sequence number, so a lost
+ * fragment is retransmitted alone and the receiver reassembles the record
+ * as the fragments are delivered in order.
+ * @param store List master structure
+ * @param op OP_SET or OP_DEL
+ * @param key key data
+ * @param keysize number of key bytes
+ * @param val value data, NULL for OP_DEL
+ * @param valsize number of value bytes
+ * @return false if a packet could not be sent
+ */
+static bool repl_frag(list_store_t *store,uint8_t op,void *key,int keysize,
+        void *val,int valsize)
+{
+    repl_info_t *net=store->net;
+    int hdrSize=offsetof(packet_t,data);
+    int room=net->txMax-hdrSize-sizeof(frag_t);
+    frag_t frag;
+    bool ret;
+
+    /* Records queued before this one go first */
+    ret=repl_flush(store);
+    frag.total=1+keysize+valsize;
+    for (frag.offset=0;frag.offset<frag.total;) {
+        uint8_t *dst=net->tx+hdrSize+sizeof(frag);
+        uint32_t pos=frag.offset;
+        int n=(frag.total-pos<room) ? frag.total-pos : room;
+        int left=n;
+
+        memcpy(net->tx+hdrSize,&frag,sizeof(frag));
+        /* Copy the span of the op byte, key and value in this fragment */
+        if (pos==0) {
+            *dst++=op;
+            left--;
         } else {
-            fprintf(stderr,"Memory Allocation Error: %d\n",(int) sizeof(*(store->net)));
-            ret=false;
+            pos--;
         }
-    } else {
-        ret=false;
+        if ((left)&&(pos<keysize)) {
+            int c=(keysize-pos<left) ? keysize-pos : left;
+            memcpy(dst,(uint8_t *)key+pos,c);
+            dst+=c;
+            left-=c;
+            pos=0;
+        } else {
+            pos-=keysize;
+        }
+        if (left) memcpy(dst,(uint8_t *)val+pos,left);
+        net->txStart=utime();
+        net->txLen=hdrSize+sizeof(frag)+n;
+        if (!repl_finish(store,OP_FRAG)) ret=false;
+        frag.offset+=n;
     }
     return ret;
 }
 
+/**
+ * Add a fragment to the record being reassembled for a peer and apply the
+ * record once complete.  A fragment out of place, after lost packets were
+ * given up on, discards the partial record.
+ * @param store List master structure
+ * @param node Node that sent the fragment
+ * @param data OP_FRAG payload
+ * @param bytes Size of the payload
+ */
+static void repl_reassemble(list_store_t *store,id_t node,uint8_t *data,int bytes)
+{
+    repl_info_t *net=store->net;
+    repl_peer_t *peer=NULL;
+    frag_t frag;
+    int i;
+
+    if (bytes<=(int)sizeof(frag)) return;
+    memcpy(&frag,data,sizeof(frag));
+    data+=sizeof(frag);
+    bytes-=sizeof(frag);
+    for (i=0;i<net->npeers;i++) {
+        if (net->peers[i].node==node) peer=&net->peers[i];
+    }
+    if (peer==NULL) return;
 
-/** Close the socket to wake the thread so it sees the exit condition. Then 
- * join to gather thread resources */
-void repl_close(list_store_t *store)
+    if (frag.offset==0) {
+        uint8_t *buf;
+        /* A record can not be larger than the largest entry */
+        if (frag.total>1+store->key.sz(NULL)+store->value.sz(NULL)) return;
+        buf=realloc(peer->frag,frag.total);
+        if (buf==NULL) return;
+        peer->frag=buf;
+        peer->fragTotal=frag.total;
+        peer->fragLen=0;
+    }
+    if ((peer->fragTotal==0)||(frag.total!=peer->fragTotal)||
+            (frag.offset!=peer->fragLen)||(bytes>frag.total-frag.offset)) {
+        dbg("Fragment dropped from: %x offset: %u",node,frag.offset);
+        peer->fragTotal=0;
+        return;
+    }
+    memcpy(peer->frag+peer->fragLen,data,bytes);
+    peer->fragLen+=bytes;
+    if (peer->fragLen==peer->fragTotal) {
+        peer->fragTotal=0;
+        processOp(store,OP_BATCH,node,peer->frag,peer->fragLen);
+    }
+}
+
+/**
+ * Append a record to the outbound batch, txLock must be held.
+ * The batch is sent when the next record does not fit in a packet, otherwise
+ * it is sent by the reactor within REPL_FLUSH_US.  Larger records are sent
+ * in fragments.
+ * @param store List master structure
+ * @param op OP_SET or OP_DEL
+ * @param key key data
+ * @param keysize number of key bytes
+ * @param val value data, NULL for OP_DEL
+ * @param valsize number of value bytes
+ * @return false if a full batch could not be sent
+ */
+static bool repl_batch_add(list_store_t *store,uint8_t op,void *key,int keysize,
+        void *val,int valsize)
 {
     repl_info_t *net=store->net;
+    int hdrSize=offsetof(packet_t,data);
+    int rsize=1+keysize+valsize;
+    bool ret=true;
 
-    /* Ensure network is up */
-    if ((net)&&(net->sock)) {
-        /* Set port to 0 so thread will exit next loop */
-        store->port=0;
-        close(store->net->sock);
-        store->net->sock=0;
-        pthread_join(store->nethandle,NULL);
+    if (hdrSize+rsize>net->txMax) return repl_frag(store,op,key,keysize,val,valsize);
+    /* Send the current batch if this record will not fit */
+    if ((net->txLen>hdrSize)&&(net->txLen+rsize>net->txMax)) {
+        ret=repl_flush(store);
+    }
 
-        /* Clean up resources */
-        if (store->net) free(store->net);
-        store->net=NULL;
+    /* New batch, start the flush timer */
+    if (net->txLen==hdrSize) net->txStart=utime();
+    net->tx[net->txLen]=op;
+    memcpy(&net->tx[net->txLen+1],key,keysize);
+    if (valsize) memcpy(&net->tx[net->txLen+1+keysize],val,valsize);
+    net->txLen+=rsize;
+    return ret;
+}
+
+/** Finish the outbound batch packet and send it, txLock must be held.
+ * While txHold is set finished packets are kept, up to REPL_TX_BATCH, to be
+ * sent together.
+ * @param store List master structure
+ * @return true if the batch was sent, held or empty
+ */
+static bool repl_flush(list_store_t *store)
+{
+    return repl_finish(store,OP_BATCH);
+}
+
+/** Number the outbound packet, keep it for retransmission and send it,
+ * txLock must be held.
+ * @param store List master structure
+ * @param op OP_BATCH or OP_FRAG
+ * @return true if the packet was sent, held or empty
+ */
+static bool repl_finish(list_store_t *store,uint8_t op)
+{
+    repl_info_t *net=store->net;
+    int hdrSize=offsetof(packet_t,data);
+
+    if (net->txLen>hdrSize) {
+        packet_t *pkt=(packet_t *)net->tx;
+
+        pkt->size=net->txLen;
+        pkt->hashid=store->id;
+        pkt->nodeid=net->self;
+        pkt->seq=++net->txSeq;
+        pkt->op=op;
+        /* Keep a copy to answer NACKs */
+        {
+            int slot=pkt->seq%REPL_HISTORY;
+            memcpy(net->hist+(size_t)slot*net->txMax,pkt,net->txLen);
+            net->histLen[slot]=net->txLen;
+            net->histSeq[slot]=pkt->seq;
+        }
+        net->txLens[net->txHeld++]=net->txLen;
+        net->txCount++;
+        net->txLen=hdrSize;
+        /* The next record queued wakes the reactor again */
+        __atomic_store_n(&net->armed,false,__ATOMIC_SEQ_CST);
+        if ((net->txHold)&&(net->txHeld<REPL_TX_BATCH)) {
+            net->tx=net->txBuf+(size_t)net->txHeld*net->txMax;
+            return true;
+        }
     }
+    return repl_send_held(store);
 }
 
-/** Indicates when data is available on the listen or accepted socket using
- * select.  This avoids blocking, forever in the accept call, and allows the
- * thread to exit
- * @param sFd Listen socket file descriptor
- * @param cFd Active client socket file descriptor
- * @return File descriptor with data or 0 on a timeout
+/** Send the finished packets with one system call, txLock must be held.
+ * A partly filled batch is moved to the first slot.
+ * @param store List master structure
+ * @return true if all packets were sent
  */
-static int socketReady(int sock, long tmOutms)
+static bool repl_send_held(list_store_t *store)
 {
-    fd_set read_fds;
-    int status;
-    int nfds=0;
-    struct timeval wait;
+    repl_info_t *net=store->net;
+    int hdrSize=offsetof(packet_t,data);
+    int held=net->txHeld;
+    int sent;
+
+    if (held==0) return true;
+
+    sent=repl_send(store,net->txBuf,net->txMax,net->txLens,held);
+    repl_pace_use(net,net->txLens,held);
+    if (sent<held) {
+        fprintf(stderr,"Batch send issue: Sent: %d, Packets: %d\n",sent,held);
+    }
+    net->txHeld=0;
+    net->txSeqSent=net->txSeq;
+    net->txSentTime=utime();
+    if ((net->txLen>hdrSize)&&(net->tx!=net->txBuf)) {
+        memmove(net->txBuf+hdrSize,net->tx+hdrSize,net->txLen-hdrSize);
+    }
+    net->tx=net->txBuf;
+    return (sent==held);
+}
 
-    /* Set Timeout */
-    memset(&wait,0x00,sizeof(wait));
-    wait.tv_sec = tmOutms/1000;
-    wait.tv_usec = tmOutms%1000;
+/** Allocate resources and add the store to the replication reactor */
+bool repl_start(list_store_t *store)
+{
+    repl_info_t *net;
+    repl_port_t *rport=NULL;
+    int hdrSize=offsetof(packet_t,data);
+    size_t rsize;
 
-    /* Setup select inputs */
-    FD_ZERO(&read_fds);
+    if ((!store->port)||(store->net)) return false;
 
-    /* Add descriptors */
-    if (sock>0) {
-        nfds = sock;
-        FD_SET(sock, &read_fds);
+    net=calloc(1,sizeof(*(store->net)));
+    if (net==NULL) {
+        fprintf(stderr,"Memory Allocation Error: %d\n",(int) sizeof(*(store->net)));
+        return false;
     }
+    pthread_mutex_init(&net->netLock,NULL);
+    pthread_cond_init(&net->startCond,NULL);
+    pthread_mutex_init(&net->txLock,NULL);
+    pthread_mutex_init(&net->runLock,NULL);
+    pthread_mutex_init(&net->fetchLock,NULL);
+    pthread_cond_init(&net->fetchCond,NULL);
 
-    /* Pause on select */
-    status = select(nfds + 1, &read_fds, (fd_set *)0, (fd_set *)0, &wait);
+    /* Packets fit the transport, larger records are fragmented */
+    net->txLen=hdrSize;
+    net->txMax=(store->local) ? shm_mtu() : REPL_MTU;
+    net->txBuf=malloc((size_t)REPL_TX_BATCH*net->txMax);
+    net->tx=net->txBuf;
+    net->hist=malloc((size_t)REPL_HISTORY*net->txMax);
+    /* Queue holds several records of maximum size */
+    rsize=sizeof(uint32_t)+1+store->key.sz(NULL)+store->value.sz(NULL);
+    for (net->qSize=REPL_QUEUE;net->qSize<4*rsize;net->qSize<<=1);
+    net->q=malloc(net->qSize);
+    net->syncKey=malloc(store->key.sz(NULL));
 
-    /* Check status */
-    if (status==0) {
-        /* Timeout */
-        return 0;
-    } else if (status<0) {
-        /* Error, sleep to stop runaway error, also occurs on close */
-        usleep(10000);
-        return 0;
-    } else {
-        /* Check if server connection is ready */
-        if (FD_ISSET(sock, &read_fds)) {
-            return sock;
+    /* Set initial state */
+    net->state=STATE_START;
+    net->startTime=utime()+REPL_START_US;
+
+    pthread_mutex_lock(&reactor.lock);
+    net->self=repl_node_id();
+    if ((store->partition)&&
+            (((net->rebalKey=malloc(store->key.sz(NULL)))==NULL)||
+             (!repl_ring_build(&net->ring,&net->self,1)))) {
+        /* A partition starts with this node owning every key */
+        fprintf(stderr,"Memory Allocation Error: partition ring\n");
+    } else if ((net->tx)&&(net->hist)&&(net->q)&&(net->syncKey)&&
+            (repl_reactor_start())) {
+        rport=repl_port_get(store->port,store->local);
+    }
+    if (rport) {
+        list_store_t **stores=rport->stores;
+
+        /* Add to the port list, the reactor picks it up on the next wake */
+        pthread_rwlock_wrlock(&reactor.rwlock);
+        if (rport->nstores>=rport->maxstores) {
+            stores=realloc(rport->stores,(rport->maxstores+4)*sizeof(*stores));
+            if (stores) {
+                rport->stores=stores;
+                rport->maxstores+=4;
+            }
+        }
+        if (stores) {
+            net->sock=rport->sock;
+            net->rport=rport;
+            store->net=net;
+            rport->stores[rport->nstores++]=store;
+            reactor.nstores++;
+        }
+        pthread_rwlock_unlock(&reactor.rwlock);
+    }
+    if (store->net==NULL) {
+        /* Release the socket and threads if nothing else uses them */
+        if ((rport)&&(rport->nstores==0)) {
+            if (rport->sock>=0) close(rport->sock);
+            rport->sock=-1;
+            repl_local_close(rport);
+        }
+        if (reactor.nstores==0) repl_reactor_stop();
+        pthread_mutex_unlock(&reactor.lock);
+        if (net->txBuf) free(net->txBuf);
+        if (net->hist) free(net->hist);
+        if (net->q) free(net->q);
+        if (net->syncKey) free(net->syncKey);
+        if (net->rebalKey) free(net->rebalKey);
+        repl_ring_free(&net->ring);
+        free(net);
+        return false;
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    /* Changes are tracked from here, start from the current table */
+    repl_digest_all(store);
+
+    dbg("Replicator Starting: id: %x, self: %x, sock: %d port: %u",store->id,
+            net->self,net->sock,store->port);
+
+    /* See if existing nodes have more data */
+    send_msg(store,OP_STAT_REQ,NULL,0);
+    repl_wake();
+    return true;
+}
+
+
+/** Remove the store from the reactor.  The socket is closed with the last
+ * store on its port and the threads are joined with the last store. */
+void repl_close(list_store_t *store)
+{
+    repl_info_t *net=store->net;
+
+    /* Ensure network is up */
+    if ((net)&&(net->sock)) {
+        repl_port_t *rport=net->rport;
+        int i;
+
+        /* Send anything still held, queued or batched */
+        pthread_mutex_lock(&store->lock);
+        repl_pend_flush(store);
+        pthread_mutex_unlock(&store->lock);
+        pthread_mutex_lock(&net->txLock);
+        net->paceRate=0;
+        repl_drain(store,true);
+        repl_flush(store);
+        pthread_mutex_unlock(&net->txLock);
+        /* Owners move the keys of a leaving member without waiting */
+        if (store->partition) send_msg(store,OP_BYE,NULL,0);
+
+        /* Writer lock waits for any thread using the store */
+        pthread_mutex_lock(&reactor.lock);
+        pthread_rwlock_wrlock(&reactor.rwlock);
+        for (i=0;i<rport->nstores;i++) {
+            if (rport->stores[i]==store) {
+                rport->stores[i]=rport->stores[--rport->nstores];
+                reactor.nstores--;
+                break;
+            }
         }
+        if ((rport->nstores==0)&&(rport->sock>=0)) {
+            epoll_ctl(reactor.epfd,EPOLL_CTL_DEL,rport->sock,NULL);
+            close(rport->sock);
+            rport->sock=-1;
+        }
+        pthread_rwlock_unlock(&reactor.rwlock);
+        /* The receive thread takes the read lock, join it after */
+        if (rport->nstores==0) repl_local_close(rport);
+        if (reactor.nstores==0) repl_reactor_stop();
+        pthread_mutex_unlock(&reactor.lock);
+
+        store->port=0;
+        net->sock=0;
+
+        /* Clean up resources */
+        pthread_mutex_destroy(&net->txLock);
+        pthread_mutex_destroy(&net->runLock);
+        free(net->txBuf);
+        free(net->hist);
+        free(net->q);
+        if (net->pend) free(net->pend);
+        repl_peers_free(store);
+        free(net->syncKey);
+        if (net->tombs) free(net->tombs);
+        if (net->rebalKey) free(net->rebalKey);
+        if (net->members) free(net->members);
+        repl_ring_free(&net->ring);
+        repl_ring_free(&net->viewOld);
+        pthread_mutex_destroy(&net->fetchLock);
+        pthread_cond_destroy(&net->fetchCond);
+        free(net);
+        store->net=NULL;
     }
-    return 0;
 }
 
 /**@}*/
@@ -30,10 +30,24 @@
 extern "C" {
 #endif
 
+#define REPL_REPLICAS_MAX 8     /**< Largest replication factor of a partition */
+
 bool repl_start(list_store_t *store);
 bool repl_update(list_store_t *store,_entry_t *eptr);
 bool repl_remove(list_store_t *store,void *keyref);
+bool repl_forward(list_store_t *store,void *keyref,void *valref);
+void repl_reserve(list_store_t *store);
+int repl_room(list_store_t *store,int count);
 void repl_close(list_store_t *store);
+bool repl_wait_sync(list_store_t *store,long tmOutms);
+void repl_digest(list_store_t *store,_entry_t *eptr);
+bool repl_coalesce(list_store_t *store,long tmOutms);
+bool repl_pace(list_store_t *store,long rate,long burst);
+bool repl_owned(list_store_t *store,void *key);
+bool repl_fetch(list_store_t *store,void *keyref,void *value);
+#ifdef UNIT_TEST
+extern unsigned int repl_test_drop;
+#endif
 
 #ifdef __cplusplus
 }
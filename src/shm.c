@@ -0,0 +1,318 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @brief Shared memory transport for processes on one host.  Each port maps
+ * a broadcast ring of fixed size slots.  Senders reserve slots with an atomic
+ * add and every reader follows the ring at its own position, so a packet
+ * costs two copies and no system call.  Readers that fall a full ring behind
+ * lose packets, as with a multicast socket, and the replication sequence
+ * numbers recover them.  A reader that finds the ring empty spins briefly
+ * and then sleeps on a futex, which senders only wake when a reader sleeps.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shm.h"
+
+#ifndef SHM_SLOTS
+#define SHM_SLOTS 4096          /**< Slots in a ring, a power of 2 */
+#endif
+#ifndef SHM_SLOT_SIZE
+#define SHM_SLOT_SIZE 2048      /**< Bytes per slot, including its header */
+#endif
+#define SHM_SPIN_US 50          /**< Time a reader polls before sleeping */
+#define SHM_STALL_US 10000      /**< Time before an unfinished write is lost */
+#define SHM_NAME "/hashlib.%u"  /**< Shared memory object of a port */
+
+#if defined(__x86_64__)||defined(__i386__)
+#define shm_pause() __builtin_ia32_pause()
+#else
+#define shm_pause()
+#endif
+
+/** Ring header, the write position has its own cache line */
+typedef struct {
+    uint32_t slots;         /**< Number of slots */
+    uint32_t slotSize;      /**< Size of each slot */
+    uint32_t sleepers;      /**< Readers waiting on event */
+    uint32_t event;         /**< Futex word, bumped to wake the sleepers */
+    uint8_t pad[48];
+    uint64_t head;          /**< Next position to reserve */
+    uint8_t pad2[56];
+} shm_hdr_t;
+
+/** Slot holding one packet */
+typedef struct {
+    uint64_t seq;           /**< Position+1 once written, 0 while writing */
+    uint32_t len;           /**< Bytes in data */
+    uint32_t pad;
+    uint8_t data[];
+} shm_slot_t;
+
+struct shm_ring {
+    shm_hdr_t *hdr;         /**< Mapped ring */
+    uint8_t *slots;         /**< First slot, after the header */
+    long spin;              /**< Poll time before sleeping, 0 on one CPU */
+};
+
+/** Return current time as long in microseconds */
+static inline long shm_utime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/** Slot for a ring position */
+static inline shm_slot_t *shm_slot(shm_ring_t *ring,uint64_t pos)
+{
+    return (shm_slot_t *)(ring->slots+(size_t)(pos&(SHM_SLOTS-1))*SHM_SLOT_SIZE);
+}
+
+/** Largest packet a slot holds */
+int shm_mtu(void)
+{
+    return SHM_SLOT_SIZE-offsetof(shm_slot_t,data);
+}
+
+/**
+ * Map the ring of a port, creating it for the first process.
+ * @param port Port number naming the ring
+ * @return Ring or NULL on failure
+ */
+shm_ring_t *shm_init(uint16_t port)
+{
+    size_t size=sizeof(shm_hdr_t)+(size_t)SHM_SLOTS*SHM_SLOT_SIZE;
+    char name[32];
+    struct stat st;
+    shm_ring_t *ring;
+    void *map;
+    int fd;
+
+    snprintf(name,sizeof(name),SHM_NAME,port);
+    fd=shm_open(name,O_RDWR|O_CREAT|O_CLOEXEC,0660);
+    if (fd<0) {
+        perror("shm_open");
+        return NULL;
+    }
+    /* A new object reads as zero, which is an empty ring */
+    if ((fstat(fd,&st)<0)||((st.st_size==0)&&(ftruncate(fd,size)<0))) {
+        perror("shm size");
+        close(fd);
+        return NULL;
+    }
+    if ((st.st_size!=0)&&(st.st_size!=size)) {
+        fprintf(stderr,"%s: size %ld, expected %lu\n",name,(long)st.st_size,size);
+        close(fd);
+        return NULL;
+    }
+    map=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (map==MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    ring=calloc(1,sizeof(*ring));
+    if (ring==NULL) {
+        munmap(map,size);
+        return NULL;
+    }
+    ring->hdr=map;
+    ring->slots=(uint8_t *)map+sizeof(shm_hdr_t);
+    /* Polling only helps while the sender runs on another CPU */
+    ring->spin=(sysconf(_SC_NPROCESSORS_ONLN)>1) ? SHM_SPIN_US : 0;
+    ring->hdr->slots=SHM_SLOTS;
+    ring->hdr->slotSize=SHM_SLOT_SIZE;
+    return ring;
+}
+
+/** Unmap a ring, the object stays for other processes */
+void shm_close(shm_ring_t *ring)
+{
+    munmap(ring->hdr,sizeof(shm_hdr_t)+(size_t)SHM_SLOTS*SHM_SLOT_SIZE);
+    free(ring);
+}
+
+/** Start a reader at the current write position, older packets are skipped */
+void shm_reader(shm_ring_t *ring,shm_reader_t *rd)
+{
+    rd->pos=__atomic_load_n(&ring->hdr->head,__ATOMIC_ACQUIRE);
+    rd->stall=0;
+}
+
+/** Wake the sleeping readers of every process */
+void shm_wake(shm_ring_t *ring)
+{
+    __atomic_fetch_add(&ring->hdr->event,1,__ATOMIC_SEQ_CST);
+    syscall(SYS_futex,&ring->hdr->event,FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+}
+
+/**
+ * Publish count packets to every reader of the ring.
+ * @param ring Ring of the port
+ * @param buf count slots of size bytes, one packet per slot
+ * @param size Size of each slot
+ * @param lens Number of bytes to send from each slot
+ * @param count Number of slots
+ * @return Number of packets sent, packets larger than shm_mtu are dropped
+ */
+int shm_send_batch(shm_ring_t *ring, uint8_t *buf, int size, int *lens, int count)
+{
+    uint64_t pos;
+    int sent=0;
+    int i;
+
+    if (count<=0) return 0;
+    pos=__atomic_fetch_add(&ring->hdr->head,count,__ATOMIC_ACQ_REL);
+    for (i=0;i<count;i++) {
+        shm_slot_t *slot=shm_slot(ring,pos+i);
+        int len=lens[i];
+
+        /* Readers copying the old packet see the change and drop it */
+        __atomic_store_n(&slot->seq,0,__ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if ((len<0)||(len>shm_mtu())) {
+            len=0;
+        } else {
+            memcpy(slot->data,buf+(size_t)i*size,len);
+            sent++;
+        }
+        slot->len=len;
+        __atomic_store_n(&slot->seq,pos+i+1,__ATOMIC_RELEASE);
+    }
+    /* Only a sleeping reader costs a system call */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->hdr->sleepers,__ATOMIC_RELAXED)) shm_wake(ring);
+    return sent;
+}
+
+/**
+ * Copy up to count packets from the ring.  A reader a full ring behind
+ * jumps to the write position, losing the packets between.
+ * @param ring Ring of the port
+ * @param rd Position of this reader
+ * @param buf count slots of size bytes, one packet per slot
+ * @param size Size of each slot
+ * @param lens Output of the size of each packet
+ * @param count Number of slots
+ * @return Number of packets read
+ */
+int shm_recv_batch(shm_ring_t *ring, shm_reader_t *rd, uint8_t *buf, int size,
+        int *lens, int count)
+{
+    int n=0;
+
+    while (n<count) {
+        shm_slot_t *slot=shm_slot(ring,rd->pos);
+        uint64_t seq=__atomic_load_n(&slot->seq,__ATOMIC_ACQUIRE);
+        uint32_t len;
+
+        if (seq!=rd->pos+1) {
+            uint64_t head=__atomic_load_n(&ring->hdr->head,__ATOMIC_ACQUIRE);
+
+            if (head-rd->pos>=SHM_SLOTS) {
+                /* Overrun, the slot has been reused */
+                rd->pos=head;
+                rd->stall=0;
+            } else if (rd->pos!=head) {
+                /* A sender is writing, or died writing the slot */
+                long now=shm_utime();
+                if (rd->stall==0) rd->stall=now;
+                if (now-rd->stall<SHM_STALL_US) break;
+                rd->pos++;
+                rd->stall=0;
+            } else {
+                break;
+            }
+            continue;
+        }
+        len=slot->len;
+        if (len>size) len=0;
+        memcpy(buf+(size_t)n*size,slot->data,len);
+        /* Keep the copy only if the slot was not reused during it */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq,__ATOMIC_RELAXED)!=seq) continue;
+        rd->pos++;
+        rd->stall=0;
+        if (len) lens[n++]=len;
+    }
+    return n;
+}
+
+/**
+ * Bytes a reader can fall further behind before it loses packets.
+ * @param ring Ring of the port
+ * @param rd Position of this reader
+ * @return Free slots times the slot payload
+ */
+long shm_space(shm_ring_t *ring,shm_reader_t *rd)
+{
+    uint64_t behind=__atomic_load_n(&ring->hdr->head,__ATOMIC_ACQUIRE)-rd->pos;
+
+    if (behind>=SHM_SLOTS) return 0;
+    return (long)(SHM_SLOTS-behind)*shm_mtu();
+}
+
+/**
+ * Wait for a packet past the reader position, polling for SHM_SPIN_US
+ * before sleeping when the host has more than one CPU.
+ * @param ring Ring of the port
+ * @param rd Position of this reader
+ * @param usec Longest time to wait
+ */
+void shm_wait(shm_ring_t *ring,shm_reader_t *rd,long usec)
+{
+    shm_hdr_t *hdr=ring->hdr;
+    long start=shm_utime();
+    struct timespec ts;
+    uint32_t event;
+
+    while (__atomic_load_n(&hdr->head,__ATOMIC_ACQUIRE)==rd->pos) {
+        if (shm_utime()-start>=ring->spin) break;
+        shm_pause();
+    }
+    if (__atomic_load_n(&hdr->head,__ATOMIC_ACQUIRE)!=rd->pos) {
+        /* Unfinished writes are polled, not slept on */
+        if (rd->stall) usleep(100);
+        return;
+    }
+
+    /* A sender that misses the sleeper count has already moved head */
+    __atomic_fetch_add(&hdr->sleepers,1,__ATOMIC_SEQ_CST);
+    event=__atomic_load_n(&hdr->event,__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->head,__ATOMIC_SEQ_CST)==rd->pos) {
+        ts.tv_sec=usec/1000000;
+        ts.tv_nsec=(usec%1000000)*1000;
+        syscall(SYS_futex,&hdr->event,FUTEX_WAIT,event,&ts,NULL,0);
+    }
+    __atomic_fetch_sub(&hdr->sleepers,1,__ATOMIC_SEQ_CST);
+}
+/**@}*/
@@ -0,0 +1,52 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * @{
+ */
+
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include<stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Shared memory ring, one per port on a host */
+typedef struct shm_ring shm_ring_t;
+
+/** Read position of one receiver */
+typedef struct {
+    uint64_t pos;       /**< Next ring position to read */
+    long stall;         /**< Time in usec an unfinished write was seen */
+} shm_reader_t;
+
+shm_ring_t *shm_init(uint16_t port);
+void shm_close(shm_ring_t *ring);
+int shm_mtu(void);
+void shm_reader(shm_ring_t *ring,shm_reader_t *rd);
+int shm_send_batch(shm_ring_t *ring, uint8_t *buf, int size, int *lens, int count);
+int shm_recv_batch(shm_ring_t *ring, shm_reader_t *rd, uint8_t *buf, int size,
+        int *lens, int count);
+void shm_wait(shm_ring_t *ring,shm_reader_t *rd,long usec);
+void shm_wake(shm_ring_t *ring);
+long shm_space(shm_ring_t *ring,shm_reader_t *rd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __SHM_H__ */
+/**@}*/
@@ -20,8 +20,11 @@
 #ifdef UNIT_TEST
 #include <stdio.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/time.h>
 #include "hash.h"
+#include "repl.h"
+#include "wheel.h"
 #include "test.h"
 
 #define mu_assert(message, test) do { if (!(test)) {printf("Fail %s:%d ",__func__,__LINE__); return message;} } while (0)
@@ -590,6 +593,367 @@ static char *testHashDel()
     return 0;
 }
 
+DEFINE_LIST(TestX,int,int);
+DEFINE_HASH(TestY,int);
+/** Sum the visited values, stopping once past the limit in ctx */
+static bool rangeSum(const void *key,int *value,void *ctx)
+{
+    int *sum=ctx;
+    sum[0]+=*value;
+    return (sum[0]<sum[1]);
+}
+/** Test for LowerBound, UpperBound and Range */
+static char *testHashRange()
+{
+    char key[16];
+    int sum[2];
+    int i;
+
+    /* Keys below 256 so the byte order compare is numeric */
+    for (i=0;i<=200;i+=2) mu_assert("Set range key",TestXSet(i,i));
+    for (i=0;i<10;i++) {
+        sprintf(key,"t:%03d",i);
+        mu_assert("Set range key",TestYSet(key,i));
+    }
+
+    mu_assert("LowerBound first",TestXLowerBound(0)==0);
+    mu_assert("LowerBound existing",TestXLowerBound(10)==5);
+    mu_assert("LowerBound missing",TestXLowerBound(11)==6);
+    mu_assert("UpperBound existing",TestXUpperBound(10)==6);
+    mu_assert("LowerBound past end",TestXLowerBound(250)==TestXCount());
+    mu_assert("UpperBound last",TestXUpperBound(200)==TestXCount());
+    mu_assert("LowerBound hash",TestYLowerBound("t:004")==4);
+    mu_assert("UpperBound hash",TestYUpperBound("t:004")==5);
+    mu_assert("LowerBound hash missing",TestYLowerBound("t:0041")==5);
+
+    sum[0]=0; sum[1]=INT_MAX;
+    mu_assert("Range count",TestXRange(10,20,rangeSum,sum)==6);
+    mu_assert("Range values",sum[0]==10+12+14+16+18+20);
+    sum[0]=0;
+    mu_assert("Range missing bounds",TestXRange(9,21,rangeSum,sum)==6);
+    mu_assert("Range missing values",sum[0]==10+12+14+16+18+20);
+    sum[0]=0;
+    mu_assert("Range empty",TestXRange(21,21,rangeSum,sum)==0);
+    mu_assert("Range empty values",sum[0]==0);
+    sum[0]=0; sum[1]=30;
+    mu_assert("Range stop",TestXRange(10,20,rangeSum,sum)==3);
+    sum[0]=0; sum[1]=INT_MAX;
+    mu_assert("Range hash",TestYRange("t:003","t:005",rangeSum,sum)==3);
+    mu_assert("Range hash values",sum[0]==3+4+5);
+
+    TestXFree();
+    TestYFree();
+    mu_assert("Range free list",TestXRange(0,200,rangeSum,sum)==0);
+    mu_assert("LowerBound free list",TestXLowerBound(10)==0);
+    return 0;
+}
+
+DEFINE_HASH(TestZ,int);
+/** Test for PrefixScan */
+static char *testHashPrefix()
+{
+    char *keys[]={"tenant4/a","tenant41/a","tenant42","tenant42/a","tenant42/b",
+        "tenant42/c/d","tenant42\x7f","tenant43/a","tenant5"};
+    int sum[2];
+    int i;
+
+    for (i=0;i<sizeof(keys)/sizeof(keys[0]);i++) {
+        mu_assert("Set prefix key",TestZSet(keys[i],1<<i));
+    }
+    sum[0]=0; sum[1]=INT_MAX;
+    mu_assert("PrefixScan count",TestZPrefixScan("tenant42/",rangeSum,sum)==3);
+    mu_assert("PrefixScan keys",sum[0]==((1<<3)|(1<<4)|(1<<5)));
+    sum[0]=0;
+    mu_assert("PrefixScan short",TestZPrefixScan("tenant42",rangeSum,sum)==5);
+    mu_assert("PrefixScan short keys",sum[0]==(0x7c));
+    sum[0]=0;
+    mu_assert("PrefixScan all",TestZPrefixScan("",rangeSum,sum)==TestZCount());
+    sum[0]=0;
+    mu_assert("PrefixScan none",TestZPrefixScan("tenant6",rangeSum,sum)==0);
+    mu_assert("PrefixScan none",TestZPrefixScan("a",rangeSum,sum)==0);
+    mu_assert("PrefixScan none keys",sum[0]==0);
+    sum[0]=0; sum[1]=1<<4;
+    mu_assert("PrefixScan stop",TestZPrefixScan("tenant42/",rangeSum,sum)==2);
+
+    TestZFree();
+    mu_assert("PrefixScan free",TestZPrefixScan("",rangeSum,sum)==0);
+    return 0;
+}
+
+DEFINE_LIST(TestVis,int,test_fields_t);
+/** Read one field in place, recording the value address */
+static bool visitField(const void *key,test_fields_t *value,void *ctx)
+{
+    void **out=ctx;
+    out[0]=value;
+    *(int *)out[1]=value->ifield;
+    return value->bfield;
+}
+/** Test for Visit */
+static char *testHashVisit()
+{
+    test_fields_t val={.ifield=0,.bfield=true,.ffield=0};
+    void *out[2];
+    int field=0;
+    int i;
+
+    for (i=0;i<10;i++) {
+        val.ifield=i*10;
+        val.bfield=(i&1);
+        mu_assert("Set visit key",TestVisSet(i,val));
+    }
+    out[1]=&field;
+    mu_assert("Visit return",TestVisVisit(3,visitField,out));
+    mu_assert("Visit field",field==30);
+    mu_assert("Visit in place",out[0]==TestVisPtr(3));
+    mu_assert("Visit callback return",!TestVisVisit(4,visitField,out));
+    mu_assert("Visit field",field==40);
+    field=-1;
+    mu_assert("Visit missing",!TestVisVisit(11,visitField,out));
+    mu_assert("Visit missing field",field==-1);
+    TestVisFree();
+    return 0;
+}
+
+DEFINE_LIST(TestCnt,int,long);
+typedef struct {int32_t lo; int32_t hi;} test_pair_t;
+DEFINE_LIST(TestPair,int,test_pair_t);
+/** Add the amount in ctx, leaving the value unchanged for 0 */
+static bool updateAdd(const void *key,long *value,void *ctx)
+{
+    long add=*(long *)ctx;
+    *value+=add;
+    return (add!=0);
+}
+/** Increment a counter from several threads */
+static void *updateThread(void *parm)
+{
+    long one=1;
+    int i;
+    for (i=0;i<1000;i++) TestCntUpdate(7,updateAdd,&one);
+    return NULL;
+}
+/** Test for Update and CompareAndSet */
+static char *testHashUpdate()
+{
+    pthread_t threads[4];
+    test_pair_t a={1,2},b={1,3},c={4,5},v;
+    long add=5;
+    int i;
+
+    mu_assert("Update insert",TestCntUpdate(1,updateAdd,&add));
+    mu_assert("Update insert value",TestCntVal(1)==5);
+    mu_assert("Update existing",TestCntUpdate(1,updateAdd,&add));
+    mu_assert("Update existing value",TestCntVal(1)==10);
+    add=0;
+    mu_assert("Update unchanged",!TestCntUpdate(1,updateAdd,&add));
+    mu_assert("Update unchanged insert",!TestCntUpdate(2,updateAdd,&add));
+    mu_assert("Update unchanged not inserted",!TestCntHasKey(2));
+
+    mu_assert("CompareAndSet match",TestCntCompareAndSet(1,10,20));
+    mu_assert("CompareAndSet value",TestCntVal(1)==20);
+    mu_assert("CompareAndSet differs",!TestCntCompareAndSet(1,10,30));
+    mu_assert("CompareAndSet unchanged",TestCntVal(1)==20);
+    mu_assert("CompareAndSet missing",!TestCntCompareAndSet(3,0,1));
+    mu_assert("CompareAndSet not inserted",!TestCntHasKey(3));
+
+    /* Structures without padding compare by their members */
+    mu_assert("Set pair",TestPairSet(1,a));
+    mu_assert("CompareAndSet pair differs",!TestPairCompareAndSet(1,b,c));
+    mu_assert("CompareAndSet pair match",TestPairCompareAndSet(1,a,c));
+    mu_assert("CompareAndSet pair value",TestPairGet(1,&v)&&(v.lo==4)&&(v.hi==5));
+
+    /* No increments are lost between threads */
+    for (i=0;i<4;i++) pthread_create(&threads[i],NULL,updateThread,NULL);
+    for (i=0;i<4;i++) pthread_join(threads[i],NULL);
+    mu_assert("Update threads",TestCntVal(7)==4000);
+
+    TestCntFree();
+    TestPairFree();
+    return 0;
+}
+
+DEFINE_LIST(TestGM,int,int);
+DEFINE_HASH(TestGH,int);
+/** Test for GetMany */
+static char *testHashGetMany()
+{
+    static int keys[1000];
+    static int vals[1000];
+    static bool found[1000];
+    char *hkeys[]={"b","zz","a","b","c"};
+    int hvals[5];
+    int count=0;
+    int i;
+
+    for (i=0;i<10000;i+=2) mu_assert("Set many key",TestGMSet(i,-i));
+    /* Unsorted probes, half missing, with repeats */
+    srand(7);
+    for (i=0;i<1000;i++) keys[i]=rand()%10000;
+    keys[999]=keys[0];
+    for (i=0;i<1000;i++) {
+        vals[i]=1;
+        if (!(keys[i]&1)) count++;
+    }
+    mu_assert("GetMany count",TestGMGetMany(keys,1000,vals,found)==count);
+    for (i=0;i<1000;i++) {
+        mu_assert("GetMany found",found[i]==TestGMHasKey(keys[i]));
+        mu_assert("GetMany value",(found[i]) ? (vals[i]==-keys[i]) : (vals[i]==1));
+    }
+    /* Probes already in list order */
+    for (i=0;i<1000;i++) keys[i]=TestGMKeys(i*5);
+    mu_assert("GetMany sorted",TestGMGetMany(keys,1000,vals,NULL)==1000);
+    for (i=0;i<1000;i++) mu_assert("GetMany sorted value",vals[i]==-keys[i]);
+    mu_assert("GetMany none",TestGMGetMany(keys,0,vals,found)==0);
+
+    mu_assert("Set many key",TestGHSet("a",1));
+    mu_assert("Set many key",TestGHSet("b",2));
+    mu_assert("Set many key",TestGHSet("c",3));
+    mu_assert("GetMany hash",TestGHGetMany(hkeys,5,hvals,found)==4);
+    mu_assert("GetMany hash found",found[0]&&!found[1]&&found[2]&&found[3]&&found[4]);
+    mu_assert("GetMany hash value",(hvals[0]==2)&&(hvals[2]==1)&&(hvals[3]==2)&&(hvals[4]==3));
+
+    TestGMFree();
+    TestGHFree();
+    mu_assert("GetMany free",TestGMGetMany(keys,1000,vals,found)==0);
+    return 0;
+}
+
+/** Check each wheel key fires at its tick */
+static void wheelFire(void *key,uint32_t expire,void *ctx)
+{
+    uint32_t *now=ctx;
+    if ((*(uint32_t *)key!=expire)||((int32_t)(expire-now[0])>0)||
+            ((int32_t)(expire-now[1])<=0)) now[2]++;
+    now[3]++;
+}
+DEFINE_LIST(TestTTL,int,int);
+/** Test for SetTTL and the timer wheel */
+static char *testHashTTL()
+{
+    wheel_t *wheel;
+    uint32_t now[4]={0};
+    uint32_t tick;
+    int i;
+
+    /* Keys on every level fire on their tick, not before or after */
+    wheel=wheel_init(100);
+    mu_assert("Wheel init",wheel);
+    srand(11);
+    for (i=0;i<5000;i++) {
+        uint32_t *key=malloc(sizeof(*key));
+        *key=100+((i&1) ? rand()%5000 : rand()%(1<<25));
+        mu_assert("Wheel add",wheel_add(wheel,key,*key));
+    }
+    now[1]=99;
+    for (tick=100;tick<5100;tick++) {
+        now[0]=tick;
+        while (wheel_advance(wheel,tick,wheelFire,now,64)==64);
+        now[1]=tick;
+    }
+    mu_assert("Wheel fired on tick",now[2]==0);
+    mu_assert("Wheel fired near keys",now[3]>=2500);
+    for (;tick<(1<<25)+100;tick+=4096) {
+        now[0]=tick;
+        while (wheel_advance(wheel,tick,wheelFire,now,64)==64);
+        now[1]=tick;
+    }
+    now[0]=tick;
+    while (wheel_advance(wheel,tick,wheelFire,now,64)==64);
+    mu_assert("Wheel fired all keys",now[3]==5000);
+    mu_assert("Wheel empty",!wheel_next(wheel,&tick));
+    wheel_free(wheel);
+
+    /* The next tick is the first key, or the wrap that cascades later ones */
+    wheel=wheel_init(100);
+    mu_assert("Wheel init",wheel);
+    for (i=0;i<2;i++) {
+        uint32_t *key=malloc(sizeof(*key));
+        *key=(i) ? 110 : 5000;
+        mu_assert("Wheel add",wheel_add(wheel,key,*key));
+    }
+    mu_assert("Wheel next key",wheel_next(wheel,&tick)&&(tick==110));
+    now[0]=110;
+    mu_assert("Wheel next fired",wheel_advance(wheel,110,wheelFire,now,64)==1);
+    mu_assert("Wheel next wrap",wheel_next(wheel,&tick)&&(tick==128));
+    wheel_free(wheel);
+
+    for (i=0;i<100;i++) {
+        mu_assert("SetTTL short",TestTTLSetTTL(i,i,30));
+        mu_assert("SetTTL long",TestTTLSetTTL(i+100,i,10000));
+    }
+    mu_assert("SetTTL then Set",TestTTLSetTTL(200,1,30));
+    mu_assert("Set keeps",TestTTLSet(200,2));
+    mu_assert("SetTTL refresh",TestTTLSetTTL(201,1,30));
+    mu_assert("SetTTL refresh",TestTTLSetTTL(201,2,2000));
+    mu_assert("SetTTL none",TestTTLSetTTL(202,1,0));
+    mu_assert("SetTTL extend",TestTTLSetTTL(203,1,30));
+    mu_assert("SetTTL extend",TestTTLSetTTL(203,2,200));
+    mu_assert("SetTTL after Set",TestTTLSetTTL(204,1,2000));
+    mu_assert("SetTTL after Set",TestTTLSet(204,2));
+    mu_assert("SetTTL after Set",TestTTLSetTTL(204,3,30));
+    mu_assert("SetTTL shorten",TestTTLSetTTL(205,1,2000));
+    mu_assert("SetTTL shorten",TestTTLSetTTL(205,2,30));
+    mu_assert("SetTTL count",TestTTLCount()==206);
+    mu_assert("SetTTL get",TestTTLVal(5)==5);
+
+    /* The reaper deletes the short entries */
+    for (i=0;(i<100)&&(TestTTLCount()!=104);i++) usleep(5000);
+    mu_assert("SetTTL expired",TestTTLCount()==104);
+    mu_assert("SetTTL expired key",!TestTTLHasKey(5));
+    mu_assert("SetTTL long kept",TestTTLVal(105)==5);
+    mu_assert("Set cleared expiry",TestTTLVal(200)==2);
+    mu_assert("SetTTL refreshed",TestTTLVal(201)==2);
+    mu_assert("SetTTL no expiry",TestTTLVal(202)==1);
+    mu_assert("SetTTL extended kept",TestTTLVal(203)==2);
+    /* The extended entry's timer moved to its new tick */
+    for (i=0;(i<100)&&(TestTTLCount()!=103);i++) usleep(5000);
+    mu_assert("SetTTL extended expired",TestTTLCount()==103);
+
+    TestTTLFree();
+    mu_assert("SetTTL after free",TestTTLSetTTL(1,1,10));
+    TestTTLFree();
+    return 0;
+}
+
+DEFINE_LIST(TestCache,int,int);
+DEFINE_HASH(TestCacheH,int);
+/** Test for the CLOCK cache mode */
+static char *testHashCache()
+{
+    char key[16];
+    int val;
+    int i;
+
+    mu_assert("Cache",TestCacheCache(100,0));
+    for (i=0;i<100;i++) mu_assert("Cache set",TestCacheSet(i,i));
+    /* Read entries are passed over by the hand */
+    for (i=0;i<50;i++) mu_assert("Cache get",TestCacheGet(i,&val));
+    for (i=100;i<150;i++) mu_assert("Cache set",TestCacheSet(i,i));
+    mu_assert("Cache count",TestCacheCount()==100);
+    for (i=0;i<50;i++) mu_assert("Cache kept read",TestCacheHasKey(i));
+    for (i=50;i<100;i++) mu_assert("Cache evicted",!TestCacheHasKey(i));
+    for (i=100;i<150;i++) mu_assert("Cache kept new",TestCacheHasKey(i));
+    mu_assert("Cache not shared",!TestCacheNetStart(6513));
+    mu_assert("Cache shrink",TestCacheCache(10,0));
+    mu_assert("Cache shrink count",TestCacheCount()==10);
+    TestCacheFree();
+    for (i=0;i<200;i++) mu_assert("Set after free",TestCacheSet(i,i));
+    mu_assert("Free clears limit",TestCacheCount()==200);
+    TestCacheFree();
+
+    /* Each entry is a list slot, a key of 6 bytes and an int */
+    mu_assert("Cache bytes",TestCacheHCache(0,50*(sizeof(_entry_t)+6+sizeof(int))));
+    for (i=0;i<200;i++) {
+        sprintf(key,"k%04d",i);
+        mu_assert("Cache set",TestCacheHSet(key,i));
+    }
+    mu_assert("Cache bytes count",TestCacheHCount()==50);
+    mu_assert("Cache bytes newest",TestCacheHVal("k0199")==199);
+    TestCacheHFree();
+    return 0;
+}
+
 DEFINE_LIST(Test3,int,test_fields_t);
 DECLARE_LIST(Test4);
 DEFINE_LIST_ITERATOR(Test3,int,ifield)
@@ -793,6 +1157,106 @@ static char *testHashLoad()
     return 0;
 }
 
+/** Test for delta snapshots and compaction */
+static char *testHashDelta()
+{
+    TK1 key1;
+    TK2 key2=buf;
+    TV1 result1;
+    TV2 result2;
+    char *deltas1[]={"/tmp/test1.d1","/tmp/test1.d2"};
+    char *deltas2[]={"/tmp/test2.d1","/tmp/test2.d2"};
+    int pass;
+
+    /* Note uses values from previous case */
+    mu_assert("Existing key1",!testHashSet());
+    Test1Free();
+    Test2Free();
+    mu_assert("Delta without base",!Test1SaveDelta("/tmp/test1.d1"));
+    mu_assert("Existing key1",!testHashSet());
+
+    Test1DeltaTrack(true);
+    Test2DeltaTrack(true);
+    mu_assert("Save Test 1",Test1Save("/tmp/test1.hash"));
+    mu_assert("Save Test 2",Test2.save("/tmp/test2.hash"));
+
+    /* First delta: update, delete and add */
+    key1=2; key2=key1Tokey2(key1);
+    mu_assert("Set Value",Test1Set(key1,20));
+    mu_assert("Set Value",Test2Set(key2,20));
+    key1=3; key2=key1Tokey2(key1);
+    mu_assert("Delete key",Test1Del(key1));
+    mu_assert("Delete key",Test2Del(key2));
+    key1=7; key2=key1Tokey2(key1);
+    mu_assert("Set Value",Test1Set(key1,7));
+    mu_assert("Set Value",Test2Set(key2,7));
+    mu_assert("Save Delta 1",Test1SaveDelta(deltas1[0]));
+    mu_assert("Save Delta 2",Test2.saveDelta(deltas2[0]));
+
+    /* Second delta: delete the added key and re-add a deleted one */
+    key1=7; key2=key1Tokey2(key1);
+    mu_assert("Delete key",Test1Del(key1));
+    mu_assert("Delete key",Test2Del(key2));
+    key1=3; key2=key1Tokey2(key1);
+    mu_assert("Set Value",Test1Set(key1,30));
+    mu_assert("Set Value",Test2Set(key2,30));
+    mu_assert("Save Delta 1",Test1SaveDelta(deltas1[1]));
+    mu_assert("Save Delta 2",Test2.saveDelta(deltas2[1]));
+    mu_assert("Delta type check",!Test1Load(deltas1[1]));
+
+    /* Rebuild from base and deltas, then from the compacted file */
+    mu_assert("Compact 1",Test1Compact("/tmp/test1.full","/tmp/test1.hash",deltas1,2));
+    mu_assert("Compact 2",Test2.compact("/tmp/test2.full","/tmp/test2.hash",deltas2,2));
+    for (pass=0;pass<2;pass++) {
+        Test1Free();
+        Test2Free();
+        if (pass==0) {
+            mu_assert("Load Test 1",Test1Load("/tmp/test1.hash"));
+            mu_assert("Load Test 2",Test2Load("/tmp/test2.hash"));
+            mu_assert("Load Delta 1",Test1LoadDelta(deltas1[0]));
+            mu_assert("Load Delta 2",Test2.loadDelta(deltas2[0]));
+            mu_assert("Load Delta 1",Test1LoadDelta(deltas1[1]));
+            mu_assert("Load Delta 2",Test2.loadDelta(deltas2[1]));
+        } else {
+            mu_assert("Load Test 1",Test1Load("/tmp/test1.full"));
+            mu_assert("Load Test 2",Test2Load("/tmp/test2.full"));
+        }
+        mu_assert("Delta count",Test1Count()==g_count);
+        mu_assert("Delta count",Test2Count()==g_count);
+        for (key1=1;key1<=g_count;key1++) {
+            TV1 expect1=key2value(key1);
+            if (key1==2) expect1=20;
+            if (key1==3) expect1=30;
+            key2=key1Tokey2(key1);
+            mu_assert("Delta Get",Test1Get(key1,&result1));
+            mu_assert("Delta Value",result1==expect1);
+            mu_assert("Delta Get",Test2Get(key2,&result2));
+            mu_assert("Delta Value",result2==(TV2)expect1);
+        }
+        key1=7; key2=key1Tokey2(key1);
+        mu_assert("Deleted key",!Test1HasKey(key1));
+        mu_assert("Deleted key",!Test2HasKey(key2));
+    }
+
+    /* Untracked deletes after a Load keep no keys and end the base */
+    Test1DeltaTrack(false);
+    Test2DeltaTrack(false);
+    Test1Free();
+    mu_assert("Load Test 1",Test1Load("/tmp/test1.hash"));
+    for (key1=1;key1<=g_count;key1++) Test1Del(key1);
+    mu_assert("Untracked deletes",Test1_store.ndeleted==0);
+    mu_assert("Delta after untracked delete",!Test1SaveDelta(deltas1[0]));
+
+    unlink("/tmp/test1.hash");
+    unlink("/tmp/test2.hash");
+    unlink("/tmp/test1.full");
+    unlink("/tmp/test2.full");
+    unlink(deltas1[0]); unlink(deltas1[1]);
+    unlink(deltas2[0]); unlink(deltas2[1]);
+
+    return 0;
+}
+
 DEFINE_FIFO(Test5,TV1);
 DECLARE_LIST(Test6);
 /** Test for Fifo */
@@ -870,6 +1334,65 @@ static char *testFifo()
     return 0;
 }
 
+DEFINE_PQUEUE(TestPQ,int,int);
+/** Test for the priority queue */
+static char *testPQueue()
+{
+    int handles[500];
+    int prio,val,last;
+    int i;
+
+    mu_assert("Empty pop",!TestPQPopMin(&prio,&val));
+    srand(7);
+    for (i=0;i<500;i++) {
+        handles[i]=TestPQPush(rand()%1000+1000,i);
+        mu_assert("Push",handles[i]>=0);
+    }
+    mu_assert("Push count",TestPQCount()==500);
+
+    /* Lower some values below all others, raise is refused */
+    mu_assert("Decrease",TestPQDecreaseKey(handles[42],5));
+    mu_assert("Decrease",TestPQ.decreaseKey(handles[7],3));
+    mu_assert("Increase refused",!TestPQDecreaseKey(handles[8],5000));
+    mu_assert("Remove",TestPQRemove(handles[9],&val));
+    mu_assert("Remove value",val==9);
+    mu_assert("Remove again",!TestPQRemove(handles[9],NULL));
+    mu_assert("Remove count",TestPQCount()==499);
+    mu_assert("Min",TestPQMin(&prio,&val));
+    mu_assert("Min value",(prio==3)&&(val==7));
+    mu_assert("Min keeps",TestPQCount()==499);
+
+    mu_assert("Save",TestPQ.save("/tmp/test.pq"));
+    mu_assert("Pop",TestPQPopMin(&prio,&val)&&(val==7));
+    mu_assert("Pop",TestPQ.popMin(&prio,&val)&&(val==42));
+    mu_assert("Handle freed",!TestPQDecreaseKey(handles[42],1));
+    for (last=prio;TestPQPopMin(&prio,NULL);last=prio) {
+        mu_assert("Pop order",prio>=last);
+    }
+    mu_assert("Pop empty",TestPQCount()==0);
+
+    /* Load pushes the saved values with new handles */
+    mu_assert("Load",TestPQLoad("/tmp/test.pq"));
+    mu_assert("Load count",TestPQ.count()==499);
+    mu_assert("Load min",TestPQMin(&prio,&val)&&(prio==3)&&(val==7));
+    for (last=0,i=0;TestPQPopMin(&prio,&val);last=prio,i++) {
+        mu_assert("Load order",prio>=last);
+        mu_assert("Load removed",val!=9);
+    }
+    mu_assert("Load popped",i==499);
+    unlink("/tmp/test.pq");
+
+    /* Handles are reused once free */
+    mu_assert("Reuse",TestPQPush(1,1)>=0);
+    mu_assert("Reuse",TestPQPush(2,2)>=0);
+    mu_assert("Reuse count",TestPQCount()==2);
+    mu_assert("Free",TestPQ.free());
+    mu_assert("Free count",TestPQCount()==0);
+    mu_assert("Push after free",TestPQPush(1,1)==0);
+    TestPQFree();
+    return 0;
+}
+
 /** Test for Free list */
 static char *testHashFree()
 {
@@ -947,8 +1470,8 @@ static char * testNetShare(void)
     mu_assert("Count increase",TestDCount()==(int) 0);
 
     TestDNetStart(netPort);
+    mu_assert("Join sync",TestDNetSync(2000));
 
-    sleep(1);
     key1=3;    expect1=key2value(key1);
     keyB=key1; expectB=key2value(keyB);
     ret=Test1Set(key1,expect1); mu_assert("Set Value",ret); usleep(10000);
@@ -1062,6 +1585,23 @@ static char * testNetShare(void)
 #endif
 
 
+    /* Burst of updates is batched into multi-record packets */
+    for (key1=1000;key1<1200;key1++) {
+        ret=Test1Set(key1,key2value(key1)); mu_assert("Set Value",ret);
+    }
+    usleep(10000);
+    mu_assert("Burst count",TestBCount()==g_count+200);
+    mu_assert("Burst count",TestCCount()==g_count+200);
+    mu_assert("Burst count",TestDCount()==g_count+200);
+    mu_assert("Burst value",TestDVal(1199)==key2value(1199));
+    for (key1=1000;key1<1200;key1++) {
+        ret=TestCDel(key1); mu_assert("Delete Value",ret);
+    }
+    usleep(10000);
+    mu_assert("Burst delete",Test1Count()==g_count);
+    mu_assert("Burst delete",TestBCount()==g_count);
+    mu_assert("Burst delete",TestDCount()==g_count);
+
     Test1Free();
     TestBFree();
     TestCFree();
@@ -1117,6 +1657,494 @@ static char * testNetShare(void)
 }
 
 
+/* Test bulk sync of a joining node */
+DEFINE_LIST(TestE,int,int);
+DEFINE_LIST(TestF,int,int);
+static char * testNetSync(void)
+{
+    int i;
+    int max=MAXSIZE*25;
+    int netPort=6502;
+
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestESet(i,i*3));
+    }
+    mu_assert("Net Start",TestENetStart(netPort));
+    mu_assert("Sync alone",TestENetSync(1000));
+
+    usecelapsed();
+    mu_assert("Net Start",TestFNetStart(netPort));
+    mu_assert("Join sync",TestFNetSync(5000));
+    PRINT("Sync count: %d time: %0.6lf seconds\n",TestFCount(),((double) usecelapsed())/1000000.0);
+    mu_assert("Sync count",TestFCount()==max);
+    for (i=0;i<max;i+=max/100) {
+        mu_assert("Sync value",TestFVal(i)==i*3);
+    }
+
+    TestEFree();
+    TestFFree();
+    return 0;
+}
+
+/* Test recovery of lost packets */
+DEFINE_LIST(TestG,int,int);
+DEFINE_LIST(TestH,int,int);
+static char * testNetLoss(void)
+{
+    int i;
+    int max=MAXSIZE*2;
+    int netPort=6503;
+
+    mu_assert("Net Start",TestGNetStart(netPort));
+    mu_assert("Net Start",TestHNetStart(netPort));
+    mu_assert("Sync alone",TestGNetSync(1000));
+    mu_assert("Sync alone",TestHNetSync(1000));
+
+    /* Lose every 5th batch, NACKs must fill the gaps in order */
+    repl_test_drop=5;
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestGSet(i,i));
+        if ((i%100)==0) usleep(1000);
+    }
+    for (i=0;i<max;i+=2) {
+        mu_assert("Set Value",TestGSet(i,i*7));
+    }
+    for (i=0;i<max;i+=10) {
+        mu_assert("Del Value",TestGDel(i));
+    }
+    for (i=0;(i<200)&&(TestHCount()!=TestGCount());i++) usleep(10000);
+    usleep(50000);
+    repl_test_drop=0;
+
+    mu_assert("Count match",TestHCount()==TestGCount());
+    for (i=0;i<max;i++) {
+        int val;
+        bool has=TestHGet(i,&val);
+        if ((i%10)==0) {
+            mu_assert("Deleted",!has);
+        } else {
+            mu_assert("Value",has&&(val==(((i%2)==0)?i*7:i)));
+        }
+    }
+
+    TestGFree();
+    TestHFree();
+    return 0;
+}
+
+/* Test digest reconciliation of a node that diverged */
+DEFINE_LIST(TestI,int,int);
+DEFINE_LIST(TestJ,int,int);
+static char * testNetDigest(void)
+{
+    int i;
+    int max=MAXSIZE;
+    int netPort=6504;
+
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestISet(i,i));
+        mu_assert("Set Value",TestJSet(i,i));
+    }
+    /* Changed, missing and extra entries on the joining node */
+    for (i=0;i<max;i+=100) {
+        mu_assert("Set Value",TestJSet(i,-i));
+        mu_assert("Del Value",TestJDel(i+1));
+        mu_assert("Set Value",TestJSet(max+i,i));
+    }
+
+    mu_assert("Net Start",TestINetStart(netPort));
+    mu_assert("Sync alone",TestINetSync(1000));
+    mu_assert("Net Start",TestJNetStart(netPort));
+    mu_assert("Join sync",TestJNetSync(5000));
+
+    mu_assert("Count match",TestJCount()==max);
+    for (i=0;i<max;i++) {
+        mu_assert("Value",TestJVal(i)==i);
+    }
+    mu_assert("Extra removed",!TestJHasKey(max));
+
+    TestIFree();
+    TestJFree();
+    return 0;
+}
+
+/* Test a repair pull after lost packets keeps writes the peer lacks */
+DEFINE_LIST(TestR1,int,int);
+DEFINE_LIST(TestR2,int,int);
+static char * testNetRepair(void)
+{
+    int i;
+    int max=MAXSIZE*50;
+    int netPort=6514;
+
+    mu_assert("Net Start",TestR1NetStart(netPort));
+    mu_assert("Net Start",TestR2NetStart(netPort));
+    mu_assert("Sync alone",TestR1NetSync(1000));
+    mu_assert("Sync alone",TestR2NetSync(1000));
+    mu_assert("Set Value",TestR1Set(max+1,1));
+    for (i=0;(i<200)&&(!TestR2HasKey(max+1));i++) usleep(5000);
+    mu_assert("Set received",TestR2HasKey(max+1));
+
+    /* Lose every batch, the gaps outlast the retransmit history */
+    repl_test_drop=1;
+    mu_assert("Set Value",TestR2Set(max+2,2));
+    usleep(2*200000);
+    mu_assert("Del Value",TestR1Del(max+1));
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestR1Set(i,i));
+    }
+    repl_test_drop=0;
+
+    /* The pull brings the table and the delete, the local write stays */
+    for (i=0;(i<1000)&&(TestR2Count()!=max+1);i++) usleep(10000);
+    mu_assert("Local write kept",TestR2HasKey(max+2));
+    mu_assert("Delete pulled",!TestR2HasKey(max+1));
+    mu_assert("Count match",TestR2Count()==max+1);
+    for (i=0;i<max;i+=max/100) {
+        mu_assert("Value",TestR2Val(i)==i);
+    }
+
+    TestR1Free();
+    TestR2Free();
+    return 0;
+}
+
+/* Test collapsing of hot key updates */
+DEFINE_LIST(TestK,int,int);
+DEFINE_LIST(TestL,int,int);
+static char * testNetCoalesce(void)
+{
+    int i;
+    int netPort=6505;
+
+    mu_assert("Coalesce before start",!TestKNetCoalesce(20));
+    mu_assert("Net Start",TestKNetStart(netPort));
+    mu_assert("Net Start",TestLNetStart(netPort));
+    mu_assert("Sync alone",TestKNetSync(1000));
+    mu_assert("Sync alone",TestLNetSync(1000));
+    mu_assert("Coalesce",TestKNetCoalesce(20));
+
+    for (i=0;i<MAXSIZE;i++) {
+        mu_assert("Set Value",TestKSet(1,i));
+        mu_assert("Set Value",TestKSet(2,-i));
+    }
+    /* Deleted in the window, only the delete is sent */
+    mu_assert("Set Value",TestKSet(3,3));
+    mu_assert("Del Value",TestKDel(3));
+    for (i=0;(i<100)&&(TestLVal(1)!=MAXSIZE-1);i++) usleep(5000);
+    usleep(50000);
+
+    mu_assert("Latest value",TestLVal(1)==MAXSIZE-1);
+    mu_assert("Latest value",TestLVal(2)==-(MAXSIZE-1));
+    mu_assert("Deleted",!TestLHasKey(3));
+    mu_assert("Count match",TestLCount()==2);
+
+    TestKFree();
+    TestLFree();
+    return 0;
+}
+
+/* Test replicas receiving only key ranges */
+DEFINE_HASH(TestM,int);
+DEFINE_HASH(TestN,int);
+static char * testNetFilter(void)
+{
+    char key[HASH_MAX_STR];
+    int i;
+    int netPort=6506;
+
+    for (i=0;i<500;i++) {
+        sprintf(key,"a%04d",i);
+        mu_assert("Set Value",TestMSet(key,i));
+        sprintf(key,"b%04d",i);
+        mu_assert("Set Value",TestMSet(key,i));
+    }
+    /* Outside the ranges is kept, inside is reconciled */
+    mu_assert("Set Value",TestNSet("a9999",7));
+    mu_assert("Set Value",TestNSet("b0150",-1));
+    mu_assert("Set Value",TestNSet("b0150x",-1));
+
+    mu_assert("Filter",TestNNetFilter("b0100","b0199"));
+    mu_assert("Filter",TestNNetFilter("b0400","b0449"));
+    mu_assert("Net Start",TestMNetStart(netPort));
+    mu_assert("Sync alone",TestMNetSync(1000));
+    mu_assert("Net Start",TestNNetStart(netPort));
+    mu_assert("Filter after start",!TestNNetFilter("c","d"));
+    mu_assert("Join sync",TestNNetSync(5000));
+
+    mu_assert("Count match",TestNCount()==151);
+    for (i=100;i<200;i++) {
+        sprintf(key,"b%04d",i);
+        mu_assert("Value",TestNVal(key)==i);
+    }
+    mu_assert("Second range",TestNVal("b0449")==449);
+    mu_assert("Outside range",!TestNHasKey("b0450"));
+    mu_assert("Outside range",!TestNHasKey("a0100"));
+    mu_assert("Local kept",TestNVal("a9999")==7);
+    mu_assert("Extra removed",!TestNHasKey("b0150x"));
+
+    mu_assert("Set Value",TestMSet("a0001",-5));
+    mu_assert("Del Value",TestMDel("b0101"));
+    mu_assert("Set Value",TestMSet("b0120",-5));
+    for (i=0;(i<100)&&(TestNVal("b0120")!=-5);i++) usleep(5000);
+    mu_assert("Update received",TestNVal("b0120")==-5);
+    mu_assert("Delete received",!TestNHasKey("b0101"));
+    mu_assert("Update dropped",!TestNHasKey("a0001"));
+
+    TestMFree();
+    TestNFree();
+    return 0;
+}
+
+/* Test replication through shared memory */
+DEFINE_LIST(TestO,int,int);
+DEFINE_LIST(TestP,int,int);
+static char * testNetLocal(void)
+{
+    int i;
+    int max=MAXSIZE;
+    int netPort=6507;
+
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestOSet(i,i));
+    }
+    mu_assert("Net Start",TestONetStartLocal(netPort));
+    mu_assert("Sync alone",TestONetSync(1000));
+    mu_assert("Net Start",TestPNetStartLocal(netPort));
+    mu_assert("Join sync",TestPNetSync(5000));
+    mu_assert("Count match",TestPCount()==max);
+
+    /* Updates are sent as they are made */
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestOSet(i,-i));
+    }
+    mu_assert("Del Value",TestODel(0));
+    for (i=0;(i<100)&&(TestPVal(max-1)!=-(max-1));i++) usleep(1000);
+    for (i=1;i<max;i++) {
+        mu_assert("Value",TestPVal(i)==-i);
+    }
+    mu_assert("Deleted",!TestPHasKey(0));
+
+    TestOFree();
+    TestPFree();
+    return 0;
+}
+
+/* Test a partitioned store keeping each key on two of three nodes */
+DEFINE_LIST(TestQ,int,int);
+DEFINE_LIST(TestR,int,int);
+DEFINE_LIST(TestS,int,int);
+static char * testNetPartition(void)
+{
+    int i,v;
+    int max=300;
+    int netPort=6508;
+
+    mu_assert("Partition",TestQNetPartition(2));
+    mu_assert("Partition",TestRNetPartition(2));
+    mu_assert("Partition",TestSNetPartition(2));
+    mu_assert("Replicas range",!TestSNetPartition(0));
+    mu_assert("Net Start",TestQNetStart(netPort));
+    mu_assert("Net Start",TestRNetStart(netPort));
+    mu_assert("Net Start",TestSNetStart(netPort));
+    mu_assert("Partition after start",!TestSNetPartition(2));
+    mu_assert("Sync",TestQNetSync(1000));
+    mu_assert("Sync",TestRNetSync(1000));
+    mu_assert("Sync",TestSNetSync(1000));
+    usleep(100000);
+
+    /* Keys written anywhere end up on two owners */
+    for (i=0;i<max;i++) {
+        mu_assert("Set Value",TestQSet(i,i));
+    }
+    for (i=0;(i<200)&&(TestQCount()+TestRCount()+TestSCount()!=2*max);i++) {
+        usleep(5000);
+    }
+    mu_assert("Two owners",TestQCount()+TestRCount()+TestSCount()==2*max);
+    mu_assert("Partitioned",TestQCount()<max);
+    mu_assert("Partitioned",TestRCount()<max);
+    mu_assert("Partitioned",TestSCount()<max);
+
+    /* A get on a node without the key goes to an owner */
+    for (i=0;i<max;i++) {
+        mu_assert("Forwarded get",TestSGet(i,&v)&&(v==i));
+    }
+    mu_assert("Missing key",!TestSGet(max,&v));
+
+    /* Only the owners of a key change it */
+    for (i=0;(i<max)&&(TestSHasKey(i));i++);
+    mu_assert("Key not owned",i<max);
+    mu_assert("CompareAndSet not owned",!TestSCompareAndSet(i,i,-1));
+    mu_assert("Value kept",TestSGet(i,&v)&&(v==i));
+    mu_assert("CompareAndSet owned",TestQCompareAndSet(i,i,i));
+
+    /* The remaining owners copy the keys of a leaving node */
+    TestSFree();
+    for (i=0;(i<400)&&(TestQCount()+TestRCount()!=2*max);i++) usleep(5000);
+    mu_assert("Leave rebalance",(TestQCount()==max)&&(TestRCount()==max));
+
+    /* A joining node receives its keys and the others drop them */
+    mu_assert("Partition",TestSNetPartition(2));
+    mu_assert("Net Start",TestSNetStart(netPort));
+    for (i=0;(i<400)&&((TestSCount()==0)||
+                (TestQCount()+TestRCount()+TestSCount()!=2*max));i++) {
+        usleep(5000);
+    }
+    mu_assert("Join rebalance",TestQCount()+TestRCount()+TestSCount()==2*max);
+    mu_assert("Join rebalance",(TestSCount()>0)&&(TestQCount()<max));
+    for (i=0;i<max;i++) {
+        mu_assert("Value",TestRGet(i,&v)&&(v==i));
+    }
+
+    TestQFree();
+    TestRFree();
+    TestSFree();
+    return 0;
+}
+
+/* Test a paced sender */
+typedef struct {int id; char fill[252];} test_block_t;
+DEFINE_LIST(TestT,int,test_block_t);
+DEFINE_LIST(TestU,int,test_block_t);
+static char * testNetPace(void)
+{
+    test_block_t blk;
+    struct timeval start,end;
+    long usec;
+    int i;
+    int max=2000;
+    int netPort=6509;
+
+    memset(&blk,0,sizeof(blk));
+    mu_assert("Pace before start",!TestTNetPace(1000000,16*1024));
+    mu_assert("Net Start",TestTNetStart(netPort));
+    mu_assert("Net Start",TestUNetStart(netPort));
+    mu_assert("Sync",TestUNetSync(1000));
+    mu_assert("Pace",TestTNetPace(1000000,16*1024));
+
+    /* About 520KB, more than the send queue, at 1MB/s */
+    gettimeofday(&start,NULL);
+    for (i=0;i<max;i++) {
+        blk.id=i;
+        mu_assert("Set Value",TestTSet(i,blk));
+    }
+    for (i=0;(i<400)&&(TestUCount()!=max);i++) usleep(5000);
+    gettimeofday(&end,NULL);
+    usec=(end.tv_sec-start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);
+
+    mu_assert("Count match",TestUCount()==max);
+    mu_assert("Paced",usec>=300000);
+    for (i=0;i<max;i++) {
+        mu_assert("Value",TestUGet(i,&blk)&&(blk.id==i));
+    }
+
+    TestTFree();
+    TestUFree();
+    return 0;
+}
+
+/* Test values larger than a packet and than 64KB */
+typedef struct {int id; char fill[100000]; int tail;} test_large_t;
+DEFINE_LIST(TestV,int,test_large_t);
+DEFINE_LIST(TestW,int,test_large_t);
+static char * testNetFrag(void)
+{
+    static test_large_t blk;
+    int i,j;
+    int max=20;
+    int netPort=6510;
+
+    for (i=0;i<max;i++) {
+        blk.id=i;
+        blk.tail=-i;
+        memset(blk.fill,i,sizeof(blk.fill));
+        mu_assert("Set Value",TestVSet(i,blk));
+    }
+    mu_assert("Net Start",TestVNetStart(netPort));
+    mu_assert("Sync alone",TestVNetSync(1000));
+    mu_assert("Net Start",TestWNetStart(netPort));
+    mu_assert("Join sync",TestWNetSync(5000));
+    mu_assert("Count match",TestWCount()==max);
+    for (i=0;i<max;i++) {
+        mu_assert("Get",TestWGet(i,&blk));
+        mu_assert("Value",(blk.id==i)&&(blk.tail==-i)&&(blk.fill[99999]==i));
+    }
+
+    /* Lost fragments are retransmitted alone */
+    repl_test_drop=11;
+    for (i=0;i<3;i++) {
+        blk.id=i;
+        blk.tail=i+1000;
+        mu_assert("Set Value",TestVSet(i,blk));
+        for (j=0;(j<200)&&(TestWPtr(i)->tail!=i+1000);j++) usleep(5000);
+        mu_assert("Update received",TestWPtr(i)->tail==i+1000);
+    }
+    repl_test_drop=0;
+
+    TestVFree();
+    TestWFree();
+    return 0;
+}
+
+/* Test read-modify-write replication */
+DEFINE_LIST(TestX1,int,long);
+DEFINE_LIST(TestX2,int,long);
+static bool netAdd(const void *key,long *value,void *ctx)
+{
+    *value+=*(long *)ctx;
+    return true;
+}
+static char * testNetUpdate(void)
+{
+    long add=1;
+    int i;
+    int netPort=6511;
+
+    mu_assert("Net Start",TestX1NetStart(netPort));
+    mu_assert("Net Start",TestX2NetStart(netPort));
+    mu_assert("Join sync",TestX2NetSync(5000));
+    for (i=0;i<100;i++) {
+        mu_assert("Update",TestX1Update(5,netAdd,&add));
+    }
+    mu_assert("CompareAndSet",TestX1CompareAndSet(5,100,-1));
+    for (i=0;(i<100)&&(TestX2Val(5)!=-1);i++) usleep(5000);
+    mu_assert("CompareAndSet received",TestX2Val(5)==-1);
+    for (i=0;i<100;i++) {
+        mu_assert("Update",TestX2Update(6,netAdd,&add));
+    }
+    for (i=0;(i<100)&&(TestX1Val(6)!=100);i++) usleep(5000);
+    mu_assert("Update received",TestX1Val(6)==100);
+
+    TestX1Free();
+    TestX2Free();
+    return 0;
+}
+
+/* Test expiry replication */
+DEFINE_LIST(TestX3,int,int);
+DEFINE_LIST(TestX4,int,int);
+static char * testNetTTL(void)
+{
+    int i;
+    int netPort=6512;
+
+    mu_assert("Net Start",TestX3NetStart(netPort));
+    mu_assert("Net Start",TestX4NetStart(netPort));
+    mu_assert("Join sync",TestX4NetSync(5000));
+    mu_assert("SetTTL",TestX3SetTTL(1,1,100));
+    mu_assert("Set",TestX3Set(2,2));
+    for (i=0;(i<100)&&(!TestX4HasKey(1));i++) usleep(5000);
+    mu_assert("SetTTL received",TestX4Val(1)==1);
+    for (i=0;(i<100)&&(TestX4HasKey(1));i++) usleep(5000);
+    mu_assert("Expiry received",!TestX4HasKey(1));
+    mu_assert("Expiry local",!TestX3HasKey(1));
+    mu_assert("Other kept",TestX4Val(2)==2);
+
+    TestX3Free();
+    TestX4Free();
+    return 0;
+}
+
 /* Test larger dataset */
 DEFINE_LIST(Test7,int,uint32_t);
 DEFINE_LIST(Test8,uint64_t,uint64_t);
@@ -1218,6 +2246,33 @@ static char * testLargeHash(void)
         mu_assert("Check Loaded Value",uA==h);
     }
 
+    /* Sharded save and parallel load of the same data */
+    mu_assert("Save Sharded",TestA.saveSharded("/tmp",4));
+    mu_assert("Save Sharded",Test9SaveSharded("/tmp",3));
+    TestAFree();
+    Test9Free();
+    TIMEINFO("Sharded save done");/* Print time info if enabled */
+    mu_assert("Load Parallel",TestALoadParallel("/tmp",4));
+    mu_assert("Load Parallel",Test9.loadParallel("/tmp",2));
+    TIMEINFO("Parallel load done");/* Print time info if enabled */
+    for (i=0;i<4;i++) {
+        sprintf(buf,"/tmp/TestA.%d",i); unlink(buf);
+        sprintf(buf,"/tmp/Test9.%d",i); unlink(buf);
+    }
+    mu_assert("Parallel Count",TestACount()==count);
+    mu_assert("Parallel Count",Test9Count()==count);
+    mu_assert("Missing shards",!Test9LoadParallel("/tmp",2));
+    for (i=0;i<max;i++) {
+        uint32_t u9;
+        uint64_t uA;
+        h=Test7Val(i)>>1;
+        sprintf(buf,"%d",i);
+        mu_assert("Get Parallel Value",Test9Get(h,&u9));
+        mu_assert("Check Parallel Value",u9==i);
+        mu_assert("Get Parallel Value",TestAGet(buf,&uA));
+        mu_assert("Check Parallel Value",uA==h);
+    }
+
     Test9Free();
     TestAFree();
     TIMEINFO("Two Frees full list done");/* Print time info if enabled */
@@ -1424,11 +2479,32 @@ static char * all_tests() {
     mu_run_test(testHashItem);
     mu_run_test(testHashHasKey);
     mu_run_test(testHashDel);
+    mu_run_test(testHashRange);
+    mu_run_test(testHashPrefix);
+    mu_run_test(testHashVisit);
+    mu_run_test(testHashUpdate);
+    mu_run_test(testHashGetMany);
+    mu_run_test(testHashTTL);
+    mu_run_test(testHashCache);
     mu_run_test(testForEach);
     mu_run_test(testHashLoad);
+    mu_run_test(testHashDelta);
     mu_run_test(testFifo);
+    mu_run_test(testPQueue);
     mu_run_test(testHashFree);
     mu_run_test(testNetShare);
+    mu_run_test(testNetSync);
+    mu_run_test(testNetLoss);
+    mu_run_test(testNetDigest);
+    mu_run_test(testNetRepair);
+    mu_run_test(testNetCoalesce);
+    mu_run_test(testNetFilter);
+    mu_run_test(testNetLocal);
+    mu_run_test(testNetPartition);
+    mu_run_test(testNetPace);
+    mu_run_test(testNetFrag);
+    mu_run_test(testNetUpdate);
+    mu_run_test(testNetTTL);
     DBUG_SW(false);
     mu_run_test(testLargeHash);
     mu_run_test(testThreadMain);
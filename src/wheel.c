@@ -0,0 +1,217 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @brief Hierarchical timer wheel for expiring keys.  Each level has
+ * WHEEL_SLOTS slots, a slot of one level spans a full turn of the level
+ * below.  A key is placed by the ticks left until it expires, and moves down
+ * a level each time the level below wraps, so adding a key and firing it cost
+ * a constant amount of work however many keys are waiting.  Keys further out
+ * than the top level wait in its last slot and are placed again on each turn.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wheel.h"
+
+#define WHEEL_BITS 6                    /**< Bits of tick per level */
+#define WHEEL_SLOTS (1<<WHEEL_BITS)     /**< Slots per level */
+#define WHEEL_MASK (WHEEL_SLOTS-1)
+#define WHEEL_LEVELS 4                  /**< Levels, 2^24 ticks in all */
+#define WHEEL_SPAN (1u<<(WHEEL_BITS*WHEEL_LEVELS)) /**< Ticks the wheel holds */
+
+/** Slot index of a tick in a level */
+#define WHEEL_INDEX(t,level) (((t)>>((level)*WHEEL_BITS))&WHEEL_MASK)
+
+/** Key waiting for its tick */
+typedef struct {
+    void *key;          /**< Allocated key, freed when fired */
+    uint32_t expire;    /**< Tick the key expires at */
+} wheel_timer_t;
+
+/** Growing array of the timers in a slot */
+typedef struct {
+    wheel_timer_t *timers;
+    int count;
+    int max;
+} wheel_slot_t;
+
+struct wheel {
+    uint32_t tick;          /**< Next tick to fire */
+    uint32_t count;         /**< Keys waiting */
+    bool cascaded;          /**< Upper levels are moved down for tick */
+    wheel_slot_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/**
+ * Create an empty wheel.
+ * @param tick First tick to fire
+ * @return Wheel or NULL on allocation failure
+ */
+wheel_t *wheel_init(uint32_t tick)
+{
+    wheel_t *wheel=calloc(1,sizeof(*wheel));
+
+    if (wheel) wheel->tick=tick;
+    return wheel;
+}
+
+/** Free a wheel and the keys still waiting in it */
+void wheel_free(wheel_t *wheel)
+{
+    int level,i,j;
+
+    for (level=0;level<WHEEL_LEVELS;level++) {
+        for (i=0;i<WHEEL_SLOTS;i++) {
+            wheel_slot_t *slot=&wheel->slots[level][i];
+            for (j=0;j<slot->count;j++) free(slot->timers[j].key);
+            free(slot->timers);
+        }
+    }
+    free(wheel);
+}
+
+/** Next tick the wheel fires */
+uint32_t wheel_tick(wheel_t *wheel)
+{
+    return wheel->tick;
+}
+
+/** Append a timer to the slot of its level */
+static bool wheel_place(wheel_t *wheel,wheel_timer_t *timer)
+{
+    int32_t delta=(int32_t)(timer->expire-wheel->tick);
+    uint32_t expire=timer->expire;
+    wheel_slot_t *slot;
+    int level;
+
+    if (delta<0) {
+        /* Late, fire on the next tick */
+        expire=wheel->tick;
+    } else if ((uint32_t)delta>=WHEEL_SPAN) {
+        /* Beyond the top level, wait in its last slot */
+        expire=wheel->tick+WHEEL_SPAN-1;
+    }
+    delta=(int32_t)(expire-wheel->tick);
+    for (level=0;level<WHEEL_LEVELS-1;level++) {
+        if ((uint32_t)delta<(1u<<((level+1)*WHEEL_BITS))) break;
+    }
+    slot=&wheel->slots[level][WHEEL_INDEX(expire,level)];
+    if (slot->count==slot->max) {
+        int max=(slot->max) ? slot->max*2 : 4;
+        wheel_timer_t *timers=realloc(slot->timers,max*sizeof(*timers));
+        if (timers==NULL) return false;
+        slot->timers=timers;
+        slot->max=max;
+    }
+    slot->timers[slot->count++]=*timer;
+    return true;
+}
+
+/**
+ * Add a key to expire at a tick.
+ * @param wheel Timer wheel
+ * @param key Allocated key, owned by the wheel on success
+ * @param expire Tick the key expires at
+ * @return false on allocation failure
+ */
+bool wheel_add(wheel_t *wheel,void *key,uint32_t expire)
+{
+    wheel_timer_t timer={.key=key,.expire=expire};
+
+    if (!wheel_place(wheel,&timer)) return false;
+    wheel->count++;
+    return true;
+}
+
+/**
+ * Find the next tick that needs an advance.  Keys of the upper levels move
+ * down as the lowest level wraps, so that tick is the latest returned.
+ * @param wheel Timer wheel
+ * @param next Set to the tick of the first waiting key or lowest level wrap
+ * @return false if no keys are waiting
+ */
+bool wheel_next(wheel_t *wheel,uint32_t *next)
+{
+    uint32_t t=wheel->tick;
+
+    if (wheel->count==0) return false;
+    if ((wheel->cascaded)||(WHEEL_INDEX(t,0)!=0)) {
+        while (wheel->slots[0][WHEEL_INDEX(t,0)].count==0) {
+            if (WHEEL_INDEX(++t,0)==0) break;
+        }
+    }
+    *next=t;
+    return true;
+}
+
+/** Move the timers of a slot of an upper level down, return the slot index */
+static int wheel_cascade(wheel_t *wheel,int level)
+{
+    int index=WHEEL_INDEX(wheel->tick,level);
+    wheel_slot_t slot=wheel->slots[level][index];
+    int i;
+
+    memset(&wheel->slots[level][index],0x00,sizeof(slot));
+    for (i=0;i<slot.count;i++) {
+        /* Placement only grows a lower slot, on failure the key is lost */
+        if (!wheel_place(wheel,&slot.timers[i])) {
+            free(slot.timers[i].key);
+            wheel->count--;
+        }
+    }
+    free(slot.timers);
+    return index;
+}
+
+/**
+ * Fire the keys expiring up to now, at most max of them.
+ * @param wheel Timer wheel
+ * @param now Current tick, keys expiring at or before it fire
+ * @param fire Called for each expired key, it may add keys
+ * @param ctx Pointer passed to fire
+ * @param max Most keys to fire in this call
+ * @return Number of keys fired, max when more are waiting
+ */
+int wheel_advance(wheel_t *wheel,uint32_t now,wheel_fire_fn_t fire,void *ctx,int max)
+{
+    int count=0;
+
+    while (((int32_t)(now-wheel->tick)>=0)&&(count<max)) {
+        wheel_slot_t *slot=&wheel->slots[0][WHEEL_INDEX(wheel->tick,0)];
+
+        if ((!wheel->cascaded)&&(WHEEL_INDEX(wheel->tick,0)==0)) {
+            int level;
+            for (level=1;(level<WHEEL_LEVELS)&&(wheel_cascade(wheel,level)==0);level++);
+        }
+        wheel->cascaded=true;
+        while ((slot->count)&&(count<max)) {
+            /* fire may add keys, growing this slot */
+            wheel_timer_t timer=slot->timers[--slot->count];
+            wheel->count--;
+            fire(timer.key,timer.expire,ctx);
+            free(timer.key);
+            count++;
+        }
+        if (slot->count) break;
+        wheel->tick++;
+        wheel->cascaded=false;
+    }
+    return count;
+}
+/**@}*/
@@ -0,0 +1,46 @@
+/**
+ * @file
+ * @author Scott Milano
+ * @copyright Copyright 2019 Scott Milano
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * @{
+ */
+
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+#include<stdint.h>
+#include<stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Hierarchical timer wheel of keys, one per store with expiring entries */
+typedef struct wheel wheel_t;
+
+/** Called for each expired key, the wheel frees the key after the call */
+typedef void (*wheel_fire_fn_t)(void *key,uint32_t expire,void *ctx);
+
+wheel_t *wheel_init(uint32_t tick);
+void wheel_free(wheel_t *wheel);
+bool wheel_add(wheel_t *wheel,void *key,uint32_t expire);
+int wheel_advance(wheel_t *wheel,uint32_t now,wheel_fire_fn_t fire,void *ctx,int max);
+uint32_t wheel_tick(wheel_t *wheel);
+bool wheel_next(wheel_t *wheel,uint32_t *next);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __WHEEL_H__ */
+/**@}*/